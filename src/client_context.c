@@ -1,5 +1,6 @@
 #include "client_context.h"
 
+#include <pthread.h>
 #include <string.h>
 
 #include "utils.h"
@@ -83,8 +84,14 @@ GeneralizedColumn* lookup_src(char* handle, ClientContext* context) {
   return src_generalized_col;
 }
 
+/*
+ * Batched operators run in parallel and insert their results concurrently.
+ */
+static pthread_mutex_t result_context_lock = PTHREAD_MUTEX_INITIALIZER;
+
 bool insert_result_context(Result* result, char* handle_name,
                            ClientContext* context) {
+  pthread_mutex_lock(&result_context_lock);
   GeneralizedColumnHandle* handle_ptr = lookup_context(handle_name, context);
   if (handle_ptr != NULL) {
     if (handle_ptr->generalized_column.column_type == RESULT) {
@@ -112,6 +119,7 @@ bool insert_result_context(Result* result, char* handle_name,
     context->chandles_in_use += 1;
     // free(handle_ptr);
   }
+  pthread_mutex_unlock(&result_context_lock);
   return true;
 }
 
@@ -0,0 +1,195 @@
+#include "db_bitvector.h"
+
+#include <string.h>
+
+#include "utils.h"
+
+Bitvector* bitvector_allocate(size_t num_bits) {
+  Bitvector* bits = calloc(
+      1, sizeof(Bitvector) + bitvector_num_words(num_bits) * sizeof(uint64_t));
+  if (bits == NULL) {
+    log_err("%s:%d could not allocate bitvector of %ld bits\n", __FILE__,
+            __LINE__, num_bits);
+    return NULL;
+  }
+  bits->num_bits = num_bits;
+  return bits;
+}
+
+Bitvector* bitvector_resize(Bitvector* bits, size_t num_bits) {
+  size_t old_words = bitvector_num_words(bits->num_bits);
+  size_t new_words = bitvector_num_words(num_bits);
+  Bitvector* resized =
+      realloc(bits, sizeof(Bitvector) + new_words * sizeof(uint64_t));
+  if (resized == NULL) {
+    log_err("%s:%d could not resize bitvector to %ld bits\n", __FILE__,
+            __LINE__, num_bits);
+    return NULL;
+  }
+  if (new_words > old_words) {
+    memset(&resized->words[old_words], 0,
+           (new_words - old_words) * sizeof(uint64_t));
+  } else if (num_bits % 64 != 0) {
+    // keep the invariant that bits past num_bits are zero
+    resized->words[new_words - 1] &= ((uint64_t)1 << (num_bits % 64)) - 1;
+  }
+  resized->num_bits = num_bits;
+  return resized;
+}
+
+void bitvector_set_range(Bitvector* bits, size_t start, size_t end) {
+  while (start < end && start % 64 != 0) {
+    bitvector_set(bits, start++);
+  }
+  for (; start + 64 <= end; start += 64) {
+    bits->words[start / 64] = ~(uint64_t)0;
+  }
+  while (start < end) {
+    bitvector_set(bits, start++);
+  }
+}
+
+size_t bitvector_count(const Bitvector* bits) {
+  size_t count = 0;
+  size_t num_words = bitvector_num_words(bits->num_bits);
+  for (size_t w = 0; w < num_words; w++) {
+    count += __builtin_popcountll(bits->words[w]);
+  }
+  return count;
+}
+
+size_t bitvector_count_from(const Bitvector* bits, size_t start) {
+  if (start >= bits->num_bits) {
+    return 0;
+  }
+  size_t num_words = bitvector_num_words(bits->num_bits);
+  size_t count = __builtin_popcountll(bits->words[start / 64] >> (start % 64));
+  for (size_t w = start / 64 + 1; w < num_words; w++) {
+    count += __builtin_popcountll(bits->words[w]);
+  }
+  return count;
+}
+
+size_t bitvector_count_words(const Bitvector* bits, size_t first_word,
+                             size_t last_word) {
+  size_t count = 0;
+  for (size_t w = first_word; w < last_word; w++) {
+    count += __builtin_popcountll(bits->words[w]);
+  }
+  return count;
+}
+
+size_t bitvector_to_positions(const Bitvector* bits, size_t* positions) {
+  return bitvector_words_to_positions(bits, 0,
+                                      bitvector_num_words(bits->num_bits),
+                                      positions);
+}
+
+size_t bitvector_words_to_positions(const Bitvector* bits, size_t first_word,
+                                    size_t last_word, size_t* positions) {
+  size_t j = 0;
+  for (size_t w = first_word; w < last_word; w++) {
+    uint64_t word = bits->words[w];
+    while (word != 0) {
+      positions[j++] = w * 64 + __builtin_ctzll(word);
+      // clear the lowest set bit
+      word &= word - 1;
+    }
+  }
+  return j;
+}
+
+Bitvector* positions_to_bitvector(const size_t* positions, size_t num_positions,
+                                  size_t num_bits) {
+  Bitvector* bits = bitvector_allocate(num_bits);
+  if (bits == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < num_positions; i++) {
+    if (positions[i] < num_bits) {
+      bitvector_set(bits, positions[i]);
+    }
+  }
+  return bits;
+}
+
+Bitvector* bitvector_and(const Bitvector* left, const Bitvector* right) {
+  const Bitvector* shorter = left->num_bits < right->num_bits ? left : right;
+  const Bitvector* longer = shorter == left ? right : left;
+  Bitvector* bits = bitvector_allocate(longer->num_bits);
+  if (bits == NULL) {
+    return NULL;
+  }
+  bits->column = left->column != NULL ? left->column : right->column;
+  size_t num_words = bitvector_num_words(shorter->num_bits);
+  for (size_t w = 0; w < num_words; w++) {
+    bits->words[w] = left->words[w] & right->words[w];
+  }
+  return bits;
+}
+
+Bitvector* bitvector_or(const Bitvector* left, const Bitvector* right) {
+  const Bitvector* shorter = left->num_bits < right->num_bits ? left : right;
+  const Bitvector* longer = shorter == left ? right : left;
+  Bitvector* bits = bitvector_allocate(longer->num_bits);
+  if (bits == NULL) {
+    return NULL;
+  }
+  bits->column = left->column != NULL ? left->column : right->column;
+  size_t short_words = bitvector_num_words(shorter->num_bits);
+  size_t long_words = bitvector_num_words(longer->num_bits);
+  for (size_t w = 0; w < short_words; w++) {
+    bits->words[w] = left->words[w] | right->words[w];
+  }
+  memcpy(&bits->words[short_words], &longer->words[short_words],
+         (long_words - short_words) * sizeof(uint64_t));
+  return bits;
+}
+
+Bitvector* bitvector_not(const Bitvector* bits) {
+  Bitvector* negated = bitvector_allocate(bits->num_bits);
+  if (negated == NULL) {
+    return NULL;
+  }
+  size_t num_words = bitvector_num_words(bits->num_bits);
+  for (size_t w = 0; w < num_words; w++) {
+    negated->words[w] = ~bits->words[w];
+  }
+  if (bits->num_bits % 64 != 0) {
+    negated->words[num_words - 1] &=
+        ((uint64_t)1 << (bits->num_bits % 64)) - 1;
+  }
+  negated->column = bits->column;
+  if (bits->column != NULL) {
+    for (size_t k = 0; k < bits->column->update_struct.del_length; k++) {
+      if (bits->column->update_struct.del_pos[k] < negated->num_bits) {
+        bitvector_clear(negated, bits->column->update_struct.del_pos[k]);
+      }
+    }
+  }
+  return negated;
+}
+
+bool result_to_positionlist(Result* result) {
+  if (result->data_type == POSITIONLIST) {
+    return true;
+  }
+  if (result->data_type != BITVECTOR) {
+    return false;
+  }
+  Bitvector* bits = result->payload;
+  size_t* positions = NULL;
+  if (result->num_tuples > 0) {
+    positions = malloc(result->num_tuples * sizeof(size_t));
+    if (positions == NULL) {
+      log_err("%s:%d could not allocate position list\n", __FILE__, __LINE__);
+      return false;
+    }
+    bitvector_to_positions(bits, positions);
+  }
+  free(bits);
+  // positions come out in increasing order so pending inserts stay at the end
+  result->payload = positions;
+  result->data_type = POSITIONLIST;
+  return true;
+}
@@ -0,0 +1,58 @@
+#include "db_bloom.h"
+
+#include <stdlib.h>
+
+#include "db_morsel.h"
+
+typedef struct BloomMorselArgs {
+  BloomFilter* filter;
+  const int* values;
+} BloomMorselArgs;
+
+static void bloom_morsel(void* arg, size_t morsel, size_t start, size_t end) {
+  (void)morsel;
+  BloomMorselArgs* args = (BloomMorselArgs*)arg;
+  BloomFilter* filter = args->filter;
+  for (size_t i = start; i < end; i++) {
+    uint64_t hash = mix_hash(args->values[i]);
+    // other morsels may set bits of the same word
+    __atomic_fetch_or(&filter->words[hash >> filter->word_shift],
+                      bloom_mask(hash), __ATOMIC_RELAXED);
+  }
+}
+
+BloomFilter* bloom_create(const int* values, size_t num_values) {
+  BloomFilter* filter = malloc(sizeof(BloomFilter));
+  // at least 2 words, a single word would need a shift by 64
+  size_t num_words = 2;
+  unsigned word_bits = 1;
+  while (num_words * 64 < num_values * BLOOM_BITS_PER_KEY) {
+    num_words *= 2;
+    word_bits += 1;
+  }
+  filter->words = calloc(num_words, sizeof(uint64_t));
+  filter->word_shift = 64 - word_bits;
+  BloomMorselArgs args = {.filter = filter, .values = values};
+  morsel_run(num_values, &bloom_morsel, &args);
+  return filter;
+}
+
+double bloom_pass_rate(const BloomFilter* filter, const int* values,
+                       size_t num_values) {
+  if (num_values == 0) {
+    return 0.0;
+  }
+  size_t step = num_values / BLOOM_SAMPLE_SIZE + 1;
+  size_t sampled = 0;
+  size_t passed = 0;
+  for (size_t i = 0; i < num_values; i += step) {
+    passed += bloom_contains(filter, values[i]);
+    sampled += 1;
+  }
+  return (double)passed / (double)sampled;
+}
+
+void bloom_free(BloomFilter* filter) {
+  free(filter->words);
+  free(filter);
+}
@@ -0,0 +1,272 @@
+#include "db_groupby.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db_hashtable.h"
+#include "db_morsel.h"
+#include "db_threadpool.h"
+
+// the low bits of a key's hash pick its partition when the thread-local
+// tables are merged, slots within a table use the bits above them
+#define GROUP_PARTITION_BITS 6
+#define GROUP_PARTITIONS (1 << GROUP_PARTITION_BITS)
+#define GROUP_TABLE_INIT_SIZE 1024
+
+/*
+ * Open addressing table with linear probing, kept at most half full.
+ * An entry with count 0 is an empty slot. capacity is a power of 2.
+ */
+typedef struct GroupTable {
+  GroupEntry* entries;
+  size_t capacity;
+  size_t num_groups;
+} GroupTable;
+
+typedef struct GroupByArgs {
+  const int* keys;
+  const int* const* values;
+  size_t num_values;
+  size_t num_workers;
+  GroupTable* tables;
+  // groups of worker w in partition p are counted in counts[w][p], which
+  // then becomes their offset in partitioned
+  size_t (*counts)[GROUP_PARTITIONS];
+  size_t partition_starts[GROUP_PARTITIONS + 1];
+  size_t partition_groups[GROUP_PARTITIONS];
+  GroupEntry* partitioned;
+} GroupByArgs;
+
+typedef struct GroupByTask {
+  GroupByArgs* args;
+  size_t index;
+} GroupByTask;
+
+static inline uint32_t group_hash(int key) { return (uint32_t)hash_func(key); }
+
+static inline size_t group_partition(int key) {
+  return group_hash(key) & (GROUP_PARTITIONS - 1);
+}
+
+static void group_table_init(GroupTable* table, size_t capacity) {
+  table->entries = calloc(capacity, sizeof(GroupEntry));
+  table->capacity = capacity;
+  table->num_groups = 0;
+}
+
+/*
+ * Slot of key, either the one holding it or the empty slot it goes in.
+ */
+static inline size_t group_table_slot(const GroupTable* table, int key) {
+  size_t mask = table->capacity - 1;
+  size_t slot = (group_hash(key) >> GROUP_PARTITION_BITS) & mask;
+  while (table->entries[slot].count != 0 && table->entries[slot].key != key) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+static void group_table_grow(GroupTable* table) {
+  GroupTable grown;
+  group_table_init(&grown, table->capacity * 2);
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (table->entries[i].count != 0) {
+      grown.entries[group_table_slot(&grown, table->entries[i].key)] =
+          table->entries[i];
+    }
+  }
+  grown.num_groups = table->num_groups;
+  free(table->entries);
+  *table = grown;
+}
+
+/*
+ * Entry of key, a new one is set to the identities of each aggregate. The
+ * caller must add to count before looking up another key.
+ */
+static inline GroupEntry* group_table_find(GroupTable* table, int key,
+                                           size_t num_values) {
+  if (2 * (table->num_groups + 1) > table->capacity) {
+    group_table_grow(table);
+  }
+  GroupEntry* entry = &table->entries[group_table_slot(table, key)];
+  if (entry->count == 0) {
+    entry->key = key;
+    for (size_t v = 0; v < num_values; v++) {
+      entry->sums[v] = 0;
+      entry->mins[v] = INT_MAX;
+      entry->maxs[v] = INT_MIN;
+    }
+    table->num_groups += 1;
+  }
+  return entry;
+}
+
+static void group_morsel(void* arg, size_t worker, size_t morsel, size_t start,
+                         size_t end) {
+  (void)morsel;
+  GroupByArgs* args = (GroupByArgs*)arg;
+  GroupTable* table = &args->tables[worker];
+  if (table->entries == NULL) {
+    group_table_init(table, GROUP_TABLE_INIT_SIZE);
+  }
+  for (size_t i = start; i < end; i++) {
+    GroupEntry* entry =
+        group_table_find(table, args->keys[i], args->num_values);
+    entry->count += 1;
+    for (size_t v = 0; v < args->num_values; v++) {
+      int value = args->values[v][i];
+      entry->sums[v] += value;
+      entry->mins[v] = value < entry->mins[v] ? value : entry->mins[v];
+      entry->maxs[v] = value > entry->maxs[v] ? value : entry->maxs[v];
+    }
+  }
+}
+
+static void* partition_count_task(void* task_arg) {
+  GroupByTask* task = (GroupByTask*)task_arg;
+  GroupTable* table = &task->args->tables[task->index];
+  size_t* counts = task->args->counts[task->index];
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (table->entries[i].count != 0) {
+      counts[group_partition(table->entries[i].key)] += 1;
+    }
+  }
+  return NULL;
+}
+
+static void* partition_scatter_task(void* task_arg) {
+  GroupByTask* task = (GroupByTask*)task_arg;
+  GroupTable* table = &task->args->tables[task->index];
+  size_t* offsets = task->args->counts[task->index];
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (table->entries[i].count != 0) {
+      task->args->partitioned[offsets[group_partition(
+          table->entries[i].key)]++] = table->entries[i];
+    }
+  }
+  free(table->entries);
+  table->entries = NULL;
+  return NULL;
+}
+
+/*
+ * Merges the groups of one partition, then writes the merged groups back
+ * over the start of the partition.
+ */
+static void* partition_merge_task(void* task_arg) {
+  GroupByTask* task = (GroupByTask*)task_arg;
+  GroupByArgs* args = task->args;
+  GroupEntry* groups = &args->partitioned[args->partition_starts[task->index]];
+  size_t num_entries = args->partition_starts[task->index + 1] -
+                       args->partition_starts[task->index];
+  if (num_entries == 0) {
+    args->partition_groups[task->index] = 0;
+    return NULL;
+  }
+  // sized for every entry being distinct so the table never grows
+  size_t capacity = GROUP_TABLE_INIT_SIZE;
+  while (capacity < 2 * num_entries + 2) {
+    capacity *= 2;
+  }
+  GroupTable table;
+  group_table_init(&table, capacity);
+  for (size_t i = 0; i < num_entries; i++) {
+    GroupEntry* entry =
+        group_table_find(&table, groups[i].key, args->num_values);
+    entry->count += groups[i].count;
+    for (size_t v = 0; v < args->num_values; v++) {
+      entry->sums[v] += groups[i].sums[v];
+      entry->mins[v] =
+          groups[i].mins[v] < entry->mins[v] ? groups[i].mins[v]
+                                             : entry->mins[v];
+      entry->maxs[v] =
+          groups[i].maxs[v] > entry->maxs[v] ? groups[i].maxs[v]
+                                             : entry->maxs[v];
+    }
+  }
+  size_t j = 0;
+  for (size_t i = 0; i < table.capacity; i++) {
+    if (table.entries[i].count != 0) {
+      groups[j++] = table.entries[i];
+    }
+  }
+  args->partition_groups[task->index] = j;
+  free(table.entries);
+  return NULL;
+}
+
+static void run_group_tasks(GroupByArgs* args, size_t num_tasks,
+                            TaskFunc func) {
+  GroupByTask* tasks = malloc(num_tasks * sizeof(GroupByTask));
+  TaskGroup group = {0};
+  for (size_t i = 0; i < num_tasks; i++) {
+    tasks[i] = (GroupByTask){.args = args, .index = i};
+    threadpool_submit(g_pool, &group, func, &tasks[i]);
+  }
+  threadpool_wait(g_pool, &group);
+  free(tasks);
+}
+
+static int compare_group_keys(const void* a, const void* b) {
+  int left = ((const GroupEntry*)a)->key;
+  int right = ((const GroupEntry*)b)->key;
+  return (left > right) - (left < right);
+}
+
+GroupEntry* group_by(const int* keys, const int* const* values,
+                     size_t num_values, size_t num_rows, size_t* num_groups) {
+  *num_groups = 0;
+  if (num_rows == 0) {
+    return NULL;
+  }
+  GroupByArgs args = {.keys = keys,
+                      .values = values,
+                      .num_values = num_values,
+                      .num_workers = morsel_num_workers(num_rows)};
+  args.tables = calloc(args.num_workers, sizeof(GroupTable));
+  morsel_run_workers(num_rows, &group_morsel, &args);
+
+  GroupEntry* groups;
+  if (args.num_workers == 1) {
+    // a single table already holds distinct keys
+    groups = malloc(args.tables[0].num_groups * sizeof(GroupEntry));
+    for (size_t i = 0; i < args.tables[0].capacity; i++) {
+      if (args.tables[0].entries[i].count != 0) {
+        groups[(*num_groups)++] = args.tables[0].entries[i];
+      }
+    }
+    free(args.tables[0].entries);
+  } else {
+    // two pass counting: count the groups of each table per partition, turn
+    // the counts into offsets and scatter the groups to their partition
+    args.counts = calloc(args.num_workers, sizeof(*args.counts));
+    run_group_tasks(&args, args.num_workers, &partition_count_task);
+    size_t offset = 0;
+    for (size_t p = 0; p < GROUP_PARTITIONS; p++) {
+      args.partition_starts[p] = offset;
+      for (size_t w = 0; w < args.num_workers; w++) {
+        size_t count = args.counts[w][p];
+        args.counts[w][p] = offset;
+        offset += count;
+      }
+    }
+    args.partition_starts[GROUP_PARTITIONS] = offset;
+    args.partitioned = malloc((offset + 1) * sizeof(GroupEntry));
+    run_group_tasks(&args, args.num_workers, &partition_scatter_task);
+    run_group_tasks(&args, GROUP_PARTITIONS, &partition_merge_task);
+
+    groups = args.partitioned;
+    for (size_t p = 0; p < GROUP_PARTITIONS; p++) {
+      memmove(&groups[*num_groups], &groups[args.partition_starts[p]],
+              args.partition_groups[p] * sizeof(GroupEntry));
+      *num_groups += args.partition_groups[p];
+    }
+    free(args.counts);
+  }
+  free(args.tables);
+  qsort(groups, *num_groups, sizeof(GroupEntry), &compare_group_keys);
+  return groups;
+}
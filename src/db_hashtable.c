@@ -1,93 +1,289 @@
 #include "db_hashtable.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <signal.h>
+#include <string.h>
+
+#include "main_api.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HT_X86 1
+#endif
+
+// keys past the last one which a 16 wide comparison may read
+#define KEY_PADDING 16
+
+typedef void (*ProbeBucketsFunc)(const HashTable*, const int*, const size_t*,
+                                 const size_t*, const size_t*, size_t,
+                                 JoinChunk*, bool*);
 
 HashTable* ht_allocate(size_t size) {
   HashTable* ht = malloc(sizeof(HashTable));
-  ht->keys = malloc(sizeof(int) * size);
+  ht->keys = malloc(sizeof(int) * (size + KEY_PADDING));
   // raise(SIGINT);
   ht->positions = malloc(sizeof(size_t) * size);
-  ht->offsets = calloc(size, sizeof(size_t));
-  ht->bucket_offsets = calloc(size, sizeof(size_t));
   ht->size = size;
-  ht->num_buckets = size / 4;
-  // edge case for very small partitions
-  if (ht->num_buckets == 0) {
-    ht->num_buckets += 1;
+  // power of 2 so the bucket is the low bits of the hash, also covers the
+  // edge case of very small partitions
+  ht->num_buckets = 1;
+  while (ht->num_buckets < size / 4) {
+    ht->num_buckets *= 2;
   }
-  ht->bucket_counts = calloc(ht->num_buckets, sizeof(size_t));
+  ht->bucket_mask = ht->num_buckets - 1;
+  ht->offsets = calloc(ht->num_buckets + 1, sizeof(size_t));
 
   return ht;
 }
 
-// Adpated from
-// https://stackoverflow.com/questions/664014/what-integer-hash-function-are-good-that-accepts-an-integer-hash-key
-static inline size_t hash_func(int x) {
-  x = ((x >> 16) ^ x) * 0x45d9f3b;
-  x = ((x >> 16) ^ x) * 0x45d9f3b;
-  x = (x >> 16) ^ x;
-  return (size_t)x;
-}
-
 int bulk_ht_load(HashTable* ht, int* keys, size_t* vals, size_t num_values) {
   assert(num_values <= ht->size);
-  // step 1 count bucket size
+  // step 1 count bucket size, bucket b is counted in offsets[b + 1]
   for (size_t i = 0; i < num_values; i++) {
-    // using modulo here, but could use bit shifting if num_buckets was a power
-    // of 2
-    ht->bucket_counts[hash_func(keys[i]) % ht->num_buckets] += 1;
+    ht->offsets[(hash_func(keys[i]) & ht->bucket_mask) + 1] += 1;
   }
 
-  size_t curr_offset = 0;
   // calculate bucket offsets
   for (size_t i = 0; i < ht->num_buckets; i++) {
-    ht->offsets[i] = curr_offset;
-    curr_offset += ht->bucket_counts[i];
-    // printf("curr_offset %ld ith offset %ld\n", curr_offset, ht->offsets[i] );
+    ht->offsets[i + 1] += ht->offsets[i];
   }
 
-  // insert into table
-  size_t offset;
+  // insert into table, next_offsets is where the next item of each bucket
+  // goes
+  size_t* next_offsets = malloc(sizeof(size_t) * ht->num_buckets);
+  memcpy(next_offsets, ht->offsets, sizeof(size_t) * ht->num_buckets);
   for (size_t i = 0; i < num_values; i++) {
-    size_t hash = hash_func(keys[i]) % ht->num_buckets;
-
-    offset = ht->offsets[hash] + ht->bucket_offsets[hash];
+    size_t offset = next_offsets[hash_func(keys[i]) & ht->bucket_mask]++;
     ht->keys[offset] = keys[i];
     ht->positions[offset] = vals[i];
-    ht->bucket_offsets[hash] += 1;
   }
+  free(next_offsets);
+  memset(&ht->keys[num_values], 0, sizeof(int) * KEY_PADDING);
 
   return 1;
 }
-// returns all matching values in hashtable in values and number in num_values
-int get(HashTable* ht, int key, size_t** values, size_t* num_values,
-        size_t* value_init_length) {
-  size_t hash = hash_func(key) % ht->num_buckets;
-  size_t offset = ht->offsets[hash];
-
-  *num_values = 0;
-  for (size_t i = 0; i < ht->bucket_counts[hash]; i++) {
-    // printf("bucket %ld i: %ld, offset %ld, val %d \n", hash, i, offset,
-    // ht->keys[i+offset]);
-    if (*num_values + 1 >= *value_init_length) {
-      // printf("increase value array \n");
-      *values = realloc(*values, sizeof(size_t) * (*value_init_length + 1));
-      *value_init_length = *value_init_length + 1;
+
+void join_matches_reserve(JoinMatches* matches, size_t extra) {
+  JoinChunk* tail = matches->tail;
+  if (extra == 0 || (tail != NULL && tail->length + extra <= tail->capacity)) {
+    return;
+  }
+  // chunks start small and double up to JOIN_OUTPUT_CHUNK_ROWS, so tasks
+  // with few matches stay small
+  size_t capacity = tail == NULL ? 64 : 2 * tail->capacity;
+  capacity = capacity < JOIN_OUTPUT_CHUNK_ROWS ? capacity
+                                               : JOIN_OUTPUT_CHUNK_ROWS;
+  capacity = capacity > extra ? capacity : extra;
+  JoinChunk* chunk = malloc(sizeof(JoinChunk));
+  chunk->left_positions = malloc(sizeof(size_t) * capacity);
+  chunk->right_positions =
+      matches->left_only ? NULL : malloc(sizeof(size_t) * capacity);
+  chunk->length = 0;
+  chunk->capacity = capacity;
+  chunk->next = NULL;
+  if (tail == NULL) {
+    matches->head = chunk;
+  } else {
+    tail->next = chunk;
+  }
+  matches->tail = chunk;
+}
+
+void join_matches_free(JoinMatches* matches) {
+  JoinChunk* chunk = matches->head;
+  while (chunk != NULL) {
+    JoinChunk* next = chunk->next;
+    free(chunk->left_positions);
+    free(chunk->right_positions);
+    free(chunk);
+    chunk = next;
+  }
+  matches->head = NULL;
+  matches->tail = NULL;
+  matches->length = 0;
+}
+
+/*
+ * The probe kernels compare key i with bucket [starts[i], ends[i]) of the
+ * table and append the matches to chunk, which already has room for every
+ * key of those buckets. If found is not NULL, found[i] is set to whether key
+ * i matched.
+ * Branchless, always writes the candidate pair and only keeps it if the keys
+ * match.
+ */
+static void probe_buckets_scalar(const HashTable* ht, const int* keys,
+                                 const size_t* positions, const size_t* starts,
+                                 const size_t* ends, size_t num_keys,
+                                 JoinChunk* chunk, bool* found) {
+  for (size_t i = 0; i < num_keys; i++) {
+    size_t first_match = chunk->length;
+    for (size_t k = starts[i]; k < ends[i]; k++) {
+      chunk->left_positions[chunk->length] = ht->positions[k];
+      chunk->right_positions[chunk->length] = positions[i];
+      chunk->length += ht->keys[k] == keys[i];
+    }
+    if (found != NULL) {
+      found[i] = chunk->length != first_match;
     }
-    (*values)[*num_values] = ht->positions[i + offset];
-    *num_values = *num_values + (ht->keys[i + offset] == key);
   }
+}
 
-  return 1;
+#ifdef HT_X86
+/*
+ * Compares 8 keys of the bucket at a time, the keys past its end are masked
+ * off.
+ */
+__attribute__((target("avx2"))) static void probe_buckets_avx2(
+    const HashTable* ht, const int* keys, const size_t* positions,
+    const size_t* starts, const size_t* ends, size_t num_keys,
+    JoinChunk* chunk, bool* found) {
+  for (size_t i = 0; i < num_keys; i++) {
+    size_t start = starts[i];
+    size_t end = ends[i];
+    size_t first_match = chunk->length;
+    const __m256i key = _mm256_set1_epi32(keys[i]);
+    for (size_t k = start; k < end; k += 8) {
+      __m256i match = _mm256_cmpeq_epi32(
+          _mm256_loadu_si256((const __m256i*)&ht->keys[k]), key);
+      unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(match));
+      if (end - k < 8) {
+        mask &= (1u << (end - k)) - 1;
+      }
+      for (; mask != 0; mask &= mask - 1) {
+        chunk->left_positions[chunk->length] =
+            ht->positions[k + __builtin_ctz(mask)];
+        chunk->right_positions[chunk->length] = positions[i];
+        chunk->length += 1;
+      }
+    }
+    if (found != NULL) {
+      found[i] = chunk->length != first_match;
+    }
+  }
+}
+
+/*
+ * Compares 16 keys, a whole cache line, of the bucket at a time.
+ */
+__attribute__((target("avx512f"))) static void probe_buckets_avx512(
+    const HashTable* ht, const int* keys, const size_t* positions,
+    const size_t* starts, const size_t* ends, size_t num_keys,
+    JoinChunk* chunk, bool* found) {
+  for (size_t i = 0; i < num_keys; i++) {
+    size_t start = starts[i];
+    size_t end = ends[i];
+    size_t first_match = chunk->length;
+    const __m512i key = _mm512_set1_epi32(keys[i]);
+    for (size_t k = start; k < end; k += 16) {
+      __mmask16 in_bucket =
+          end - k < 16 ? (__mmask16)((1u << (end - k)) - 1) : 0xffff;
+      unsigned mask = _mm512_mask_cmpeq_epi32_mask(
+          in_bucket, _mm512_loadu_si512(&ht->keys[k]), key);
+      for (; mask != 0; mask &= mask - 1) {
+        chunk->left_positions[chunk->length] =
+            ht->positions[k + __builtin_ctz(mask)];
+        chunk->right_positions[chunk->length] = positions[i];
+        chunk->length += 1;
+      }
+    }
+    if (found != NULL) {
+      found[i] = chunk->length != first_match;
+    }
+  }
+}
+#endif
+
+static ProbeBucketsFunc probe_buckets_impl = &probe_buckets_scalar;
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+
+static void init_probe_kernels(void) {
+#ifdef HT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    probe_buckets_impl = &probe_buckets_avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    probe_buckets_impl = &probe_buckets_avx2;
+  }
+#endif
+}
+
+/*
+ * Group prefetching: the keys are probed PROBE_BATCH_SIZE at a time, and
+ * each stage of a probe is done for the whole batch before the next, first
+ * hashing every key and prefetching its bucket offsets, then reading the
+ * offsets and prefetching the bucket's keys and positions, and only then
+ * comparing. The cache misses of the batch overlap rather than each probe
+ * waiting on its own misses one after another.
+ */
+void probe_many(const HashTable* ht, const int* keys, const size_t* positions,
+                size_t num_keys, JoinMatches* matches, bool* found) {
+  pthread_once(&probe_once, &init_probe_kernels);
+  size_t buckets[PROBE_BATCH_SIZE];
+  size_t starts[PROBE_BATCH_SIZE];
+  size_t ends[PROBE_BATCH_SIZE];
+  for (size_t base = 0; base < num_keys; base += PROBE_BATCH_SIZE) {
+    size_t batch_size = num_keys - base < PROBE_BATCH_SIZE ? num_keys - base
+                                                            : PROBE_BATCH_SIZE;
+    for (size_t i = 0; i < batch_size; i++) {
+      buckets[i] = hash_func(keys[base + i]) & ht->bucket_mask;
+      __builtin_prefetch(&ht->offsets[buckets[i]]);
+    }
+    size_t batch_candidates = 0;
+    for (size_t i = 0; i < batch_size; i++) {
+      starts[i] = ht->offsets[buckets[i]];
+      ends[i] = ht->offsets[buckets[i] + 1];
+      batch_candidates += ends[i] - starts[i];
+      __builtin_prefetch(&ht->keys[starts[i]]);
+      __builtin_prefetch(&ht->positions[starts[i]]);
+    }
+    if (batch_candidates == 0) {
+      if (found != NULL) {
+        memset(&found[base], 0, batch_size * sizeof(bool));
+      }
+      continue;
+    }
+    join_matches_reserve(matches, batch_candidates);
+    size_t chunk_length = matches->tail->length;
+    probe_buckets_impl(ht, &keys[base], &positions[base], starts, ends,
+                       batch_size, matches->tail,
+                       found == NULL ? NULL : &found[base]);
+    matches->length += matches->tail->length - chunk_length;
+  }
+}
+
+/*
+ * Group prefetched like probe_many, but each key only needs to know whether
+ * its bucket holds it, so the comparison stops at the first match.
+ */
+void probe_exists(const HashTable* ht, const int* keys, size_t num_keys,
+                  bool* found) {
+  size_t buckets[PROBE_BATCH_SIZE];
+  for (size_t base = 0; base < num_keys; base += PROBE_BATCH_SIZE) {
+    size_t batch_size = num_keys - base < PROBE_BATCH_SIZE ? num_keys - base
+                                                            : PROBE_BATCH_SIZE;
+    for (size_t i = 0; i < batch_size; i++) {
+      buckets[i] = hash_func(keys[base + i]) & ht->bucket_mask;
+      __builtin_prefetch(&ht->offsets[buckets[i]]);
+    }
+    for (size_t i = 0; i < batch_size; i++) {
+      __builtin_prefetch(&ht->keys[ht->offsets[buckets[i]]]);
+    }
+    for (size_t i = 0; i < batch_size; i++) {
+      size_t k = ht->offsets[buckets[i]];
+      size_t end = ht->offsets[buckets[i] + 1];
+      while (k < end && ht->keys[k] != keys[base + i]) {
+        k++;
+      }
+      found[base + i] = k < end;
+    }
+  }
 }
 
 int ht_deallocate(HashTable* ht) {
   free(ht->keys);
   free(ht->positions);
   free(ht->offsets);
-  free(ht->bucket_offsets);
-  free(ht->bucket_counts);
   free(ht);
 
   return 1;
@@ -117,16 +313,16 @@ int main(void) {
     }
 
 
-   size_t* ret_vals = malloc(sizeof(size_t));
-   size_t value_init_length = 1;
-   size_t num_values = 0;
+   int probe = 3;
+   size_t probe_pos = 0;
+   JoinMatches matches = {0};
 
-   get(ht, 3, ret_vals, &num_values, &value_init_length);
+   probe_many(ht, &probe, &probe_pos, 1, &matches, NULL);
 
-   printf("numvals %ld \n", num_values );
+   printf("numvals %ld \n", matches.length );
 
-   for (size_t i= 0; i < num_values; i++){
-		printf("ret val %ld \n", ret_vals[i]);
+   for (size_t i= 0; i < matches.length; i++){
+		printf("ret val %ld \n", matches.head->left_positions[i]);
    }
 
 
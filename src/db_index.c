@@ -1,9 +1,17 @@
 #include "db_index.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <signal.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INDEX_X86 1
+#endif
+
+#include "db_morsel.h"
+#include "db_sort.h"
 #include "main_api.h"
 #include "utils.h"
 
@@ -80,13 +88,28 @@ void pos_qsort(size_t* data, int begin, int end) {
  * one of the inputs
  */
 
+typedef struct ReorderArgs {
+  const int* data;
+  const size_t* positions;
+  int* temp;
+} ReorderArgs;
+
+static void reorder_morsel(void* arg, size_t morsel, size_t start,
+                           size_t end) {
+  (void)morsel;
+  ReorderArgs* args = (ReorderArgs*)arg;
+  for (size_t i = start; i < end; i++) {
+    args->temp[i] = args->data[args->positions[i]];
+  }
+}
+
 void reorder_column_on_position(Column* column, size_t* positions,
                                 size_t allocated_length) {
   // only support int data currently
   int* temp = malloc(sizeof(int) * allocated_length);
-  for (size_t i = 0; i < *column->num_rows; i++) {
-    temp[i] = column->data[positions[i]];
-  }
+  ReorderArgs args = {
+      .data = column->data, .positions = positions, .temp = temp};
+  morsel_run(*column->num_rows, &reorder_morsel, &args);
 
   // column->data is a memmapped file, so we cant just change the pointer
   memcpy(column->data, temp, sizeof(int) * allocated_length);
@@ -107,7 +130,11 @@ void sort_table_on_column(Table* table, Column* column) {
       positions[i] = i;
     }
 
-    db_qsort(column->data, positions, 0, *column->num_rows);
+    int* sorted_values;
+    size_t* sorted_positions;
+    sort_pairs(column->data, positions, *column->num_rows, &sorted_values,
+               &sorted_positions);
+    memcpy(column->data, sorted_values, sizeof(int) * (*column->num_rows));
 
     // for (size_t i = 0; i < *column->num_rows; i++){
     //     printf("pos: %ld, val: %d \n", positions[i], column->data[i]);
@@ -115,9 +142,12 @@ void sort_table_on_column(Table* table, Column* column) {
 
     for (size_t i = 0; i < table->col_count; i++) {
       if (strcmp(table->columns[i].name, column->name) != 0)
-        reorder_column_on_position(&table->columns[i], positions,
+        reorder_column_on_position(&table->columns[i], sorted_positions,
                                    table->table_alloc_size);
     }
+    free(positions);
+    free(sorted_values);
+    free(sorted_positions);
   }
 
   return;
@@ -378,95 +408,252 @@ int sorted_unclustered_delete(SortedIndex* index, size_t pos) {
 // ****************************************************************************
 
 /*
- * given sorted data and positions builds a linked list of the leaf nodes
+ * First index in [lo, hi) of the sorted vals whose value is >= key.
  */
-BNode* build_leaves(int* data, size_t* positions, size_t data_length) {
-  BNode* curr_node = calloc(1, sizeof(BNode));
-  curr_node->previous = NULL;
-  curr_node->is_leaf = true;
-  curr_node->is_root = false;
-  BNode* head = curr_node;
-
-  size_t internal_idx = 0;
-  size_t i = 0;
-  while (i < data_length) {
-    assert(curr_node->num_elements <= FAN_OUT);
-    curr_node->vals[internal_idx] = data[i];
-    curr_node->children.positions[internal_idx] = positions[i];
-    curr_node->num_elements += 1;
-    internal_idx += 1;
-
-    if (internal_idx == FAN_OUT) {
-      internal_idx = 0;
-      BNode* next_node = calloc(1, sizeof(BNode));
-      next_node->is_leaf = true;
-      next_node->is_root = false;
-      curr_node->next = next_node;
-      curr_node = next_node;
-      curr_node->next = NULL;
+static size_t lower_bound_int(const int* vals, size_t lo, size_t hi, int key) {
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (vals[mid] < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
-    i++;
   }
-
-  return head;
+  return lo;
 }
 
+typedef size_t (*LowerBoundFunc)(const int*, size_t, size_t, int);
+
+#ifdef INDEX_X86
 /*
- * Takes in a linked list of the previous layer and constructs the next level up
+ * Blocks start at multiples of 8 keys, so a block never reads past vals, and
+ * its keys before from or from n on are masked off. The keys are sorted, so
+ * the count of keys below key is where the first key >= key is.
  */
-BNode* build_layer(BNode* head_node, size_t* nodes_in_layer) {
-  BNode* curr_node = calloc(1, sizeof(BNode));
-  BNode* first_node = curr_node;
-  curr_node->previous = NULL;
-  curr_node->is_leaf = false;
-  curr_node->is_root = false;
-  BNode* next_node;
-  size_t i = 0;
-  while (head_node != NULL) {
-    assert(curr_node->num_elements <= FAN_OUT);
-    if (curr_node->num_elements == FAN_OUT - 1) {
-      // bug?
-      if (head_node != NULL) {
-        curr_node->children.child_pointers[FAN_OUT] = head_node->next;
-      } else {
-        curr_node->children.child_pointers[FAN_OUT] = NULL;
-      }
+__attribute__((target("avx2"))) static size_t lower_bound_avx2(
+    const int* vals, size_t from, size_t n, int key) {
+  const __m256i keys = _mm256_set1_epi32(key);
+  size_t lower = from;
+  for (size_t k = from & ~(size_t)7; k < n; k += 8) {
+    __m256i below = _mm256_cmpgt_epi32(
+        keys, _mm256_loadu_si256((const __m256i*)&vals[k]));
+    unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(below));
+    unsigned valid = 0xffu;
+    if (k < from) {
+      valid &= 0xffu << (from - k);
+    }
+    if (n - k < 8) {
+      valid &= (1u << (n - k)) - 1;
+    }
+    mask &= valid;
+    lower += __builtin_popcount(mask);
+    if (mask != valid) {
+      break;
+    }
+  }
+  return lower;
+}
 
-      next_node = calloc(1, sizeof(BNode));
-      next_node->previous = curr_node;
-      next_node->is_leaf = false;
-      next_node->is_root = false;
-      curr_node->next = next_node;
-      curr_node = next_node;
-      i = 0;
-      *nodes_in_layer += 1;
+/*
+ * Same with 16 keys, a whole cache line, per comparison.
+ */
+__attribute__((target("avx512f"))) static size_t lower_bound_avx512(
+    const int* vals, size_t from, size_t n, int key) {
+  const __m512i keys = _mm512_set1_epi32(key);
+  size_t lower = from;
+  for (size_t k = from & ~(size_t)15; k < n; k += 16) {
+    unsigned valid = 0xffffu;
+    if (k < from) {
+      valid &= 0xffffu << (from - k);
+    }
+    if (n - k < 16) {
+      valid &= (1u << (n - k)) - 1;
     }
+    unsigned mask = _mm512_mask_cmplt_epi32_mask(
+        (__mmask16)valid, _mm512_loadu_si512(&vals[k]), keys);
+    lower += __builtin_popcount(mask);
+    if (mask != valid) {
+      break;
+    }
+  }
+  return lower;
+}
+#endif
+
+static LowerBoundFunc lower_bound_impl = &lower_bound_int;
+static pthread_once_t lower_bound_once = PTHREAD_ONCE_INIT;
+
+static void init_lower_bound(void) {
+#ifdef INDEX_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    lower_bound_impl = &lower_bound_avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    lower_bound_impl = &lower_bound_avx2;
+  }
+#endif
+}
 
-    curr_node->children.child_pointers[i] = head_node;
-    curr_node->vals[i] = head_node->vals[0];
-    head_node = head_node->next;
-    curr_node->num_elements += 1;
-    i++;
+size_t bnode_lower_bound(const BNode* node, size_t from, int key) {
+  pthread_once(&lower_bound_once, &init_lower_bound);
+  if (from >= node->num_elements) {
+    return node->num_elements;
   }
-  return first_node;
+  return lower_bound_impl(node->vals, from, node->num_elements, key);
 }
 
-// build a btree given sorted data and accompanying positons.
-BNode* build_btree(int* data, size_t* positions, size_t data_length) {
-  BNode* head_node = build_leaves(data, positions, data_length);
-  size_t nodes_in_layer = 0;
-  while (true) {
-    head_node = build_layer(head_node, &nodes_in_layer);
-    // printf("The nodes in the layer go %ld \n", nodes_in_layer );
-    if (nodes_in_layer == 0) {
-      head_node->is_root = true;
-      return head_node;
+BNode* bnode_allocate(bool is_leaf) {
+  // aligned_alloc wants a multiple of the alignment
+  size_t size = (sizeof(BNode) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE *
+                CACHE_LINE_SIZE;
+  BNode* node = aligned_alloc(CACHE_LINE_SIZE, size);
+  memset(node, 0, sizeof(BNode));
+  node->is_leaf = is_leaf;
+  return node;
+}
+
+/*
+ * Leaf which holds the first entry >= key, or the leaf before it. Inner node
+ * keys are the minimum of each child, so the entry is in the last child whose
+ * minimum is below key, or in the first entries of the next leaf when that
+ * child's values below key are all it has.
+ */
+static BNode* btree_descend(BNode* node, int key) {
+  while (node->is_leaf == false) {
+    size_t child = bnode_lower_bound(node, 0, key);
+    node = node->children.child_pointers[child == 0 ? 0 : child - 1];
+  }
+  return node;
+}
+
+/*
+ * One layer of a bulk load. Node n of the layer holds entries
+ * [n * per_node, (n + 1) * per_node) of the layer below, rows of the sorted
+ * data for leaves and nodes of the layer below otherwise, so every node can be
+ * filled on its own.
+ */
+typedef struct BuildLayerArgs {
+  const int* data;
+  const size_t* positions;
+  // NULL when building leaves
+  BNode** children;
+  size_t num_entries;
+  size_t per_node;
+  BNode** nodes;
+  size_t num_nodes;
+} BuildLayerArgs;
+
+// builds the nodes whose first entry is in [start, end)
+static void build_nodes_morsel(void* arg, size_t morsel, size_t start,
+                               size_t end) {
+  (void)morsel;
+  BuildLayerArgs* args = (BuildLayerArgs*)arg;
+  size_t per_node = args->per_node;
+  size_t first = (start + per_node - 1) / per_node;
+  size_t last = (end + per_node - 1) / per_node;
+  for (size_t n = first; n < last; n++) {
+    size_t from = n * per_node;
+    size_t count = args->num_entries - from < per_node
+                       ? args->num_entries - from
+                       : per_node;
+    BNode* node = bnode_allocate(args->children == NULL);
+    if (args->children == NULL) {
+      memcpy(node->vals, &args->data[from], count * sizeof(int));
+      memcpy(node->children.positions, &args->positions[from],
+             count * sizeof(size_t));
     } else {
-      nodes_in_layer = 0;
+      for (size_t i = 0; i < count; i++) {
+        node->children.child_pointers[i] = args->children[from + i];
+        node->vals[i] = args->children[from + i]->vals[0];
+      }
     }
+    node->num_elements = count;
+    args->nodes[n] = node;
+  }
+}
+
+static void link_nodes_morsel(void* arg, size_t morsel, size_t start,
+                              size_t end) {
+  (void)morsel;
+  BuildLayerArgs* args = (BuildLayerArgs*)arg;
+  for (size_t n = start; n < end; n++) {
+    args->nodes[n]->previous = n > 0 ? args->nodes[n - 1] : NULL;
+    args->nodes[n]->next = n + 1 < args->num_nodes ? args->nodes[n + 1] : NULL;
   }
 }
 
+static size_t node_fill(double fill_factor, size_t min_entries) {
+  size_t entries = (size_t)(FAN_OUT * fill_factor);
+  entries = entries < min_entries ? min_entries : entries;
+  return entries > FAN_OUT ? FAN_OUT : entries;
+}
+
+/*
+ * Builds the layer above args->children, or the leaves, and returns its nodes
+ * in key order.
+ */
+static BNode** build_layer(BuildLayerArgs* args) {
+  args->num_nodes = (args->num_entries + args->per_node - 1) / args->per_node;
+  args->nodes = malloc(sizeof(BNode*) * (args->num_nodes + 1));
+  morsel_run(args->num_entries, &build_nodes_morsel, args);
+  // an empty tree still has a leaf
+  if (args->num_nodes == 0) {
+    args->nodes[0] = bnode_allocate(true);
+    args->num_nodes = 1;
+  }
+  morsel_run(args->num_nodes, &link_nodes_morsel, args);
+  return args->nodes;
+}
+
+/*
+ * Bottom up bulk load of a btree given sorted data and accompanying
+ * positions. The leaves are filled to BTREE_LEAF_FILL and inner nodes to
+ * BTREE_INNER_FILL, leaving room for inserts. Each layer is built in parallel
+ * a morsel of entries at a time, then the layer above it, until a layer is a
+ * single node, the root. The root is always an inner node.
+ */
+BNode* build_btree(int* data, size_t* positions, size_t data_length) {
+  BuildLayerArgs args = {.data = data,
+                         .positions = positions,
+                         .children = NULL,
+                         .num_entries = data_length,
+                         .per_node = node_fill(BTREE_LEAF_FILL, 1)};
+  BNode** layer = build_layer(&args);
+  // at least 2 children per inner node, or the layers would never shrink
+  size_t inner_per_node = node_fill(BTREE_INNER_FILL, 2);
+  do {
+    args.children = layer;
+    args.num_entries = args.num_nodes;
+    args.per_node = inner_per_node;
+    layer = build_layer(&args);
+    free(args.children);
+  } while (args.num_nodes > 1);
+  BNode* root = layer[0];
+  free(layer);
+  root->is_root = true;
+  return root;
+}
+
+/*
+ * Sorts the column's values with their positions in parallel and bulk loads
+ * an unclustered btree on them.
+ */
+static BNode* build_unclustered_btree(Column* column) {
+  size_t* positions = malloc(sizeof(size_t) * (*column->num_rows));
+  for (size_t i = 0; i < *column->num_rows; i++) {
+    positions[i] = i;
+  }
+  int* data;
+  size_t* sorted_positions;
+  sort_pairs(column->data, positions, *column->num_rows, &data,
+             &sorted_positions);
+  BNode* root = build_btree(data, sorted_positions, *column->num_rows);
+  free(positions);
+  free(data);
+  free(sorted_positions);
+  return root;
+}
+
 int create_unclustered_btree_index(Column* column) {
   printf("create unclustered btree \n");
   column->clustered = false;
@@ -474,16 +661,7 @@ int create_unclustered_btree_index(Column* column) {
   column->index = NULL;
   // First we need to sort our data if any has been loaded
   if (*column->num_rows > 0) {
-    int* data = malloc(sizeof(int) * (*column->num_rows));
-    size_t* positions = malloc(sizeof(size_t) * (*column->num_rows));
-    for (size_t i = 0; i < *column->num_rows; i++) {
-      positions[i] = i;
-    }
-
-    memcpy(data, column->data, *(column->num_rows) * sizeof(int));
-    db_qsort(data, positions, 0, *column->num_rows);
-    BNode* root = build_btree(data, positions, *column->num_rows);
-    column->index = root;
+    column->index = build_unclustered_btree(column);
   }
   return 0;
 }
@@ -497,16 +675,7 @@ int load_into_unclustered_btree_index(Column* column) {
   }
   // First we need to sort our data if any has been loaded
   if (*column->num_rows > 0) {
-    int* data = malloc(sizeof(int) * (*column->num_rows));
-    size_t* positions = malloc(sizeof(size_t) * (*column->num_rows));
-    for (size_t i = 0; i < *column->num_rows; i++) {
-      positions[i] = i;
-    }
-
-    memcpy(data, column->data, *(column->num_rows) * sizeof(int));
-    db_qsort(data, positions, 0, *column->num_rows);
-    BNode* root = build_btree(data, positions, *column->num_rows);
-    column->index = root;
+    column->index = build_unclustered_btree(column);
   }
 
   // traverse_tree(column->index, print_node, NULL);
@@ -543,12 +712,12 @@ int load_into_clustered_btree_index(Table* table, Column* column) {
 
   printf("load clustered btree\n");
   if (*column->num_rows > 0) {
-    int* data = malloc(sizeof(int) * (*column->num_rows));
-    memcpy(data, column->data, *(column->num_rows) * sizeof(int));
-    BNode* root = build_btree(data, positions, *column->num_rows);
+    // the table is sorted, so the data is the leaves' keys in order
+    BNode* root = build_btree(column->data, positions, *column->num_rows);
     column->index = root;
     // traverse_tree(column->index, print_node, NULL);
   }
+  free(positions);
   return 0;
 }
 
@@ -611,42 +780,6 @@ void traverse_tree(BNode* root, void (*func)(BNode*, FILE*), FILE* out_file) {
   return;
 }
 
-#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
-
-/*
- * Want this to return the position of the lower bound of the key
- */
-
-size_t BNode_binary_search(BNode* bnode, size_t lp, size_t rp, int key,
-                           bool* success) {
-  if (lp <= rp) {
-    size_t mid = lp + (rp - lp) / 2;
-    if (bnode->vals[mid] == key) {
-      *success = true;
-      return mid;
-    } else if ((bnode->vals[mid - 1] <= key &&
-                (mid == rp))) {  // || bnode->vals[MIN(mid+1, rp)] > key
-      *success = true;
-      return mid - 1;
-    } else if (bnode->vals[mid] > key) {
-      if (mid == 0) {
-        *success = true;
-        return mid;
-      } else if (bnode->vals[mid - 1] < key) {
-        *success = true;
-        return mid - 1;
-      }
-      // recurse left
-      return BNode_binary_search(bnode, lp, mid - 1, key, success);
-    }
-    // recurse right
-    return BNode_binary_search(bnode, mid + 1, rp, key, success);
-  }
-  // Value not found, return lower bound
-  *success = false;
-  return 0;
-}
-
 /*
  * Passes tests untop test27 inclusive with size 100
  */
@@ -660,38 +793,17 @@ Result* BTree_unclustered_select(BNode* root, size_t max_num_vals, int lower,
   // printf("unclustered select btree\n");
   // traverse_tree(root, print_node, NULL);
 
-  BNode* left_node = root;
-  while (left_node->is_leaf == false) {
-    bool success;
-    size_t idx = BNode_binary_search(left_node, 0, left_node->num_elements,
-                                     lower, &success);
-    while (idx > 0 && left_node->vals[idx] >= lower) {
-      idx -= 1;
-    }
-    if (success == false) {
-      log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-      return NULL;
-    }
-    // printf("Child node idx %ld \n", idx );
-    left_node = left_node->children.child_pointers[idx];
-  }
+  BNode* left_node = btree_descend(root, lower);
   assert(left_node->is_leaf == true);
 
-  bool success;
-  size_t leaf_internal_idx = BNode_binary_search(
-      left_node, 0, left_node->num_elements, lower, &success);
-
-  // order matters here, needs to be >0 before we --
-  while (leaf_internal_idx > 0 &&
-         left_node->vals[leaf_internal_idx - 1] >= lower) {
-    leaf_internal_idx -= 1;
-  }
+  size_t leaf_internal_idx = bnode_lower_bound(left_node, 0, lower);
 
   // printf("Leaf internal idx %ld \n", leaf_internal_idx);
 
   // if the lower bound is in the rightmost leaf and no values in the leaf match
   // we are done
-  if (left_node->next == NULL && left_node->vals[leaf_internal_idx] < lower) {
+  if (left_node->next == NULL &&
+      leaf_internal_idx == left_node->num_elements) {
     return result;
   }
 
@@ -759,46 +871,19 @@ Result* BTree_clustered_select(BNode* root, int lower, int upper) {
   result->num_tuples = 0;
   result->num_update_tuples = 0;
 
-  BNode* left_node = root;
-  printf("root num elemets %ld\n", root->num_elements);
-  while (left_node->is_leaf == false) {
-    bool success;
-    size_t idx = BNode_binary_search(left_node, 0, left_node->num_elements - 1,
-                                     lower, &success);
-    printf("left node num_elements %ld", left_node->num_elements);
-    printf(" in bnode binary search idx %ld\n", idx);
-    // if (success == false){
-    //     log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-    //     return result;
-    // }
-    left_node = left_node->children.child_pointers[idx];
-  }
+  BNode* left_node = btree_descend(root, lower);
   assert(left_node->is_leaf == true);
 
-  bool success;
-  size_t left_start_idx = BNode_binary_search(
-      left_node, 0, left_node->num_elements - 1, lower, &success);
-  // if (success == false){
-  //         log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-  //         return result;
-  //     }
-  while (left_start_idx > 0 && left_node->vals[left_start_idx - 1] >= lower) {
-    left_start_idx -= 1;
+  size_t left_start_idx = bnode_lower_bound(left_node, 0, lower);
+  // the first value >= lower is the first of the next leaf
+  if (left_start_idx == left_node->num_elements && left_node->next != NULL) {
+    left_node = left_node->next;
+    left_start_idx = 0;
   }
 
   size_t left_pos = left_node->children.positions[left_start_idx];
 
-  BNode* right_node = root;
-  while (right_node->is_leaf == false) {
-    bool success;
-    size_t idx = BNode_binary_search(
-        right_node, 0, right_node->num_elements - 1, upper, &success);
-    // if (success == false){
-    //     log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-    //     return result;
-    // }
-    right_node = right_node->children.child_pointers[idx];
-  }
+  BNode* right_node = btree_descend(root, upper);
   assert(right_node->is_leaf == true);
 
   // if we have duplicate values that span across nodes
@@ -806,15 +891,9 @@ Result* BTree_clustered_select(BNode* root, int lower, int upper) {
     right_node = right_node->next;
   }
 
-  size_t right_end_idx = BNode_binary_search(
-      right_node, 0, right_node->num_elements - 1, upper, &success);
-  // if (success == false){
-  //         log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-  //         return result;
-  //     }
-  while (right_end_idx > 0 && right_node->vals[right_end_idx] >= upper) {
-    right_end_idx -= 1;
-  }
+  // last value below upper
+  size_t right_end_idx = bnode_lower_bound(right_node, 0, upper);
+  right_end_idx -= right_end_idx > 0;
 
   // printf("upper %d lower  %d\n", upper, lower);
   // printf("left node\n");
@@ -843,12 +922,7 @@ int insert_into_node(BNode* node, int val, size_t pos) {
   if (node->num_elements == FAN_OUT) {
     return -1;
   }
-  bool success;
-  size_t node_idx =
-      BNode_binary_search(node, 0, node->num_elements - 1, val, &success);
-  while (node_idx > 0 && node->vals[node_idx - 1] >= val) {
-    node_idx -= 1;
-  }
+  size_t node_idx = bnode_lower_bound(node, 0, val);
   memmove(&node->vals[node_idx], &node->vals[node_idx + 1],
           (node->num_elements - node_idx) * sizeof(int));
   memmove(&node->children.positions[node_idx],
@@ -867,20 +941,7 @@ int insert_into_node(BNode* node, int val, size_t pos) {
 }
 
 int btree_clustered_insert(BNode* root, int val, size_t pos) {
-  BNode* ins_node = root;
-  while (ins_node->is_leaf == false) {
-    bool success;
-    size_t idx =
-        BNode_binary_search(ins_node, 0, ins_node->num_elements, val, &success);
-    while (idx > 0 && ins_node->vals[idx] >= val) {
-      idx -= 1;
-    }
-    if (success == false) {
-      log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-      return -1;
-    }
-    ins_node = ins_node->children.child_pointers[idx];
-  }
+  BNode* ins_node = btree_descend(root, val);
   assert(ins_node->is_leaf == true);
   if (!insert_into_node(ins_node, val, pos)) {
     log_err("Failed to insert into node\n");
@@ -899,20 +960,7 @@ int btree_clustered_insert(BNode* root, int val, size_t pos) {
   return 1;
 }
 int btree_unclustered_insert(BNode* root, int val, size_t pos) {
-  BNode* ins_node = root;
-  while (ins_node->is_leaf == false) {
-    bool success;
-    size_t idx =
-        BNode_binary_search(ins_node, 0, ins_node->num_elements, val, &success);
-    while (idx > 0 && ins_node->vals[idx] >= val) {
-      idx -= 1;
-    }
-    if (success == false) {
-      log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-      return -1;
-    }
-    ins_node = ins_node->children.child_pointers[idx];
-  }
+  BNode* ins_node = btree_descend(root, val);
   assert(ins_node->is_leaf == true);
   if (!insert_into_node(ins_node, val, pos)) {
     log_err("Failed to insert into node\n");
@@ -941,29 +989,10 @@ int btree_unclustered_insert(BNode* root, int val, size_t pos) {
 }
 
 int btree_clustered_delete(BNode* root, int val) {
-  BNode* left_node = root;
-  while (left_node->is_leaf == false) {
-    bool success;
-    size_t idx = BNode_binary_search(left_node, 0, left_node->num_elements, val,
-                                     &success);
-    while (idx > 0 && left_node->vals[idx] >= val) {
-      idx -= 1;
-    }
-    if (success == false) {
-      log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-      return -1;
-    }
-    // printf("Child node idx %ld \n", idx );
-    left_node = left_node->children.child_pointers[idx];
-  }
+  BNode* left_node = btree_descend(root, val);
   assert(left_node->is_leaf == true);
 
-  bool success;
-  size_t left_start_idx = BNode_binary_search(
-      left_node, 0, left_node->num_elements - 1, val, &success);
-  while (left_start_idx > 0 && left_node->vals[left_start_idx - 1] >= val) {
-    left_start_idx -= 1;
-  }
+  size_t left_start_idx = bnode_lower_bound(left_node, 0, val);
 
   memmove(&left_node->vals[left_start_idx],
           &left_node->vals[left_start_idx + 1],
@@ -984,29 +1013,10 @@ int btree_clustered_delete(BNode* root, int val) {
 }
 
 int btree_unclustered_delete(BNode* root, int val) {
-  BNode* left_node = root;
-  while (left_node->is_leaf == false) {
-    bool success;
-    size_t idx = BNode_binary_search(left_node, 0, left_node->num_elements, val,
-                                     &success);
-    while (idx > 0 && left_node->vals[idx] >= val) {
-      idx -= 1;
-    }
-    if (success == false) {
-      log_err("%s:%d BNode binary search failed", __FILE__, __LINE__);
-      return -1;
-    }
-    // printf("Child node idx %ld \n", idx );
-    left_node = left_node->children.child_pointers[idx];
-  }
+  BNode* left_node = btree_descend(root, val);
   assert(left_node->is_leaf == true);
 
-  bool success;
-  size_t left_start_idx = BNode_binary_search(
-      left_node, 0, left_node->num_elements - 1, val, &success);
-  while (left_start_idx > 0 && left_node->vals[left_start_idx - 1] >= val) {
-    left_start_idx -= 1;
-  }
+  size_t left_start_idx = bnode_lower_bound(left_node, 0, val);
 
   size_t left_pos = left_node->children.positions[left_start_idx];
 
@@ -1038,4 +1048,87 @@ int btree_unclustered_delete(BNode* root, int val) {
     init_node = init_node->previous;
   }
   return 1;
-}
\ No newline at end of file
+}
+
+// ****************************************************************************
+// Index cursors
+// ****************************************************************************
+
+void index_cursor_init(IndexCursor* cursor, Column* column) {
+  cursor->index_type = column->index_type;
+  cursor->index = column->index;
+  cursor->leaf = NULL;
+  cursor->idx = 0;
+}
+
+static inline int leaf_last(const BNode* leaf) {
+  return leaf->vals[leaf->num_elements - 1];
+}
+
+void index_cursor_seek(IndexCursor* cursor, int key) {
+  if (cursor->index_type == SORTED) {
+    SortedIndex* index = (SortedIndex*)cursor->index;
+    // gallop forward from the last entry, then search the last step
+    size_t lo = cursor->idx;
+    size_t step = 1;
+    while (lo + step < index->length && index->keys[lo + step] < key) {
+      lo += step;
+      step *= 2;
+    }
+    size_t hi = lo + step < index->length ? lo + step : index->length;
+    cursor->idx = lower_bound_int(index->keys, lo, hi + (hi < index->length),
+                                  key);
+    return;
+  }
+  if (cursor->index == NULL) {
+    return;
+  }
+  BNode* leaf = cursor->leaf;
+  if (leaf == NULL || leaf->num_elements == 0 ||
+      (leaf_last(leaf) < key &&
+       (leaf->next == NULL || leaf->next->num_elements == 0 ||
+        leaf_last(leaf->next) < key))) {
+    leaf = btree_descend((BNode*)cursor->index, key);
+    cursor->idx = 0;
+  } else if (leaf_last(leaf) < key) {
+    leaf = leaf->next;
+    cursor->idx = 0;
+  }
+  cursor->idx = bnode_lower_bound(leaf, cursor->idx, key);
+  if (cursor->idx == leaf->num_elements && leaf->next != NULL &&
+      leaf->next->num_elements > 0) {
+    leaf = leaf->next;
+    cursor->idx = 0;
+  }
+  cursor->leaf = leaf;
+}
+
+bool index_cursor_valid(const IndexCursor* cursor) {
+  if (cursor->index_type == SORTED) {
+    return cursor->idx < ((SortedIndex*)cursor->index)->length;
+  }
+  return cursor->leaf != NULL && cursor->idx < cursor->leaf->num_elements;
+}
+
+int index_cursor_key(const IndexCursor* cursor) {
+  if (cursor->index_type == SORTED) {
+    return ((SortedIndex*)cursor->index)->keys[cursor->idx];
+  }
+  return cursor->leaf->vals[cursor->idx];
+}
+
+size_t index_cursor_position(const IndexCursor* cursor) {
+  if (cursor->index_type == SORTED) {
+    return ((SortedIndex*)cursor->index)->col_positions[cursor->idx];
+  }
+  return cursor->leaf->children.positions[cursor->idx];
+}
+
+void index_cursor_next(IndexCursor* cursor) {
+  cursor->idx += 1;
+  if (cursor->index_type == BTREE &&
+      cursor->idx == cursor->leaf->num_elements && cursor->leaf->next != NULL) {
+    cursor->leaf = cursor->leaf->next;
+    cursor->idx = 0;
+  }
+}
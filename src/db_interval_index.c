@@ -0,0 +1,108 @@
+#include "db_interval_index.h"
+
+#include <stdlib.h>
+
+#include "utils.h"
+
+static int compare_ints(const void* a, const void* b) {
+  int left = *(const int*)a;
+  int right = *(const int*)b;
+  return (left > right) - (left < right);
+}
+
+/*
+ * Position of value in the sorted, distinct bounds, which always holds it.
+ */
+static size_t bound_position(const IntervalIndex* index, int value) {
+  return interval_index_find(index, value) - 1;
+}
+
+IntervalIndex* interval_index_create(const int* lows, const int* highs,
+                                     size_t num_queries) {
+  IntervalIndex* index = calloc(1, sizeof(IntervalIndex));
+  if (index == NULL) {
+    log_err("%s:%d Failed to allocate interval index\n", __FILE__, __LINE__);
+    return NULL;
+  }
+  index->num_queries = num_queries;
+  index->bounds = malloc(sizeof(int) * 2 * num_queries);
+  index->first_interval = malloc(sizeof(size_t) * num_queries);
+  index->end_interval = malloc(sizeof(size_t) * num_queries);
+  if (index->bounds == NULL || index->first_interval == NULL ||
+      index->end_interval == NULL) {
+    log_err("%s:%d Failed to allocate interval index\n", __FILE__, __LINE__);
+    interval_index_free(index);
+    return NULL;
+  }
+
+  // sorted distinct bounds
+  for (size_t q = 0; q < num_queries; q++) {
+    index->bounds[2 * q] = lows[q];
+    index->bounds[2 * q + 1] = highs[q];
+  }
+  qsort(index->bounds, 2 * num_queries, sizeof(int), &compare_ints);
+  size_t num_bounds = 0;
+  for (size_t i = 0; i < 2 * num_queries; i++) {
+    if (num_bounds == 0 || index->bounds[num_bounds - 1] != index->bounds[i]) {
+      index->bounds[num_bounds++] = index->bounds[i];
+    }
+  }
+  index->num_bounds = num_bounds;
+
+  // the interval starting at a bound is one past its position, empty
+  // predicates (low >= high) cover nothing
+  size_t num_intervals = interval_index_num_intervals(index);
+  index->query_offsets = calloc(num_intervals + 1, sizeof(size_t));
+  if (index->query_offsets == NULL) {
+    log_err("%s:%d Failed to allocate interval index\n", __FILE__, __LINE__);
+    interval_index_free(index);
+    return NULL;
+  }
+  for (size_t q = 0; q < num_queries; q++) {
+    index->first_interval[q] = bound_position(index, lows[q]) + 1;
+    index->end_interval[q] = bound_position(index, highs[q]) + 1;
+    if (lows[q] >= highs[q]) {
+      index->end_interval[q] = index->first_interval[q];
+    }
+    for (size_t e = index->first_interval[q]; e < index->end_interval[q];
+         e++) {
+      index->query_offsets[e + 1] += 1;
+    }
+  }
+  for (size_t e = 0; e < num_intervals; e++) {
+    index->query_offsets[e + 1] += index->query_offsets[e];
+  }
+
+  index->queries =
+      malloc(sizeof(uint32_t) * (index->query_offsets[num_intervals] + 1));
+  size_t* fill = malloc(sizeof(size_t) * num_intervals);
+  if (index->queries == NULL || fill == NULL) {
+    log_err("%s:%d Failed to allocate interval index\n", __FILE__, __LINE__);
+    free(fill);
+    interval_index_free(index);
+    return NULL;
+  }
+  for (size_t e = 0; e < num_intervals; e++) {
+    fill[e] = index->query_offsets[e];
+  }
+  for (size_t q = 0; q < num_queries; q++) {
+    for (size_t e = index->first_interval[q]; e < index->end_interval[q];
+         e++) {
+      index->queries[fill[e]++] = (uint32_t)q;
+    }
+  }
+  free(fill);
+  return index;
+}
+
+void interval_index_free(IntervalIndex* index) {
+  if (index == NULL) {
+    return;
+  }
+  free(index->bounds);
+  free(index->first_interval);
+  free(index->end_interval);
+  free(index->query_offsets);
+  free(index->queries);
+  free(index);
+}
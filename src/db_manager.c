@@ -8,6 +8,8 @@
 
 #include "db_index.h"
 #include "db_persist.h"
+#include "db_stats.h"
+#include "db_zonemap.h"
 #include "main_api.h"
 #include "utils.h"
 
@@ -65,6 +67,12 @@ Table* create_table(Db* db, const char* name, size_t num_columns,
         realloc(db->tables, (db->tables_size + 5) *
                                 sizeof(Table));  // 5 is arbitrary, but the idea
                                                  // is to do fewer reallocs
+    // tables may have moved, columns point at their table's length
+    for (size_t i = 0; i < db->tables_size; i++) {
+      for (size_t j = 0; j < db->tables[i].col_count; j++) {
+        db->tables[i].columns[j].num_rows = &db->tables[i].table_length;
+      }
+    }
     db->tables[db->tables_size] = *new_tb;
     db->tables_size += 1;
     db->tables_capacity += 4;
@@ -156,52 +164,79 @@ Column* create_column(Table* table, char* name, bool sorted,
       malloc(sizeof(int) * UPDATE_BATCH_SIZE);
   table->columns[table->col_count - 1].update_struct.del_length = 0;
   table->columns[table->col_count - 1].update_struct.ins_length = 0;
+  table->columns[table->col_count - 1].zonemap = zonemap_create();
+  stats_rebuild(&table->columns[table->col_count - 1]);
   table->table_alloc_size = table_len;
 
   close(fd);
   return &table->columns[table->col_count - 1];
 }
 
+static int compare_positions_desc(const void* a, const void* b) {
+  size_t left = *(const size_t*)a;
+  size_t right = *(const size_t*)b;
+  return (left < right) - (left > right);
+}
+
 /*
  * Deletes on base data also cover deletes on clustered sorted indexes
+ * Positions are deleted from the highest down so each memmove leaves the
+ * positions still to be deleted where they were.
  */
 bool flush_deletes(Table* table) {
   // delete from base data first
   size_t init_num_rows = table->table_length;
+  size_t remaining_rows = init_num_rows;
+  // every column holds the same delete positions
+  size_t first_deleted = init_num_rows;
   for (size_t i = 0; i < table->col_count; i++) {
     size_t local_num_rows = init_num_rows;
-    for (size_t j; j < table->columns[i].update_struct.del_length; j++) {
-      memmove(
-          &table->columns[i].data[table->columns[i].update_struct.del_pos[j]],
-          &table->columns[i]
-               .data[table->columns[i].update_struct.del_pos[j] + 1],
-          (local_num_rows - table->columns[i].update_struct.del_length) *
-              sizeof(int));
+    qsort(table->columns[i].update_struct.del_pos,
+          table->columns[i].update_struct.del_length, sizeof(size_t),
+          compare_positions_desc);
+    for (size_t j = 0; j < table->columns[i].update_struct.del_length; j++) {
+      size_t del_pos = table->columns[i].update_struct.del_pos[j];
+      // the same position can be deleted more than once before a flush, its
+      // value was then taken out of the statistics more than once
+      if (del_pos >= init_num_rows ||
+          (j > 0 &&
+           del_pos == table->columns[i].update_struct.del_pos[j - 1])) {
+        table->columns[i].stats.stale = true;
+        continue;
+      }
+      // del_pos is sorted on its own, so take the value from the data
+      int del_val = table->columns[i].data[del_pos];
+      memmove(&table->columns[i].data[del_pos],
+              &table->columns[i].data[del_pos + 1],
+              (local_num_rows - del_pos - 1) * sizeof(int));
       local_num_rows -= 1;
+      first_deleted = del_pos;
       // update any indexes
       if (table->columns[i].index_type == SORTED &&
           table->columns[i].clustered == true) {
         sorted_clustered_delete((SortedIndex*)table->columns[i].index,
-                                table->columns[i].update_struct.del_val[j]);
+                                del_val);
       } else if (table->columns[i].index_type == SORTED &&
                  table->columns[i].clustered == false) {
         sorted_unclustered_delete((SortedIndex*)table->columns[i].index,
-                                  table->columns[i].update_struct.del_val[j]);
+                                  del_val);
       } else if (table->columns[i].index_type == BTREE &&
                  table->columns[i].clustered == true) {
         btree_clustered_delete((BNode*)table->columns[i].index,
-                               table->columns[i].update_struct.del_val[j]);
+                               del_val);
       } else if (table->columns[i].index_type == BTREE &&
                  table->columns[i].clustered == false) {
         btree_unclustered_delete((BNode*)table->columns[i].index,
-                                 table->columns[i].update_struct.del_val[j]);
+                                 del_val);
       }
     }
+    remaining_rows = local_num_rows;
   }
-  table->table_length -= table->columns[0].update_struct.del_length;
+  table->table_length = remaining_rows;
 
   for (size_t i = 0; i < table->col_count; i++) {
     table->columns[i].update_struct.del_length = 0;
+    zonemap_rebuild(&table->columns[i], first_deleted);
   }
 
   return true;
@@ -215,6 +250,7 @@ bool flush_inserts(Table* table) {
     }
   }
 
+  size_t first_changed = table->table_length;
   // no primary indexes means we can just append data
   if (clustered_col == NULL) {
     for (size_t j = 0; j < table->columns[0].update_struct.ins_length; j++) {
@@ -253,6 +289,7 @@ bool flush_inserts(Table* table) {
       size_t ins_pos =
           clustered_insert_position(clustered_col->data, 0, table->table_length,
                                     clustered_col->update_struct.ins_val[j]);
+      first_changed = ins_pos < first_changed ? ins_pos : first_changed;
       for (size_t i = 0; i < table->col_count; i++) {
         memmove(&table->columns[i].data[ins_pos],
                 &table->columns[i].data[ins_pos + 1],
@@ -288,6 +325,7 @@ bool flush_inserts(Table* table) {
   }
   for (size_t i = 0; i < table->col_count; i++) {
     table->columns[i].update_struct.ins_length = 0;
+    zonemap_rebuild(&table->columns[i], first_changed);
   }
   return true;
 }
@@ -0,0 +1,94 @@
+#include "db_morsel.h"
+
+#include <stdlib.h>
+
+#include "db_threadpool.h"
+
+// morsels start on a word of a bitvector, so bitvector results can be written
+// by several threads without sharing words
+_Static_assert(MORSEL_SIZE % 64 == 0, "MORSEL_SIZE must be a multiple of 64");
+
+typedef struct MorselQueue {
+  WorkerMorselFunc func;
+  void* arg;
+  size_t num_rows;
+  size_t num_morsels;
+  size_t next_morsel;
+} MorselQueue;
+
+typedef struct MorselWorker {
+  MorselQueue* queue;
+  size_t worker;
+} MorselWorker;
+
+/*
+ * Task run by each worker, claims the next morsel until they are all taken.
+ */
+static void* morsel_worker(void* worker_arg) {
+  MorselWorker* worker = (MorselWorker*)worker_arg;
+  MorselQueue* queue = worker->queue;
+  size_t morsel;
+  while ((morsel = __atomic_fetch_add(&queue->next_morsel, 1,
+                                      __ATOMIC_RELAXED)) < queue->num_morsels) {
+    size_t start = morsel * MORSEL_SIZE;
+    size_t end = queue->num_rows - start < MORSEL_SIZE ? queue->num_rows
+                                                       : start + MORSEL_SIZE;
+    queue->func(queue->arg, worker->worker, morsel, start, end);
+  }
+  return NULL;
+}
+
+size_t morsel_num_workers(size_t num_rows) {
+  size_t num_morsels = morsel_num(num_rows);
+  if (num_morsels <= 1 || g_pool == NULL || g_pool->num_threads == 0) {
+    return 1;
+  }
+  return num_morsels < g_pool->num_threads ? num_morsels : g_pool->num_threads;
+}
+
+void morsel_run_workers(size_t num_rows, WorkerMorselFunc func, void* arg) {
+  size_t num_morsels = morsel_num(num_rows);
+  if (num_morsels == 0) {
+    return;
+  }
+  size_t num_workers = morsel_num_workers(num_rows);
+  if (num_workers == 1) {
+    for (size_t m = 0; m < num_morsels; m++) {
+      size_t start = m * MORSEL_SIZE;
+      func(arg, 0, m, start,
+           num_rows - start < MORSEL_SIZE ? num_rows : start + MORSEL_SIZE);
+    }
+    return;
+  }
+  MorselQueue queue = {.func = func,
+                       .arg = arg,
+                       .num_rows = num_rows,
+                       .num_morsels = num_morsels,
+                       .next_morsel = 0};
+  // one task per worker, the waiting thread picks one of them up as well
+  MorselWorker* workers = malloc(num_workers * sizeof(MorselWorker));
+  TaskGroup group = {0};
+  for (size_t i = 0; i < num_workers; i++) {
+    workers[i] = (MorselWorker){.queue = &queue, .worker = i};
+    threadpool_submit(g_pool, &group, &morsel_worker, &workers[i]);
+  }
+  threadpool_wait(g_pool, &group);
+  free(workers);
+}
+
+typedef struct MorselCall {
+  MorselFunc func;
+  void* arg;
+} MorselCall;
+
+static void morsel_call(void* call_arg, size_t worker, size_t morsel,
+                        size_t start, size_t end) {
+  (void)worker;
+  MorselCall* call = (MorselCall*)call_arg;
+  call->func(call->arg, morsel, start, end);
+}
+
+void morsel_run(size_t num_rows, MorselFunc func, void* arg) {
+  MorselCall call = {.func = func, .arg = arg};
+  morsel_run_workers(num_rows, &morsel_call, &call);
+}
@@ -1,6 +1,5 @@
 #include <assert.h>
 #include <limits.h>
-#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,26 +7,54 @@
 
 #include "client_context.h"
 #include "common.h"
+#include "db_bitvector.h"
+#include "db_bloom.h"
+#include "db_groupby.h"
 #include "db_hashtable.h"
 #include "db_index.h"
+#include "db_interval_index.h"
+#include "db_morsel.h"
+#include "db_partition.h"
 #include "db_persist.h"
+#include "db_scan.h"
+#include "db_sort.h"
+#include "db_stats.h"
+#include "db_threadpool.h"
+#include "db_zonemap.h"
 #include "main_api.h"
 #include "message.h"
 #include "parse.h"
 #include "utils.h"
 
 char* execute_print(DbOperator* query) {
-  // currently only supporting int data.
-  // 12 = 11 characters per max_int/min_int including sign + 1 for space after
-  // each last space is \n instead
+  // 21 = 20 characters per max_long/min_long including sign + 1 for space
+  // after each last space is \n instead
   char* return_msg =
-      malloc(12 * query->operator_fields.print_operator.col_count *
-             query->operator_fields.print_operator.col_length * sizeof(char));
+      malloc(21 * query->operator_fields.print_operator.col_count *
+                 query->operator_fields.print_operator.col_length +
+             2);
   return_msg[0] = '\0';
   int return_msg_pos = 0;
-  char* row = malloc(12 * query->operator_fields.print_operator.col_count *
-                     sizeof(char));
-  char* ascii_data = malloc(12 * sizeof(char));
+  char* row = malloc(21 * query->operator_fields.print_operator.col_count *
+                         sizeof(char) +
+                     1);
+  char* ascii_data = malloc(21 * sizeof(char));
+  // bitvectors are printed as the positions of their set bits, decode them
+  // once up front rather than searching for the ith set bit on every row
+  size_t** bitvector_positions = calloc(
+      query->operator_fields.print_operator.col_count, sizeof(size_t*));
+  for (size_t j = 0; j < query->operator_fields.print_operator.col_count; j++) {
+    if (query->operator_fields.print_operator.columns[j]->column_type ==
+            RESULT &&
+        query->operator_fields.print_operator.columns[j]
+                ->column_pointer.result->data_type == BITVECTOR) {
+      Result* bit_result = query->operator_fields.print_operator.columns[j]
+                               ->column_pointer.result;
+      bitvector_positions[j] =
+          malloc((bit_result->num_tuples + 1) * sizeof(size_t));
+      bitvector_to_positions(bit_result->payload, bitvector_positions[j]);
+    }
+  }
   // printf("Col length in query %ld\n",
   // query->operator_fields.print_operator.col_length);
   for (size_t i = 0; i < query->operator_fields.print_operator.col_length;
@@ -65,6 +92,9 @@ char* execute_print(DbOperator* query) {
                   ->column_pointer.result->payload;
           size_t data = data_pointer[i];
           sprintf(ascii_data, "%ld", data);
+        } else if (query->operator_fields.print_operator.columns[j]
+                       ->column_pointer.result->data_type == BITVECTOR) {
+          sprintf(ascii_data, "%ld", bitvector_positions[j][i]);
         } else if (query->operator_fields.print_operator.columns[j]
                        ->column_pointer.result->data_type == FLOAT) {
           float* data_pointer =
@@ -94,6 +124,10 @@ char* execute_print(DbOperator* query) {
   return_msg[return_msg_pos + 1] = '\0';
   free(ascii_data);
   free(row);
+  for (size_t j = 0; j < query->operator_fields.print_operator.col_count; j++) {
+    free(bitvector_positions[j]);
+  }
+  free(bitvector_positions);
   for (size_t j = 0; j < query->operator_fields.print_operator.col_count; j++) {
     if (query->operator_fields.print_operator.columns[j]->column_type ==
         COLUMN) {
@@ -144,6 +178,8 @@ char* execute_load(DbOperator* query) {
     resize_table(table, new_size);
   }
   const size_t num_cols = query->operator_fields.load_operator.num_cols;
+  size_t first_new_row = table->table_length;
+  const size_t first_loaded_row = table->table_length;
   printf("load num rows %ld \n", query->operator_fields.load_operator.num_rows);
   printf("load num cols %ld \n", num_cols);
   for (size_t i = 0; i < num_cols; i++) {
@@ -168,6 +204,8 @@ char* execute_load(DbOperator* query) {
           } else if (table->columns[i].index_type == BTREE) {
             load_into_clustered_btree_index(table, &table->columns[i]);
           }
+          // the whole table was sorted
+          first_new_row = 0;
         }
       }
     }
@@ -186,11 +224,56 @@ char* execute_load(DbOperator* query) {
     }
   }
 
+  for (size_t i = 0; i < num_cols; i++) {
+    zonemap_rebuild(&table->columns[i], first_new_row);
+    if (first_new_row < first_loaded_row) {
+      // a clustered index sorted the loaded rows in among the old ones
+      stats_rebuild(&table->columns[i]);
+    } else {
+      stats_add_rows(&table->columns[i], first_loaded_row);
+    }
+  }
+
   return " ";
 }
 
+/*
+ * Bitvector version of adjust_result_for_updates. Deletes clear their bit and
+ * the bitvector is grown to cover the pending inserts, so the bit for insert k
+ * is num_rows + k like the positions in a position list.
+ */
+static Result* adjust_bitvector_for_updates(Result* result, Column* column,
+                                            int min_val, int max_val) {
+  Bitvector* bits =
+      bitvector_resize(result->payload,
+                       *column->num_rows + column->update_struct.ins_length);
+  if (bits == NULL) {
+    return result;
+  }
+  for (size_t k = 0; k < column->update_struct.del_length; k++) {
+    if (column->update_struct.del_pos[k] < bits->num_bits) {
+      bitvector_clear(bits, column->update_struct.del_pos[k]);
+    }
+  }
+  result->num_update_tuples = 0;
+  for (size_t k = 0; k < column->update_struct.ins_length; k++) {
+    if ((column->update_struct.ins_val[k] >= min_val) &
+        (column->update_struct.ins_val[k] < max_val)) {
+      bitvector_set(bits, k + *column->num_rows);
+      result->num_update_tuples += 1;
+    }
+  }
+  bits->column = column;
+  result->payload = bits;
+  result->num_tuples = bitvector_count(bits);
+  return result;
+}
+
 Result* adjust_result_for_updates(Result* result, Column* column, int min_val,
                                   int max_val) {
+  if (result->data_type == BITVECTOR) {
+    return adjust_bitvector_for_updates(result, column, min_val, max_val);
+  }
   size_t* new_payload = malloc(
       sizeof(size_t) * (result->num_tuples + column->update_struct.ins_length));
   size_t j = 0;
@@ -225,13 +308,152 @@ Result* adjust_result_for_updates(Result* result, Column* column, int min_val,
   return result;
 }
 
+/*
+ * Scans rows [start, end) of a base column into bits one zone map block at a
+ * time. Blocks which cannot match are left cleared and blocks which match
+ * entirely are set without reading the data, only the rest are scanned.
+ * start must be a multiple of 64.
+ */
+static size_t zonemap_scan_select(const int* data, const ZoneMap* zonemap,
+                                  size_t start, size_t end, int min_val,
+                                  int max_val, Bitvector* bits) {
+  size_t count = 0;
+  for (size_t b = start / ZONEMAP_BLOCK_SIZE; b * ZONEMAP_BLOCK_SIZE < end;
+       b++) {
+    size_t block_start =
+        b * ZONEMAP_BLOCK_SIZE < start ? start : b * ZONEMAP_BLOCK_SIZE;
+    size_t block_end = end - b * ZONEMAP_BLOCK_SIZE < ZONEMAP_BLOCK_SIZE
+                           ? end
+                           : (b + 1) * ZONEMAP_BLOCK_SIZE;
+    switch (zonemap_match(zonemap, b, min_val, max_val)) {
+      case ZONE_NONE:
+        break;
+      case ZONE_ALL:
+        bitvector_set_range(bits, block_start, block_end);
+        count += block_end - block_start;
+        break;
+      case ZONE_SOME:
+        count += scan_select_bitvector(
+            &data[block_start], block_end - block_start, min_val, max_val,
+            &bits->words[block_start / 64]);
+        break;
+    }
+  }
+  return count;
+}
+
+/*
+ * Arguments shared by the morsels of a select. counts holds the number of
+ * qualifying rows of each morsel, which are turned into output offsets before
+ * positions are written so the merged result stays in position order.
+ */
+typedef struct SelectMorselArgs {
+  const int* data;
+  const size_t* positions_in;
+  const ZoneMap* zonemap;
+  int min_val;
+  int max_val;
+  Bitvector* bits;
+  size_t* positions;
+  size_t* counts;
+} SelectMorselArgs;
+
+static void select_bitvector_morsel(void* arg, size_t morsel, size_t start,
+                                    size_t end) {
+  SelectMorselArgs* args = (SelectMorselArgs*)arg;
+  if (args->zonemap != NULL) {
+    args->counts[morsel] =
+        zonemap_scan_select(args->data, args->zonemap, start, end,
+                            args->min_val, args->max_val, args->bits);
+  } else {
+    args->counts[morsel] = scan_select_bitvector(
+        &args->data[start], end - start, args->min_val, args->max_val,
+        &args->bits->words[start / 64]);
+  }
+}
+
+static void decode_bitvector_morsel(void* arg, size_t morsel, size_t start,
+                                    size_t end) {
+  SelectMorselArgs* args = (SelectMorselArgs*)arg;
+  bitvector_words_to_positions(args->bits, start / 64,
+                               bitvector_num_words(end),
+                               &args->positions[args->counts[morsel]]);
+}
+
+/*
+ * Each morsel writes its positions to the start of its own rows in positions,
+ * they are compacted afterwards.
+ */
+static void select_positions_morsel(void* arg, size_t morsel, size_t start,
+                                    size_t end) {
+  SelectMorselArgs* args = (SelectMorselArgs*)arg;
+  args->counts[morsel] = scan_select_range(
+      &args->data[start], &args->positions_in[start], 0, end - start,
+      args->min_val, args->max_val, &args->positions[start]);
+}
+
+/*
+ * Turns per morsel counts into exclusive offsets in place, returns the total.
+ */
+static size_t morsel_offsets(size_t* counts, size_t num_morsels) {
+  size_t total = 0;
+  for (size_t m = 0; m < num_morsels; m++) {
+    size_t count = counts[m];
+    counts[m] = total;
+    total += count;
+  }
+  return total;
+}
+
+/*
+ * Number of positions which are not NULL_POSITION, the unmatched rows of a
+ * left outer join.
+ */
+static size_t count_positions(const size_t* positions, size_t num_positions) {
+  size_t count = 0;
+  for (size_t i = 0; i < num_positions; i++) {
+    count += positions[i] != NULL_POSITION;
+  }
+  return count;
+}
+
+/*
+ * Copies the values and positions of the rows whose position is not
+ * NULL_POSITION into new arrays. Returns false and leaves the outputs alone
+ * when there are no such rows to drop.
+ */
+static bool drop_null_positions(const int* values, const size_t* positions,
+                                size_t length, int** out_values,
+                                size_t** out_positions, size_t* out_length) {
+  size_t count = count_positions(positions, length);
+  if (count == length) {
+    return false;
+  }
+  *out_values = malloc((count + 1) * sizeof(int));
+  *out_positions = malloc((count + 1) * sizeof(size_t));
+  size_t j = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (positions[i] != NULL_POSITION) {
+      (*out_values)[j] = values[i];
+      (*out_positions)[j] = positions[i];
+      j++;
+    }
+  }
+  *out_length = count;
+  return true;
+}
+
 Result* execute_scan_select(DbOperator* query, const int min_val,
                             const int max_val) {
   // src is column or vector of values, rather than indices
   size_t num_rows;
   int* src = NULL;
+  const ZoneMap* zonemap = NULL;
   if (query->operator_fields.select_operator.src->column_type == COLUMN) {
     printf("Selecting from column\n");
+    zonemap =
+        query->operator_fields.select_operator.src->column_pointer.column
+            ->zonemap;
     src =
         query->operator_fields.select_operator.src->column_pointer.column->data;
     num_rows = *(query->operator_fields.select_operator.src->column_pointer
@@ -250,36 +472,82 @@ Result* execute_scan_select(DbOperator* query, const int min_val,
   }
 
   const size_t cnum_rows = num_rows;
-  size_t* payload = malloc(num_rows * sizeof(size_t));
-  size_t j = 0;
+  Result* result = calloc(1, sizeof(Result));
+  SelectMorselArgs args = {.data = src,
+                           .min_val = min_val,
+                           .max_val = max_val,
+                           .counts = calloc(morsel_num(cnum_rows) + 1,
+                                            sizeof(size_t))};
+  // scan_select_bitvector and scan_select_range pick a SIMD kernel for the
+  // cpu, falling back to the branchless loop. Morsels of the column are
+  // scanned in parallel.
   if (!query->operator_fields.select_operator.use_index_vector) {
-    for (size_t i = 0; i < cnum_rows; i++) {
-      payload[j] = i;
-      j += ((src[i] >= min_val) & (src[i] < max_val));
+    // scan into a bitvector first, dense results stay that way and sparse ones
+    // are decoded into an exact size position list
+    args.bits = bitvector_allocate(cnum_rows);
+    if (args.bits == NULL) {
+      free(args.counts);
+      free(result);
+      return NULL;
+    }
+    if (zonemap != NULL &&
+        zonemap->num_blocks == zonemap_num_blocks(cnum_rows)) {
+      args.zonemap = zonemap;
+    }
+    morsel_run(cnum_rows, &select_bitvector_morsel, &args);
+    size_t j = morsel_offsets(args.counts, morsel_num(cnum_rows));
+    result->num_tuples = j;
+    if (j * BITVECTOR_DENSITY >= cnum_rows && j > 0) {
+      result->data_type = BITVECTOR;
+      result->payload = args.bits;
+    } else {
+      result->data_type = POSITIONLIST;
+      result->payload = j == 0 ? NULL : malloc(j * sizeof(size_t));
+      if (j > 0) {
+        args.positions = result->payload;
+        morsel_run(cnum_rows, &decode_bitvector_morsel, &args);
+      }
+      free(args.bits);
     }
   } else {
-    if (query->operator_fields.select_operator.indices->data_type !=
-        POSITIONLIST) {
-      log_err("Selects with indices currently only supports position lists\n");
+    if (!result_to_positionlist(
+            query->operator_fields.select_operator.indices)) {
+      log_err(
+          "Selects with indices currently only supports position lists and "
+          "bitvectors\n");
+      free(args.counts);
+      free(result);
       return NULL;
     }
 
-    size_t* pos_vect =
+    args.positions_in =
         (size_t*)query->operator_fields.select_operator.indices->payload;
-    for (size_t i = 0; i < cnum_rows; i++) {
-      payload[j] = pos_vect[i];
-      // printf(" src: %d, min %d, max %d,  \n", src[i],
-      // query->operator_fields.select_operator.minimum,
-      // query->operator_fields.select_operator.maximum );
-      j += ((src[i] >= min_val) & (src[i] < max_val));
+    // the unmatched rows of a left outer join have no value to select on
+    int* kept_values = NULL;
+    size_t* kept_positions = NULL;
+    size_t num_kept = num_rows;
+    if (drop_null_positions(args.data, args.positions_in, num_rows,
+                            &kept_values, &kept_positions, &num_kept)) {
+      args.data = kept_values;
+      args.positions_in = kept_positions;
+    }
+    args.positions = malloc((num_kept + 1) * sizeof(size_t));
+    morsel_run(num_kept, &select_positions_morsel, &args);
+    // move each morsel's positions down next to the previous morsel's
+    size_t j = 0;
+    for (size_t m = 0; m < morsel_num(num_kept); m++) {
+      memmove(&args.positions[j], &args.positions[m * MORSEL_SIZE],
+              args.counts[m] * sizeof(size_t));
+      j += args.counts[m];
     }
+    free(kept_values);
+    free(kept_positions);
+    result->num_tuples = j;
+    result->data_type = POSITIONLIST;
+    result->payload = args.positions;
   }
-
-  Result* result = calloc(1, sizeof(Result));
-  result->num_tuples = j;
+  free(args.counts);
   // log_err("j is after select: %ld", j);
-  result->data_type = POSITIONLIST;
-  result->payload = payload;
   return result;
 }
 
@@ -337,7 +605,10 @@ char* execute_select(DbOperator* query, ClientContext* client_context) {
   }
 
   assert(result != NULL);
-  adjust_result_for_updates(result, column, min_val, max_val);
+  // pending inserts and deletes only exist for base columns
+  if (query->operator_fields.select_operator.src->column_type == COLUMN) {
+    adjust_result_for_updates(result, column, min_val, max_val);
+  }
   insert_result_context(result, query->operator_fields.select_operator.handle,
                         client_context);
   // if src is a column then we malloced a generalized column type while parsing
@@ -347,40 +618,92 @@ char* execute_select(DbOperator* query, ClientContext* client_context) {
   return "";
 }
 
+/*
+ * Arguments shared by the morsels of a fetch. Positions at or past num_rows
+ * are pending inserts. For bitvectors counts holds the number of set bits in
+ * each morsel and then its offset into values.
+ */
+typedef struct FetchMorselArgs {
+  const Column* column;
+  size_t num_rows;
+  const size_t* positions;
+  const Bitvector* bits;
+  size_t* counts;
+  int* values;
+} FetchMorselArgs;
+
+static inline int fetch_value(const FetchMorselArgs* args, size_t pos) {
+  if (pos == NULL_POSITION) {
+    return 0;
+  }
+  return pos < args->num_rows
+             ? args->column->data[pos]
+             : args->column->update_struct.ins_val[pos - args->num_rows];
+}
+
+static void fetch_positions_morsel(void* arg, size_t morsel, size_t start,
+                                   size_t end) {
+  (void)morsel;
+  FetchMorselArgs* args = (FetchMorselArgs*)arg;
+  for (size_t i = start; i < end; i++) {
+    args->values[i] = fetch_value(args, args->positions[i]);
+  }
+}
+
+static void count_bitvector_morsel(void* arg, size_t morsel, size_t start,
+                                   size_t end) {
+  FetchMorselArgs* args = (FetchMorselArgs*)arg;
+  args->counts[morsel] = bitvector_count_words(args->bits, start / 64,
+                                               bitvector_num_words(end));
+}
+
+/*
+ * Walks the set bits word by word.
+ */
+static void fetch_bitvector_morsel(void* arg, size_t morsel, size_t start,
+                                   size_t end) {
+  FetchMorselArgs* args = (FetchMorselArgs*)arg;
+  size_t j = args->counts[morsel];
+  for (size_t w = start / 64; w < bitvector_num_words(end); w++) {
+    uint64_t word = args->bits->words[w];
+    while (word != 0) {
+      args->values[j++] = fetch_value(args, w * 64 + __builtin_ctzll(word));
+      word &= word - 1;
+    }
+  }
+}
+
 char* execute_fetch(DbOperator* query, ClientContext* client_context) {
   if (query->operator_fields.fetch_operator.indices->data_type !=
-      POSITIONLIST) {
-    return "error: indices are not position list";
+          POSITIONLIST &&
+      query->operator_fields.fetch_operator.indices->data_type != BITVECTOR) {
+    return "error: indices are not position list or bitvector";
   }
   Result* result = malloc(sizeof(Result));
   int* payload;
-  size_t j = 0;
-  if (query->operator_fields.fetch_operator.indices->num_tuples == 0) {
+  size_t j = query->operator_fields.fetch_operator.indices->num_tuples;
+  FetchMorselArgs args = {
+      .column = query->operator_fields.fetch_operator.column,
+      .num_rows = *query->operator_fields.fetch_operator.column->num_rows};
+  if (j == 0) {
     payload = NULL;
+  } else if (query->operator_fields.fetch_operator.indices->data_type ==
+             BITVECTOR) {
+    // count the set bits of each morsel first so every morsel knows where its
+    // values go
+    args.bits = query->operator_fields.fetch_operator.indices->payload;
+    args.values = payload = malloc(j * sizeof(int));
+    args.counts = malloc(morsel_num(args.bits->num_bits) * sizeof(size_t));
+    morsel_run(args.bits->num_bits, &count_bitvector_morsel, &args);
+    morsel_offsets(args.counts, morsel_num(args.bits->num_bits));
+    morsel_run(args.bits->num_bits, &fetch_bitvector_morsel, &args);
+    free(args.counts);
   } else {
-    payload = malloc(query->operator_fields.fetch_operator.indices->num_tuples *
-                     sizeof(int));
-    size_t* indices = query->operator_fields.fetch_operator.indices->payload;
-    for (size_t i = 0;
-         i <
-         query->operator_fields.fetch_operator.indices->num_tuples -
-             query->operator_fields.fetch_operator.indices->num_update_tuples;
-         i++) {
-      payload[j++] =
-          query->operator_fields.fetch_operator.column->data[indices[i]];
-    }
-
-    // go through the differential struct where has positions starting from
-    // column.num_rows
-    for (size_t i =
-             query->operator_fields.fetch_operator.indices->num_tuples -
-             query->operator_fields.fetch_operator.indices->num_update_tuples;
-         i < query->operator_fields.fetch_operator.indices->num_tuples; i++) {
-      payload[j++] =
-          query->operator_fields.fetch_operator.column->update_struct
-              .ins_val[indices[i] %
-                       *query->operator_fields.fetch_operator.column->num_rows];
-    }
+    // positions past the base data index the differential struct, which has
+    // positions starting from column.num_rows
+    args.positions = query->operator_fields.fetch_operator.indices->payload;
+    args.values = payload = malloc(j * sizeof(int));
+    morsel_run(j, &fetch_positions_morsel, &args);
   }
 
   result->num_tuples = j;
@@ -395,40 +718,127 @@ char* execute_fetch(DbOperator* query, ClientContext* client_context) {
   return " ";
 }
 
+/*
+ * Int values of an aggregate or arithmetic input, which is either a base
+ * column or an INT result.
+ */
+static int* generalized_int_data(GeneralizedColumn* column,
+                                 size_t* num_values) {
+  if (column->column_type == RESULT) {
+    *num_values = column->column_pointer.result->num_tuples;
+    return (int*)column->column_pointer.result->payload;
+  }
+  *num_values = *column->column_pointer.column->num_rows;
+  return column->column_pointer.column->data;
+}
+
+/*
+ * Partial sum, min and max of each morsel, merged in morsel order.
+ */
+typedef struct AggMorselArgs {
+  const int* data;
+  ScanAggregate* partials;
+} AggMorselArgs;
+
+static void agg_morsel(void* arg, size_t morsel, size_t start, size_t end) {
+  AggMorselArgs* args = (AggMorselArgs*)arg;
+  args->partials[morsel] = SCAN_AGGREGATE_INIT;
+  scan_aggregate(&args->data[start], end - start, &args->partials[morsel]);
+}
+
+/*
+ * Sum, min and max of num_values ints computed in one pass with the SIMD
+ * kernels over morsels in parallel. The sum is exact since it is kept in 64
+ * bits. No values gives 0, INT_MAX and INT_MIN.
+ */
+static void int_aggregates(const int* data, size_t num_values, long* sum,
+                           int* min, int* max) {
+  size_t num_morsels = morsel_num(num_values);
+  AggMorselArgs args = {
+      .data = data,
+      .partials = malloc((num_morsels + 1) * sizeof(ScanAggregate))};
+  morsel_run(num_values, &agg_morsel, &args);
+  ScanAggregate agg = SCAN_AGGREGATE_INIT;
+  for (size_t m = 0; m < num_morsels; m++) {
+    scan_aggregate_merge(&agg, &args.partials[m]);
+  }
+  free(args.partials);
+  *sum = agg.sum;
+  *min = agg.min;
+  *max = agg.max;
+}
+
+/*
+ * Count, sum, min and max of an aggregate's input. Base columns are answered
+ * from their statistics without reading the data, int results are scanned.
+ */
+static void generalized_aggregates(GeneralizedColumn* column,
+                                   ScanAggregate* agg) {
+  if (column->column_type == COLUMN) {
+    stats_aggregate(column->column_pointer.column, agg);
+    return;
+  }
+  int* data = generalized_int_data(column, &agg->count);
+  int_aggregates(data, agg->count, &agg->sum, &agg->min, &agg->max);
+}
+
+static bool is_error_string(const char* res_string) {
+  return res_string == NULL || res_string[strspn(res_string, " ")] != '\0';
+}
+
+/*
+ * Result of an avg, sum, min or max given the sum, min and max of num_values
+ * values.
+ */
+static Result* aggregate_result(OperatorType type, long sum, int min, int max,
+                                size_t num_values) {
+  Result* result = calloc(1, sizeof(Result));
+  result->num_tuples = 1;
+  switch (type) {
+    case SUM:
+      result->data_type = LONG;
+      result->payload = malloc(sizeof(long));
+      *(long*)result->payload = sum;
+      break;
+    case AVG:
+      result->data_type = DOUBLE;
+      result->payload = malloc(sizeof(double));
+      *(double*)result->payload =
+          num_values == 0 ? 0.0 : (double)sum / (double)num_values;
+      break;
+    default:
+      result->data_type = INT;
+      result->payload = malloc(sizeof(int));
+      *(int*)result->payload = type == MIN ? min : max;
+      break;
+  }
+  return result;
+}
+
+/*
+ * Whether an aggregate's input is a position list or bitvector. Positions
+ * only have a count, their values have to be fetched first.
+ */
+static bool aggregates_positions(const GeneralizedColumn* column) {
+  return column->column_type == RESULT &&
+         (column->column_pointer.result->data_type == POSITIONLIST ||
+          column->column_pointer.result->data_type == BITVECTOR);
+}
+
 char* execute_avg(DbOperator* query, ClientContext* client_context) {
+  if (aggregates_positions(&query->operator_fields.agg_operator.column)) {
+    return "Attempted to avg positions, fetch their values first";
+  }
   // still only handling ints
   if (query->operator_fields.agg_operator.column.column_type == RESULT &&
       query->operator_fields.agg_operator.column.column_pointer.result
               ->data_type != INT) {
     return "Attempted to avg non-int column/result";
   }
-  double total = 0.0;
   double* payload = malloc(sizeof(double));
-  if (query->operator_fields.agg_operator.column.column_type == RESULT) {
-    if (query->operator_fields.agg_operator.column.column_pointer.result
-            ->num_tuples != 0) {
-      for (size_t i = 0; i < query->operator_fields.agg_operator.column
-                                 .column_pointer.result->num_tuples;
-           i++) {
-        total += ((int*)query->operator_fields.agg_operator.column
-                      .column_pointer.result->payload)[i];
-      }
-      *payload = total / query->operator_fields.agg_operator.column
-                             .column_pointer.result->num_tuples;
-    }
-  } else {
-    if (*(query->operator_fields.agg_operator.column.column_pointer.column
-              ->num_rows) != 0) {
-      for (size_t i = 0; i < *(query->operator_fields.agg_operator.column
-                                   .column_pointer.column->num_rows);
-           i++) {
-        total += query->operator_fields.agg_operator.column.column_pointer
-                     .column->data[i];
-      }
-      *payload = total / (double)*(query->operator_fields.agg_operator.column
-                                       .column_pointer.column->num_rows);
-    }
-  }
+  ScanAggregate agg;
+  generalized_aggregates(&query->operator_fields.agg_operator.column, &agg);
+  *payload = agg.count == 0 ? 0.0 : (double)agg.sum / (double)agg.count;
 
   Result* result = malloc(sizeof(Result));
   result->num_tuples = 1;
@@ -440,31 +850,19 @@ char* execute_avg(DbOperator* query, ClientContext* client_context) {
 }
 
 char* execute_sum(DbOperator* query, ClientContext* client_context) {
+  if (aggregates_positions(&query->operator_fields.agg_operator.column)) {
+    return "Attempted to sum positions, fetch their values first";
+  }
   // still only handling ints
   if (query->operator_fields.agg_operator.column.column_type == RESULT &&
       query->operator_fields.agg_operator.column.column_pointer.result
               ->data_type != INT) {
     return "Attempted to sum a non-int column/result";
   }
-  long total = 0;
   long* payload = malloc(sizeof(long));
-  if (query->operator_fields.agg_operator.column.column_type == RESULT) {
-    for (size_t i = 0; i < query->operator_fields.agg_operator.column
-                               .column_pointer.result->num_tuples;
-         i++) {
-      total += ((int*)query->operator_fields.agg_operator.column.column_pointer
-                    .result->payload)[i];
-    }
-    *payload = total;
-  } else {
-    for (size_t i = 0; i < *(query->operator_fields.agg_operator.column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      total += query->operator_fields.agg_operator.column.column_pointer.column
-                   ->data[i];
-    }
-    *payload = total;
-  }
+  ScanAggregate agg;
+  generalized_aggregates(&query->operator_fields.agg_operator.column, &agg);
+  *payload = agg.sum;
 
   Result* result = malloc(sizeof(Result));
   result->num_tuples = 1;
@@ -477,37 +875,19 @@ char* execute_sum(DbOperator* query, ClientContext* client_context) {
 }
 
 char* execute_max(DbOperator* query, ClientContext* client_context) {
+  if (aggregates_positions(&query->operator_fields.agg_operator.column)) {
+    return "Attempted to max positions, fetch their values first";
+  }
   // still only handling ints
   if (query->operator_fields.agg_operator.column.column_type == RESULT &&
       query->operator_fields.agg_operator.column.column_pointer.result
               ->data_type != INT) {
     return "Attempted to max a non-int column/result";
   }
-  int max = INT_MIN;
-  int* payload = malloc(sizeof(float));
-  if (query->operator_fields.agg_operator.column.column_type == RESULT) {
-    for (size_t i = 0; i < query->operator_fields.agg_operator.column
-                               .column_pointer.result->num_tuples;
-         i++) {
-      max = ((int*)query->operator_fields.agg_operator.column.column_pointer
-                 .result->payload)[i] > max
-                ? ((int*)query->operator_fields.agg_operator.column
-                       .column_pointer.result->payload)[i]
-                : max;
-    }
-    *payload = max;
-  } else {
-    for (size_t i = 0; i < *(query->operator_fields.agg_operator.column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      max = query->operator_fields.agg_operator.column.column_pointer.column
-                        ->data[i] > max
-                ? query->operator_fields.agg_operator.column.column_pointer
-                      .column->data[i]
-                : max;
-    }
-    *payload = max;
-  }
+  int* payload = malloc(sizeof(int));
+  ScanAggregate agg;
+  generalized_aggregates(&query->operator_fields.agg_operator.column, &agg);
+  *payload = agg.max;
 
   Result* result = malloc(sizeof(Result));
   result->num_tuples = 1;
@@ -519,37 +899,19 @@ char* execute_max(DbOperator* query, ClientContext* client_context) {
 }
 
 char* execute_min(DbOperator* query, ClientContext* client_context) {
+  if (aggregates_positions(&query->operator_fields.agg_operator.column)) {
+    return "Attempted to min positions, fetch their values first";
+  }
   // still only handling ints
   if (query->operator_fields.agg_operator.column.column_type == RESULT &&
       query->operator_fields.agg_operator.column.column_pointer.result
               ->data_type != INT) {
     return "Attempted to max a non-int column/result";
   }
-  int min = INT_MAX;
-  int* payload = malloc(sizeof(float));
-  if (query->operator_fields.agg_operator.column.column_type == RESULT) {
-    for (size_t i = 0; i < query->operator_fields.agg_operator.column
-                               .column_pointer.result->num_tuples;
-         i++) {
-      min = ((int*)query->operator_fields.agg_operator.column.column_pointer
-                 .result->payload)[i] < min
-                ? ((int*)query->operator_fields.agg_operator.column
-                       .column_pointer.result->payload)[i]
-                : min;
-    }
-    *payload = min;
-  } else {
-    for (size_t i = 0; i < *(query->operator_fields.agg_operator.column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      min = query->operator_fields.agg_operator.column.column_pointer.column
-                        ->data[i] < min
-                ? query->operator_fields.agg_operator.column.column_pointer
-                      .column->data[i]
-                : min;
-    }
-    *payload = min;
-  }
+  int* payload = malloc(sizeof(int));
+  ScanAggregate agg;
+  generalized_aggregates(&query->operator_fields.agg_operator.column, &agg);
+  *payload = agg.min;
 
   Result* result = malloc(sizeof(Result));
   result->num_tuples = 1;
@@ -560,234 +922,559 @@ char* execute_min(DbOperator* query, ClientContext* client_context) {
   return " ";
 }
 
-char* execute_add(DbOperator* query, ClientContext* client_context) {
-  // still only handling ints
-  if ((query->operator_fields.binary_operator.left_column.column_type ==
-           RESULT &&
-       query->operator_fields.binary_operator.left_column.column_pointer.result
-               ->data_type != INT) ||
-      (query->operator_fields.binary_operator.right_column.column_type ==
-           RESULT &&
-       query->operator_fields.binary_operator.right_column.column_pointer
-               .result->data_type != INT)) {
-    return "Attempted to add a non-int column/result";
-  }
-
-  int* payload =
-      malloc(sizeof(int) * query->operator_fields.binary_operator.left_column
-                               .column_pointer.result->num_tuples);
-
-  // Logic to see what combination of.left_column and.right_column are column
-  // and result type and then operate on them accordingly
-  if (query->operator_fields.binary_operator.left_column.column_type ==
-          RESULT &&
-      query->operator_fields.binary_operator.right_column.column_type ==
-          RESULT) {
-    for (size_t i = 0; i < query->operator_fields.binary_operator.left_column
-                               .column_pointer.result->num_tuples;
-         i++) {
-      payload[i] = ((int*)query->operator_fields.binary_operator.left_column
-                        .column_pointer.result->payload)[i] +
-                   ((int*)query->operator_fields.binary_operator.right_column
-                        .column_pointer.result->payload)[i];
-    }
-  } else if (query->operator_fields.binary_operator.left_column.column_type ==
-                 RESULT &&
-             query->operator_fields.binary_operator.right_column.column_type ==
-                 COLUMN) {
-    for (size_t i = 0; i < *(query->operator_fields.binary_operator.left_column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      payload[i] = ((int*)query->operator_fields.binary_operator.left_column
-                        .column_pointer.result->payload)[i] +
-                   query->operator_fields.binary_operator.right_column
-                       .column_pointer.column->data[i];
-    }
-  } else if (query->operator_fields.binary_operator.left_column.column_type ==
-                 COLUMN &&
-             query->operator_fields.binary_operator.right_column.column_type ==
-                 RESULT) {
-    for (size_t i = 0; i < *(query->operator_fields.binary_operator.left_column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      payload[i] = query->operator_fields.binary_operator.left_column
-                       .column_pointer.column->data[i] +
-                   ((int*)query->operator_fields.binary_operator.right_column
-                        .column_pointer.result->payload)[i];
-    }
+/*
+ * Number of values in a column or result. Base columns count their logical
+ * rows, pending inserts included and pending deletes left out.
+ */
+char* execute_count(DbOperator* query, ClientContext* client_context) {
+  GeneralizedColumn* column = &query->operator_fields.agg_operator.column;
+  long* payload = malloc(sizeof(long));
+  if (column->column_type == COLUMN) {
+    ScanAggregate agg;
+    stats_aggregate(column->column_pointer.column, &agg);
+    *payload = agg.count;
+  } else if (column->column_pointer.result->data_type == POSITIONLIST) {
+    // unmatched rows of a left outer join are not counted
+    *payload = count_positions(column->column_pointer.result->payload,
+                               column->column_pointer.result->num_tuples);
   } else {
-    for (size_t i = 0; i < *(query->operator_fields.binary_operator.left_column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      payload[i] = query->operator_fields.binary_operator.left_column
-                       .column_pointer.column->data[i] +
-                   query->operator_fields.binary_operator.right_column
-                       .column_pointer.column->data[i];
-    }
+    *payload = column->column_pointer.result->num_tuples;
   }
 
   Result* result = malloc(sizeof(Result));
-  result->num_tuples = query->operator_fields.binary_operator.left_column
-                           .column_pointer.result->num_tuples;
-  result->data_type = INT;
+  result->num_tuples = 1;
+  result->data_type = LONG;
   result->payload = payload;
-  insert_result_context(result, query->operator_fields.binary_operator.handle,
+  insert_result_context(result, query->operator_fields.agg_operator.handle,
                         client_context);
   return " ";
 }
 
-char* execute_sub(DbOperator* query, ClientContext* client_context) {
-  // still only handling ints
-  if ((query->operator_fields.binary_operator.left_column.column_type ==
-           RESULT &&
-       query->operator_fields.binary_operator.left_column.column_pointer.result
-               ->data_type != INT) ||
-      (query->operator_fields.binary_operator.right_column.column_type ==
-           RESULT &&
-       query->operator_fields.binary_operator.right_column.column_pointer
-               .result->data_type != INT)) {
-    return "Attempted to add a non-int column/result";
-  }
-
-  int* payload =
-      malloc(sizeof(int) * query->operator_fields.binary_operator.left_column
-                               .column_pointer.result->num_tuples);
-
-  // Logic to see what combination of.left_column and.right_column are column
-  // and result type and then operate on them accordingly
-  if (query->operator_fields.binary_operator.left_column.column_type ==
-          RESULT &&
-      query->operator_fields.binary_operator.right_column.column_type ==
-          RESULT) {
-    for (size_t i = 0; i < query->operator_fields.binary_operator.left_column
-                               .column_pointer.result->num_tuples;
-         i++) {
-      payload[i] = ((int*)query->operator_fields.binary_operator.left_column
-                        .column_pointer.result->payload)[i] -
-                   ((int*)query->operator_fields.binary_operator.right_column
-                        .column_pointer.result->payload)[i];
-    }
-  } else if (query->operator_fields.binary_operator.left_column.column_type ==
-                 RESULT &&
-             query->operator_fields.binary_operator.right_column.column_type ==
-                 COLUMN) {
-    for (size_t i = 0; i < *(query->operator_fields.binary_operator.left_column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      payload[i] = ((int*)query->operator_fields.binary_operator.left_column
-                        .column_pointer.result->payload)[i] -
-                   query->operator_fields.binary_operator.right_column
-                       .column_pointer.column->data[i];
-    }
-  } else if (query->operator_fields.binary_operator.left_column.column_type ==
-                 COLUMN &&
-             query->operator_fields.binary_operator.right_column.column_type ==
-                 RESULT) {
-    for (size_t i = 0; i < *(query->operator_fields.binary_operator.left_column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      payload[i] = query->operator_fields.binary_operator.left_column
-                       .column_pointer.column->data[i] -
-                   ((int*)query->operator_fields.binary_operator.right_column
-                        .column_pointer.result->payload)[i];
-    }
+/*
+ * Estimated number of distinct values, from the column's sketch for base
+ * columns. Positions are distinct, so a position result counts its tuples.
+ */
+char* execute_count_distinct(DbOperator* query,
+                             ClientContext* client_context) {
+  GeneralizedColumn* column = &query->operator_fields.agg_operator.column;
+  long* payload = malloc(sizeof(long));
+  if (column->column_type == COLUMN) {
+    *payload = stats_count_distinct(column->column_pointer.column);
+  } else if (column->column_pointer.result->data_type == INT) {
+    *payload = count_distinct(column->column_pointer.result->payload,
+                              column->column_pointer.result->num_tuples);
+  } else if (column->column_pointer.result->data_type == POSITIONLIST) {
+    *payload = count_positions(column->column_pointer.result->payload,
+                               column->column_pointer.result->num_tuples);
+  } else if (column->column_pointer.result->data_type == BITVECTOR) {
+    *payload = column->column_pointer.result->num_tuples;
   } else {
-    for (size_t i = 0; i < *(query->operator_fields.binary_operator.left_column
-                                 .column_pointer.column->num_rows);
-         i++) {
-      payload[i] = query->operator_fields.binary_operator.left_column
-                       .column_pointer.column->data[i] -
-                   query->operator_fields.binary_operator.right_column
-                       .column_pointer.column->data[i];
-    }
+    free(payload);
+    return "Attempted to count distinct values of a non-int result";
   }
 
   Result* result = malloc(sizeof(Result));
-  result->num_tuples = query->operator_fields.binary_operator.left_column
-                           .column_pointer.result->num_tuples;
-  result->data_type = INT;
+  result->num_tuples = 1;
+  result->data_type = LONG;
   result->payload = payload;
-  insert_result_context(result, query->operator_fields.binary_operator.handle,
+  insert_result_context(result, query->operator_fields.agg_operator.handle,
                         client_context);
   return " ";
 }
 
-/**
- * append_batch_operator appends a query to a contexts batch_operators array
- * the idea is that the execute function will decide how to split up queries
- * three cases:
- * new batch and batch_operators is null
- * batch_operators array is full and we need to resize
- * spare space in batch_operators
+/*
+ * Arguments shared by the morsels of a select_agg. deleted holds the sorted
+ * base positions with pending deletes, each morsel aggregates the rows
+ * between the ones that fall inside it.
  */
-char* append_batch_operator(DbOperator* query) {
-  if (query->context->batch_operators == NULL) {
-    query->context->batch_operators = malloc(5 * sizeof(DbOperator));
-    query->context->batch_operators[0] = *query;
-    query->context->batch_operators_in_use = 1;
-    query->context->batch_operator_slots = 5;
-    return " ";
-  }
+typedef struct SelectAggMorselArgs {
+  const int* keys;
+  const int* values;
+  const ZoneMap* zonemap;
+  const size_t* deleted;
+  size_t num_deleted;
+  int min_val;
+  int max_val;
+  ScanAggregate* partials;
+} SelectAggMorselArgs;
 
-  if (query->context->batch_operator_slots <=
-      query->context->batch_operators_in_use) {
-    query->context->batch_operators =
-        realloc(query->context->batch_operators,
-                2 * query->context->batch_operator_slots * sizeof(DbOperator));
-    query->context->batch_operator_slots =
-        2 * query->context->batch_operator_slots;
+/*
+ * Aggregates rows [start, end) one zone map block at a time, like
+ * zonemap_scan_select. Blocks which match entirely skip the key column.
+ */
+static void select_agg_range(const SelectAggMorselArgs* args, size_t start,
+                             size_t end, ScanAggregate* agg) {
+  if (args->zonemap == NULL) {
+    scan_select_aggregate(&args->keys[start], &args->values[start],
+                          end - start, args->min_val, args->max_val, agg);
+    return;
   }
+  for (size_t b = start / ZONEMAP_BLOCK_SIZE; b * ZONEMAP_BLOCK_SIZE < end;
+       b++) {
+    size_t block_start =
+        b * ZONEMAP_BLOCK_SIZE < start ? start : b * ZONEMAP_BLOCK_SIZE;
+    size_t block_end = end - b * ZONEMAP_BLOCK_SIZE < ZONEMAP_BLOCK_SIZE
+                           ? end
+                           : (b + 1) * ZONEMAP_BLOCK_SIZE;
+    switch (zonemap_match(args->zonemap, b, args->min_val, args->max_val)) {
+      case ZONE_NONE:
+        break;
+      case ZONE_ALL:
+        scan_aggregate(&args->values[block_start], block_end - block_start,
+                       agg);
+        break;
+      case ZONE_SOME:
+        scan_select_aggregate(&args->keys[block_start],
+                              &args->values[block_start],
+                              block_end - block_start, args->min_val,
+                              args->max_val, agg);
+        break;
+    }
+  }
+}
 
-  query->context->batch_operators[query->context->batch_operators_in_use] =
-      *query;
-  query->context->batch_operators_in_use += 1;
-
-  return " ";
+static void select_agg_morsel(void* arg, size_t morsel, size_t start,
+                              size_t end) {
+  SelectAggMorselArgs* args = (SelectAggMorselArgs*)arg;
+  ScanAggregate agg = SCAN_AGGREGATE_INIT;
+  // first pending delete at or after start
+  size_t lo = 0;
+  size_t hi = args->num_deleted;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (args->deleted[mid] < start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  for (size_t d = lo; d < args->num_deleted && args->deleted[d] < end; d++) {
+    select_agg_range(args, start, args->deleted[d], &agg);
+    start = args->deleted[d] + 1;
+  }
+  select_agg_range(args, start, end, &agg);
+  args->partials[morsel] = agg;
 }
 
 /*
- * Function passed to execute a shared scan. Meant to be passed to pthread, but
- * could run standalone
- * TODO need to write a struct to pass arguments and to store results.
+ * select, fetch and an aggregate fused into one pass over the key and value
+ * columns. Neither positions nor fetched values are materialised, each morsel
+ * keeps a running count, sum, min and max of the values whose key qualifies.
+ * Pending deletes are skipped and pending inserts are checked afterwards.
  */
-
-void* execute_shared_select(void* thread_args) {
-  SharedScanArgs* args = (SharedScanArgs*)thread_args;
-  if (args->data_type != INT) {
-    log_err("Attempted to do share scan on non int data");
-    return NULL;
+char* execute_select_agg(DbOperator* query, ClientContext* client_context) {
+  SelectAggOperator* select_agg = &query->operator_fields.select_agg_operator;
+  Column* key = select_agg->key_column;
+  Column* value = select_agg->value_column;
+  const size_t num_rows = *key->num_rows;
+  const size_t num_morsels = morsel_num(num_rows);
+
+  size_t num_deleted;
+  size_t* deleted = column_deleted_positions(key, &num_deleted);
+
+  SelectAggMorselArgs args = {
+      .keys = key->data,
+      .values = value->data,
+      .deleted = deleted,
+      .num_deleted = num_deleted,
+      .min_val = select_agg->minimum,
+      .max_val = select_agg->maximum,
+      .partials = malloc((num_morsels + 1) * sizeof(ScanAggregate))};
+  if (key->zonemap != NULL &&
+      key->zonemap->num_blocks == zonemap_num_blocks(num_rows)) {
+    args.zonemap = key->zonemap;
   }
+  morsel_run(num_rows, &select_agg_morsel, &args);
 
-  // pthread_t thId = pthread_self();
-
-  int* data = (int*)args->data;
-
-  // printf("num queries %d, vect_size %d \n", args->num_queries,
-  // args->vect_size ); size_t sel_in_vector = 0;
-  const size_t offset = args->position_offset;
-  const size_t vect_size = args->vect_size;
-  const size_t num_queries = args->num_queries;
-
-  for (size_t i = 0; i < vect_size; i++) {
-    for (size_t k = 0; k < num_queries; k++) {
-      ((size_t*)args->results[k]->payload)[args->results[k]->num_tuples] =
-          offset + i;
-      // printf("id: %d : data: %d\n", thId, data[i]);
-      args->results[k]->num_tuples += ((data[i] >= args->comps[k].p_low) &
-                                       (data[i] < args->comps[k].p_high));
+  ScanAggregate agg = SCAN_AGGREGATE_INIT;
+  for (size_t m = 0; m < num_morsels; m++) {
+    scan_aggregate_merge(&agg, &args.partials[m]);
+  }
+  for (size_t k = 0; k < key->update_struct.ins_length; k++) {
+    if ((key->update_struct.ins_val[k] >= args.min_val) &
+        (key->update_struct.ins_val[k] < args.max_val)) {
+      int v = value->update_struct.ins_val[k];
+      agg.count += 1;
+      agg.sum += v;
+      agg.min = v < agg.min ? v : agg.min;
+      agg.max = v > agg.max ? v : agg.max;
     }
   }
-  return NULL;
+  free(args.partials);
+  free(deleted);
+
+  Result* result = aggregate_result(select_agg->agg_type, agg.sum, agg.min,
+                                    agg.max, agg.count);
+  insert_result_context(result, select_agg->handle, client_context);
+  return " ";
+}
+
+static bool is_int_input(const GeneralizedColumn* column) {
+  return column->column_type == COLUMN ||
+         column->column_pointer.result->data_type == INT;
 }
 
 /*
- * This function callss functions defined in db_index.h
- * These will either create a unclustered index, or mark that a clustered index
- * will need to be built when the data is loaded.
+ * Groups rows by key and stores the distinct keys, in increasing order, and
+ * one result per aggregate with the aggregate of each group in the same
+ * order.
  */
-
-char* create_index(DbOperator* query) {
-  if (INDEXES == 0) {
+char* execute_group_by(DbOperator* query, ClientContext* client_context) {
+  GroupByOperator* group_by_op = &query->operator_fields.group_by_operator;
+  const size_t num_aggregates = group_by_op->num_aggregates;
+  char* res_string = " ";
+  size_t num_rows;
+  const int* keys = generalized_int_data(group_by_op->key, &num_rows);
+  const int* values[GROUP_BY_MAX_AGGREGATES] = {NULL};
+  if (!is_int_input(group_by_op->key)) {
+    res_string = "group_by keys must be a column or int result";
+  }
+  for (size_t a = 0; a < num_aggregates; a++) {
+    size_t num_values;
+    values[a] = generalized_int_data(group_by_op->values[a], &num_values);
+    if (!is_int_input(group_by_op->values[a])) {
+      res_string = "group_by values must be a column or int result";
+    } else if (num_values != num_rows) {
+      res_string = "group_by values must be as long as the keys";
+    }
+  }
+
+  if (!is_error_string(res_string)) {
+    size_t num_groups;
+    GroupEntry* groups =
+        group_by(keys, values, num_aggregates, num_rows, &num_groups);
+    Result* key_result = calloc(1, sizeof(Result));
+    key_result->data_type = INT;
+    key_result->num_tuples = num_groups;
+    key_result->payload = malloc((num_groups + 1) * sizeof(int));
+    for (size_t g = 0; g < num_groups; g++) {
+      ((int*)key_result->payload)[g] = groups[g].key;
+    }
+    insert_result_context(key_result, group_by_op->key_handle,
+                          client_context);
+
+    for (size_t a = 0; a < num_aggregates; a++) {
+      Result* agg_result = calloc(1, sizeof(Result));
+      agg_result->num_tuples = num_groups;
+      switch (group_by_op->agg_types[a]) {
+        case SUM:
+          agg_result->data_type = LONG;
+          agg_result->payload = malloc((num_groups + 1) * sizeof(long));
+          for (size_t g = 0; g < num_groups; g++) {
+            ((long*)agg_result->payload)[g] = groups[g].sums[a];
+          }
+          break;
+        case AVG:
+          agg_result->data_type = DOUBLE;
+          agg_result->payload = malloc((num_groups + 1) * sizeof(double));
+          for (size_t g = 0; g < num_groups; g++) {
+            ((double*)agg_result->payload)[g] =
+                (double)groups[g].sums[a] / (double)groups[g].count;
+          }
+          break;
+        default:
+          agg_result->data_type = INT;
+          agg_result->payload = malloc((num_groups + 1) * sizeof(int));
+          for (size_t g = 0; g < num_groups; g++) {
+            ((int*)agg_result->payload)[g] = group_by_op->agg_types[a] == MIN
+                                                  ? groups[g].mins[a]
+                                                  : groups[g].maxs[a];
+          }
+          break;
+      }
+      insert_result_context(agg_result, group_by_op->agg_handles[a],
+                            client_context);
+    }
+    free(groups);
+  }
+
+  free(group_by_op->key);
+  for (size_t a = 0; a < num_aggregates; a++) {
+    free(group_by_op->values[a]);
+  }
+  return res_string;
+}
+
+typedef struct ArithmeticMorselArgs {
+  const int* left;
+  const int* right;
+  int* values;
+} ArithmeticMorselArgs;
+
+static void add_morsel(void* arg, size_t morsel, size_t start, size_t end) {
+  (void)morsel;
+  ArithmeticMorselArgs* args = (ArithmeticMorselArgs*)arg;
+  for (size_t i = start; i < end; i++) {
+    args->values[i] = args->left[i] + args->right[i];
+  }
+}
+
+static void sub_morsel(void* arg, size_t morsel, size_t start, size_t end) {
+  (void)morsel;
+  ArithmeticMorselArgs* args = (ArithmeticMorselArgs*)arg;
+  for (size_t i = start; i < end; i++) {
+    args->values[i] = args->left[i] - args->right[i];
+  }
+}
+
+/*
+ * Element wise add or sub of two columns/results of the same length, each
+ * morsel writes its own range of the output.
+ */
+static char* execute_arithmetic(DbOperator* query,
+                                ClientContext* client_context,
+                                OperatorType type) {
+  // still only handling ints
+  if ((query->operator_fields.binary_operator.left_column.column_type ==
+           RESULT &&
+       query->operator_fields.binary_operator.left_column.column_pointer.result
+               ->data_type != INT) ||
+      (query->operator_fields.binary_operator.right_column.column_type ==
+           RESULT &&
+       query->operator_fields.binary_operator.right_column.column_pointer
+               .result->data_type != INT)) {
+    return type == ADD ? "Attempted to add a non-int column/result"
+                       : "Attempted to sub a non-int column/result";
+  }
+
+  size_t left_length;
+  size_t right_length;
+  ArithmeticMorselArgs args;
+  args.left = generalized_int_data(
+      &query->operator_fields.binary_operator.left_column, &left_length);
+  args.right = generalized_int_data(
+      &query->operator_fields.binary_operator.right_column, &right_length);
+  if (left_length != right_length) {
+    return "Attempted arithmetic on columns/results of different lengths";
+  }
+  args.values = malloc(sizeof(int) * left_length);
+  morsel_run(left_length, type == ADD ? &add_morsel : &sub_morsel, &args);
+
+  Result* result = malloc(sizeof(Result));
+  result->num_tuples = left_length;
+  result->data_type = INT;
+  result->payload = args.values;
+  insert_result_context(result, query->operator_fields.binary_operator.handle,
+                        client_context);
+  return " ";
+}
+
+char* execute_add(DbOperator* query, ClientContext* client_context) {
+  return execute_arithmetic(query, client_context, ADD);
+}
+
+char* execute_sub(DbOperator* query, ClientContext* client_context) {
+  return execute_arithmetic(query, client_context, SUB);
+}
+
+/*
+ * Number of positions a result can address when it is turned into a
+ * bitvector, position lists only know their largest position.
+ */
+static size_t result_num_bits(Result* result) {
+  if (result->data_type == BITVECTOR) {
+    return ((Bitvector*)result->payload)->num_bits;
+  }
+  size_t num_bits = 0;
+  for (size_t i = 0; i < result->num_tuples; i++) {
+    size_t pos = ((size_t*)result->payload)[i];
+    if (pos != NULL_POSITION) {
+      num_bits = pos + 1 > num_bits ? pos + 1 : num_bits;
+    }
+  }
+  return num_bits;
+}
+
+/*
+ * and, or and not of select results. Position lists are converted to
+ * bitvectors first and the output is always a bitvector so the result can be
+ * fed into further combinators.
+ */
+char* execute_bitwise(DbOperator* query, ClientContext* client_context) {
+  GeneralizedColumn* left = &query->operator_fields.binary_operator.left_column;
+  GeneralizedColumn* right =
+      &query->operator_fields.binary_operator.right_column;
+  if (left->column_type != RESULT ||
+      (query->type != NOT && right->column_type != RESULT)) {
+    return "and, or and not only take select results";
+  }
+  Result* left_res = left->column_pointer.result;
+  Result* right_res = query->type == NOT ? NULL : right->column_pointer.result;
+  if ((left_res->data_type != BITVECTOR &&
+       left_res->data_type != POSITIONLIST) ||
+      (right_res != NULL && right_res->data_type != BITVECTOR &&
+       right_res->data_type != POSITIONLIST)) {
+    return "and, or and not only take position lists or bitvectors";
+  }
+
+  Bitvector* bits = NULL;
+  if (query->type == NOT) {
+    if (left_res->data_type != BITVECTOR) {
+      return "not needs a bitvector, a position list does not know how many "
+             "rows it was selected from";
+    }
+    bits = bitvector_not(left_res->payload);
+  } else {
+    size_t num_bits = result_num_bits(left_res);
+    size_t right_num_bits = result_num_bits(right_res);
+    num_bits = right_num_bits > num_bits ? right_num_bits : num_bits;
+    Bitvector* left_bits =
+        left_res->data_type == BITVECTOR
+            ? left_res->payload
+            : positions_to_bitvector(left_res->payload, left_res->num_tuples,
+                                     num_bits);
+    Bitvector* right_bits =
+        right_res->data_type == BITVECTOR
+            ? right_res->payload
+            : positions_to_bitvector(right_res->payload, right_res->num_tuples,
+                                     num_bits);
+    if (left_bits != NULL && right_bits != NULL) {
+      bits = query->type == AND ? bitvector_and(left_bits, right_bits)
+                                : bitvector_or(left_bits, right_bits);
+    }
+    if (left_bits != left_res->payload) free(left_bits);
+    if (right_bits != right_res->payload) free(right_bits);
+  }
+  if (bits == NULL) {
+    return "could not allocate bitvector";
+  }
+
+  Result* result = malloc(sizeof(Result));
+  result->num_tuples = bitvector_count(bits);
+  result->num_update_tuples =
+      bits->column == NULL
+          ? 0
+          : bitvector_count_from(bits, *bits->column->num_rows);
+  result->data_type = BITVECTOR;
+  result->payload = bits;
+  insert_result_context(result, query->operator_fields.binary_operator.handle,
+                        client_context);
+  return " ";
+}
+
+/**
+ * append_batch_operator appends a query to a contexts batch_operators array
+ * the idea is that the execute function will decide how to split up queries
+ * three cases:
+ * new batch and batch_operators is null
+ * batch_operators array is full and we need to resize
+ * spare space in batch_operators
+ */
+char* append_batch_operator(DbOperator* query) {
+  if (query->context->batch_operators == NULL) {
+    query->context->batch_operators = malloc(5 * sizeof(DbOperator));
+    query->context->batch_operators[0] = *query;
+    query->context->batch_operators_in_use = 1;
+    query->context->batch_operator_slots = 5;
+    return " ";
+  }
+
+  if (query->context->batch_operator_slots <=
+      query->context->batch_operators_in_use) {
+    query->context->batch_operators =
+        realloc(query->context->batch_operators,
+                2 * query->context->batch_operator_slots * sizeof(DbOperator));
+    query->context->batch_operator_slots =
+        2 * query->context->batch_operator_slots;
+  }
+
+  query->context->batch_operators[query->context->batch_operators_in_use] =
+      *query;
+  query->context->batch_operators_in_use += 1;
+
+  return " ";
+}
+
+/*
+ * Scans one vector of a column for a sub batch of at most QUERIES_PER_THREAD
+ * selects, appending matching positions to their results. The arguments and
+ * results are passed in SharedScanArgs, execute_shared_scan submits one call
+ * per sub batch to the thread pool.
+ */
+void* execute_shared_select(void* thread_args) {
+  SharedScanArgs* args = (SharedScanArgs*)thread_args;
+  if (args->data_type != INT) {
+    log_err("Attempted to do share scan on non int data");
+    return NULL;
+  }
+
+  // pthread_t thId = pthread_self();
+
+  int* data = (int*)args->data;
+
+  // printf("num queries %d, vect_size %d \n", args->num_queries,
+  // args->vect_size ); size_t sel_in_vector = 0;
+  const size_t offset = args->position_offset;
+  const size_t vect_size = args->vect_size;
+  const size_t num_queries = args->num_queries;
+
+  // walk the vector one zone map block at a time, queries which match all or
+  // none of a block are handled without looking at the data and the rest share
+  // the scan
+  size_t start = 0;
+  while (start < vect_size) {
+    size_t end = vect_size;
+    size_t scan_queries[QUERIES_PER_THREAD];
+    size_t num_scan_queries = 0;
+    if (args->zonemap != NULL) {
+      size_t block = (offset + start) / ZONEMAP_BLOCK_SIZE;
+      size_t block_end = (block + 1) * ZONEMAP_BLOCK_SIZE - offset;
+      end = block_end < vect_size ? block_end : vect_size;
+      for (size_t k = 0; k < num_queries; k++) {
+        switch (zonemap_match(args->zonemap, block, args->comps[k].p_low,
+                              args->comps[k].p_high)) {
+          case ZONE_NONE:
+            break;
+          case ZONE_ALL:
+            for (size_t i = start; i < end; i++) {
+              ((size_t*)args->results[k]
+                   ->payload)[args->results[k]->num_tuples++] = offset + i;
+            }
+            break;
+          case ZONE_SOME:
+            scan_queries[num_scan_queries++] = k;
+            break;
+        }
+      }
+    } else {
+      for (size_t k = 0; k < num_queries; k++) {
+        scan_queries[num_scan_queries++] = k;
+      }
+    }
+
+    // the remaining queries are evaluated together with SIMD, a tile of rows
+    // at a time
+    if (num_scan_queries > 0) {
+      int lows[QUERIES_PER_THREAD];
+      int highs[QUERIES_PER_THREAD];
+      size_t* positions[QUERIES_PER_THREAD];
+      size_t counts[QUERIES_PER_THREAD];
+      for (size_t q = 0; q < num_scan_queries; q++) {
+        size_t k = scan_queries[q];
+        lows[q] = (int)args->comps[k].p_low;
+        highs[q] = (int)args->comps[k].p_high;
+        positions[q] = (size_t*)args->results[k]->payload;
+        counts[q] = args->results[k]->num_tuples;
+      }
+      scan_select_shared(&data[start], offset + start, end - start, lows,
+                         highs, num_scan_queries, positions, counts);
+      for (size_t q = 0; q < num_scan_queries; q++) {
+        args->results[scan_queries[q]]->num_tuples = counts[q];
+      }
+    }
+    start = end;
+  }
+  return NULL;
+}
+
+/*
+ * This function callss functions defined in db_index.h
+ * These will either create a unclustered index, or mark that a clustered index
+ * will need to be built when the data is loaded.
+ */
+
+char* create_index(DbOperator* query) {
+  if (INDEXES == 0) {
     return "";
   }
   if (query->operator_fields.create_operator.index_type == SORTED &&
@@ -821,572 +1508,1618 @@ char* create_index(DbOperator* query) {
 }
 
 /*
- * execute_batch rearranges the queries into sub batches
- * currently spins up threads for each vector iteration
- * may want to look into performance of this versus using a thread pool which
- * would be a lot more effort to sync on each vector completion.
+ * Arguments shared by the morsels of an interval indexed shared scan.
+ * interval_counts holds one row per morsel of the number of rows falling in
+ * each elementary interval, which is turned into a prefix sum so a query's
+ * count in a morsel is the difference at the ends of its interval range.
+ * cursors holds one row per morsel of where the next position of each query
+ * goes.
+ */
+typedef struct IntervalScanArgs {
+  const int* data;
+  const IntervalIndex* index;
+  size_t* interval_counts;
+  size_t* cursors;
+  Result** results;
+} IntervalScanArgs;
+
+static void interval_count_morsel(void* arg, size_t morsel, size_t start,
+                                  size_t end) {
+  IntervalScanArgs* args = (IntervalScanArgs*)arg;
+  size_t num_intervals = interval_index_num_intervals(args->index);
+  size_t* counts = &args->interval_counts[morsel * (num_intervals + 1)];
+  for (size_t i = start; i < end; i++) {
+    counts[interval_index_find(args->index, args->data[i]) + 1] += 1;
+  }
+  for (size_t e = 0; e < num_intervals; e++) {
+    counts[e + 1] += counts[e];
+  }
+}
+
+static void interval_write_morsel(void* arg, size_t morsel, size_t start,
+                                  size_t end) {
+  IntervalScanArgs* args = (IntervalScanArgs*)arg;
+  const IntervalIndex* index = args->index;
+  size_t* cursors = &args->cursors[morsel * index->num_queries];
+  for (size_t i = start; i < end; i++) {
+    size_t e = interval_index_find(index, args->data[i]);
+    for (size_t k = index->query_offsets[e]; k < index->query_offsets[e + 1];
+         k++) {
+      uint32_t q = index->queries[k];
+      ((size_t*)args->results[q]->payload)[cursors[q]++] = i;
+    }
+  }
+}
+
+/*
+ * Shared scan for large batches of selects on one column. Rather than checking
+ * every row against every predicate, each row finds its elementary interval
+ * in an IntervalIndex and is appended to just the queries covering it. A first
+ * pass counts rows per interval for every morsel, which gives exact result
+ * sizes and the offset of each morsel in each result, and the second pass
+ * writes positions so results stay sorted.
+ */
+static bool execute_interval_scan(DbOperator** selects, size_t num_queries,
+                                  Result** results) {
+  Column* column =
+      selects[0]->operator_fields.select_operator.src->column_pointer.column;
+  const size_t num_rows = *column->num_rows;
+  int* lows = malloc(sizeof(int) * num_queries);
+  int* highs = malloc(sizeof(int) * num_queries);
+  for (size_t q = 0; q < num_queries; q++) {
+    lows[q] = selects[q]->operator_fields.select_operator.minimum;
+    highs[q] = selects[q]->operator_fields.select_operator.maximum;
+  }
+  IntervalIndex* index = interval_index_create(lows, highs, num_queries);
+  free(lows);
+  free(highs);
+  if (index == NULL) {
+    return false;
+  }
+
+  const size_t num_morsels = morsel_num(num_rows);
+  const size_t num_intervals = interval_index_num_intervals(index);
+  IntervalScanArgs args = {
+      .data = column->data,
+      .index = index,
+      .interval_counts =
+          calloc(num_morsels * (num_intervals + 1) + 1, sizeof(size_t)),
+      .cursors = malloc(sizeof(size_t) * (num_morsels * num_queries + 1)),
+      .results = results};
+  morsel_run(num_rows, &interval_count_morsel, &args);
+
+  for (size_t q = 0; q < num_queries; q++) {
+    size_t total = 0;
+    for (size_t m = 0; m < num_morsels; m++) {
+      size_t* counts = &args.interval_counts[m * (num_intervals + 1)];
+      args.cursors[m * num_queries + q] = total;
+      total +=
+          counts[index->end_interval[q]] - counts[index->first_interval[q]];
+    }
+    Result* result = malloc(sizeof(Result));
+    result->num_tuples = total;
+    result->num_update_tuples = 0;
+    result->data_type = POSITIONLIST;
+    result->payload = malloc(sizeof(size_t) * total);
+    results[q] = result;
+  }
+  morsel_run(num_rows, &interval_write_morsel, &args);
+
+  free(args.interval_counts);
+  free(args.cursors);
+  interval_index_free(index);
+  return true;
+}
+
+/*
+ * Runs selects on the same base column as one shared scan, results[i] is set
+ * to the positions of selects[i] in the base data.
+ */
+static bool execute_shared_scan(DbOperator** selects, size_t num_selects,
+                                Result** results) {
+  // large batches index the predicates instead of checking each of them
+  if (num_selects >= SS_INTERVAL_QUERIES) {
+    return execute_interval_scan(selects, num_selects, results);
+  }
+  // num_sub_batches is the total number of sub batches
+  size_t num_sub_batches = num_selects / QUERIES_PER_THREAD;
+  if (num_sub_batches == 0 || num_selects % QUERIES_PER_THREAD != 0) {
+    num_sub_batches += 1;
+  }
+
+  // array of args to be passed to each thread call.
+  SharedScanArgs ss_args[num_sub_batches];
+  Column* column =
+      selects[0]->operator_fields.select_operator.src->column_pointer.column;
+  const size_t num_rows = *column->num_rows;
+
+  // j indexes sub batches, i indexes into queries per thread with k offset.
+  size_t k = 0;
+  for (size_t j = 0; j < num_sub_batches; j++) {
+    ss_args[j].num_queries = 0;
+    for (size_t i = 0; i < QUERIES_PER_THREAD; i++) {
+      if (k + i >= num_selects) {
+        break;
+      }
+      ss_args[j].comps[i].p_low =
+          selects[k + i]->operator_fields.select_operator.minimum;
+      ss_args[j].comps[i].p_high =
+          selects[k + i]->operator_fields.select_operator.maximum;
+      ss_args[j].data_type = INT;
+
+      Result* result = malloc(sizeof(Result));
+      result->num_tuples = 0;
+      result->num_update_tuples = 0;
+      result->data_type = POSITIONLIST;
+      result->payload = malloc(sizeof(size_t) * num_rows);
+      results[k + i] = result;
+      ss_args[j].results[i] = result;
+      ss_args[j].num_queries += 1;
+    }
+    k += QUERIES_PER_THREAD;
+  }
+
+  size_t num_vectors = num_rows / SS_VECTOR_SIZE;
+  if (num_vectors == 0 || num_rows % SS_VECTOR_SIZE != 0) {
+    num_vectors += 1;
+  }
+
+  // still only supporting int data, to support other types we would check the
+  // passed datatype.
+  int* data = column->data;
+  ZoneMap* zonemap = column->zonemap;
+  if (zonemap != NULL && zonemap->num_blocks != zonemap_num_blocks(num_rows)) {
+    zonemap = NULL;
+  }
+
+  // every sub batch of a vector is a task on the pool, the vector is finished
+  // before moving on so the results are appended in position order.
+  TaskGroup group = {0};
+  for (size_t j = 0; j < num_vectors; j++) {
+    size_t vector_index = j * SS_VECTOR_SIZE;
+    int* vector = &data[vector_index];
+    // if remaining # rows < vector size then use remaining number of rows.
+    size_t vector_length = num_rows - vector_index < SS_VECTOR_SIZE
+                               ? num_rows - vector_index
+                               : SS_VECTOR_SIZE;
+    for (size_t b = 0; b < num_sub_batches; b++) {
+      ss_args[b].data = vector;
+      ss_args[b].vect_size = vector_length;
+      ss_args[b].position_offset = vector_index;
+      ss_args[b].zonemap = zonemap;
+      threadpool_submit(g_pool, &group, &execute_shared_select, &ss_args[b]);
+    }
+    threadpool_wait(g_pool, &group);
+  }
+  return true;
+}
+
+/*
+ * Selects (BATCH_SCAN) and aggregates (BATCH_AGGREGATE) on the same base
+ * column share a single pass over it. BATCH_SERIAL operators run one after
+ * another through execute_DbOperator, fetches from the same column are
+ * grouped this way so the column stays in cache.
+ */
+typedef enum BatchTaskType {
+  BATCH_SCAN,
+  BATCH_AGGREGATE,
+  BATCH_SERIAL
+} BatchTaskType;
+
+typedef struct BatchTask {
+  BatchTaskType type;
+  Column* column;
+  DbOperator** ops;
+  size_t num_ops;
+  ClientContext* client_context;
+  char* error;
+} BatchTask;
+
+/*
+ * Frees an operator of a batch that is not run through execute_DbOperator,
+ * along with what parse_command allocated for it.
+ */
+static void free_batch_operator(DbOperator* op) {
+  if (op->type == SELECT) {
+    free(op->operator_fields.select_operator.src);
+  }
+  free(op);
+}
+
+static void* execute_batch_task(void* task_arg) {
+  BatchTask* task = (BatchTask*)task_arg;
+  switch (task->type) {
+    case BATCH_SCAN: {
+      Result** results = malloc(sizeof(Result*) * task->num_ops);
+      if (!execute_shared_scan(task->ops, task->num_ops, results)) {
+        task->error = "Failed to run shared scan for batch";
+        for (size_t i = 0; i < task->num_ops; i++) {
+          free_batch_operator(task->ops[i]);
+        }
+        free(results);
+        break;
+      }
+      for (size_t i = 0; i < task->num_ops; i++) {
+        SelectOperator* select = &task->ops[i]->operator_fields.select_operator;
+        adjust_result_for_updates(results[i], task->column, select->minimum,
+                                  select->maximum);
+        insert_result_context(results[i], select->handle,
+                              task->client_context);
+        free_batch_operator(task->ops[i]);
+      }
+      free(results);
+      break;
+    }
+    case BATCH_AGGREGATE: {
+      ScanAggregate agg;
+      stats_aggregate(task->column, &agg);
+      for (size_t i = 0; i < task->num_ops; i++) {
+        insert_result_context(
+            aggregate_result(task->ops[i]->type, agg.sum, agg.min, agg.max,
+                             agg.count),
+            task->ops[i]->operator_fields.agg_operator.handle,
+            task->client_context);
+        free_batch_operator(task->ops[i]);
+      }
+      break;
+    }
+    case BATCH_SERIAL:
+      for (size_t i = 0; i < task->num_ops; i++) {
+        char* res_string =
+            execute_DbOperator(task->ops[i], task->client_context);
+        if (is_error_string(res_string) && task->error == NULL) {
+          task->error = res_string;
+        }
+      }
+      break;
+  }
+  return NULL;
+}
+
+/*
+ * Which task an operator of a batch level goes in, and the column tasks of
+ * that type are shared on (NULL if it runs on its own).
+ */
+static BatchTaskType batch_task_type(DbOperator* op, Column** column) {
+  *column = NULL;
+  switch (op->type) {
+    case SELECT:
+      if (op->operator_fields.select_operator.src->column_type == COLUMN &&
+          !op->operator_fields.select_operator.use_index_vector) {
+        *column =
+            op->operator_fields.select_operator.src->column_pointer.column;
+        return BATCH_SCAN;
+      }
+      return BATCH_SERIAL;
+    case AVG:
+    case SUM:
+    case MIN:
+    case MAX:
+      if (op->operator_fields.agg_operator.column.column_type == COLUMN) {
+        *column = op->operator_fields.agg_operator.column.column_pointer.column;
+        return BATCH_AGGREGATE;
+      }
+      return BATCH_SERIAL;
+    case FETCH:
+      *column = op->operator_fields.fetch_operator.column;
+      return BATCH_SERIAL;
+    default:
+      return BATCH_SERIAL;
+  }
+}
+
+static bool batchable(OperatorType type) {
+  switch (type) {
+    case SELECT:
+    case FETCH:
+    case AVG:
+    case SUM:
+    case MIN:
+    case MAX:
+    case ADD:
+    case SUB:
+    case AND:
+    case OR:
+    case NOT:
+    case SELECT_AGG:
+    case COUNT:
+    case COUNT_DISTINCT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+ * Runs ops, which do not depend on each other, as tasks grouped by column.
+ */
+static char* execute_batch_level(DbOperator** ops, size_t num_ops,
+                                 ClientContext* client_context) {
+  BatchTask* tasks = calloc(num_ops, sizeof(BatchTask));
+  size_t* op_task = malloc(sizeof(size_t) * num_ops);
+  size_t num_tasks = 0;
+  for (size_t i = 0; i < num_ops; i++) {
+    // selects on index vectors convert their positions in place, do that
+    // before anything else in the level can read them
+    if (ops[i]->type == SELECT &&
+        ops[i]->operator_fields.select_operator.use_index_vector) {
+      result_to_positionlist(ops[i]->operator_fields.select_operator.indices);
+    }
+    Column* column;
+    BatchTaskType type = batch_task_type(ops[i], &column);
+    size_t t = num_tasks;
+    if (column != NULL) {
+      for (t = 0; t < num_tasks; t++) {
+        if (tasks[t].type == type && tasks[t].column == column) {
+          break;
+        }
+      }
+    }
+    if (t == num_tasks) {
+      tasks[t].type = type;
+      tasks[t].column = column;
+      tasks[t].client_context = client_context;
+      num_tasks += 1;
+    }
+    tasks[t].num_ops += 1;
+    op_task[i] = t;
+  }
+
+  // operators of a task are consecutive in grouped, in batch order
+  DbOperator** grouped = malloc(sizeof(DbOperator*) * num_ops);
+  size_t offset = 0;
+  for (size_t t = 0; t < num_tasks; t++) {
+    tasks[t].ops = &grouped[offset];
+    offset += tasks[t].num_ops;
+    tasks[t].num_ops = 0;
+  }
+  for (size_t i = 0; i < num_ops; i++) {
+    BatchTask* task = &tasks[op_task[i]];
+    task->ops[task->num_ops++] = ops[i];
+  }
+
+  TaskGroup group = {0};
+  for (size_t t = 0; t < num_tasks; t++) {
+    threadpool_submit(g_pool, &group, &execute_batch_task, &tasks[t]);
+  }
+  threadpool_wait(g_pool, &group);
+
+  char* res_string = " ";
+  for (size_t t = 0; t < num_tasks; t++) {
+    if (tasks[t].error != NULL) {
+      res_string = tasks[t].error;
+      break;
+    }
+  }
+  free(grouped);
+  free(op_task);
+  free(tasks);
+  return res_string;
+}
+
+/*
+ * Splits a comma separated list in place into at most max_tokens trimmed
+ * tokens, returns the number found.
+ */
+static size_t split_tokens(char* list, char** tokens, size_t max_tokens) {
+  size_t num_tokens = 0;
+  char* token;
+  while (num_tokens < max_tokens && (token = strsep(&list, ",")) != NULL) {
+    tokens[num_tokens++] = trim_whitespace(token);
+  }
+  return num_tokens;
+}
+
+// no batchable operator defines more than 2 handles or takes more than 5
+// arguments
+#define BATCH_MAX_OUTPUTS 2
+#define BATCH_MAX_ARGS 5
+
+static bool batch_handle_in(char** handles, size_t num_handles,
+                            const char* handle) {
+  for (size_t h = 0; h < num_handles; h++) {
+    if (strcmp(handles[h], handle) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Levels of the commands of a batch. A command is one level above the
+ * highest command defining a handle it uses, so the commands of a level only
+ * depend on lower levels and can run at the same time. A command defining a
+ * handle is also one level above every earlier command using or defining that
+ * handle, so a handle is never replaced while another command of its level
+ * reads it, or defined twice in one level.
+ * Returns the number of levels.
+ */
+static size_t batch_levels(DbOperator* batch, size_t num_commands,
+                           size_t* levels) {
+  char** texts = malloc(sizeof(char*) * num_commands);
+  char* (*outputs)[BATCH_MAX_OUTPUTS] =
+      malloc(sizeof(*outputs) * num_commands);
+  size_t* num_outputs = calloc(num_commands, sizeof(size_t));
+  char* (*args)[BATCH_MAX_ARGS] = malloc(sizeof(*args) * num_commands);
+  size_t* num_args = calloc(num_commands, sizeof(size_t));
+  size_t num_levels = 0;
+  for (size_t i = 0; i < num_commands; i++) {
+    char* command = batch[i].operator_fields.batched_operator.command;
+    texts[i] = malloc(strlen(command) + 1);
+    strcpy(texts[i], command);
+    char* open_paren = strchr(texts[i], '(');
+    char* close_paren = strrchr(texts[i], ')');
+    char* equals = strchr(texts[i], '=');
+    if (equals != NULL && (open_paren == NULL || equals < open_paren)) {
+      *equals = '\0';
+      num_outputs[i] = split_tokens(texts[i], outputs[i], BATCH_MAX_OUTPUTS);
+    }
+    if (open_paren != NULL && close_paren != NULL && open_paren < close_paren) {
+      *close_paren = '\0';
+      num_args[i] = split_tokens(open_paren + 1, args[i], BATCH_MAX_ARGS);
+    }
+
+    levels[i] = 0;
+    for (size_t a = 0; a < num_args[i]; a++) {
+      // the latest earlier command defining the handle is the one used
+      for (size_t j = i; j-- > 0;) {
+        if (batch_handle_in(outputs[j], num_outputs[j], args[i][a])) {
+          levels[i] = levels[j] + 1 > levels[i] ? levels[j] + 1 : levels[i];
+          break;
+        }
+      }
+    }
+    for (size_t o = 0; o < num_outputs[i]; o++) {
+      for (size_t j = 0; j < i; j++) {
+        if (batch_handle_in(outputs[j], num_outputs[j], outputs[i][o]) ||
+            batch_handle_in(args[j], num_args[j], outputs[i][o])) {
+          levels[i] = levels[j] + 1 > levels[i] ? levels[j] + 1 : levels[i];
+        }
+      }
+    }
+    num_levels = levels[i] + 1 > num_levels ? levels[i] + 1 : num_levels;
+  }
+  for (size_t i = 0; i < num_commands; i++) {
+    free(texts[i]);
+  }
+  free(texts);
+  free(outputs);
+  free(num_outputs);
+  free(args);
+  free(num_args);
+  return num_levels;
+}
+
+/*
+ * Executes the commands received since batch_queries(). Commands are parsed
+ * a level at a time, once the handles they use exist, and each level runs in
+ * parallel on the thread pool: selects on the same column share one scan,
+ * aggregates on the same base column share one pass, fetches from the same
+ * column run together, and different columns run at the same time.
+ */
+char* execute_batch(ClientContext* client_context) {
+  DbOperator* batch = client_context->batch_operators;
+  const size_t num_commands = client_context->batch_operators_in_use;
+  client_context->batch_operators = NULL;
+  client_context->batch_operators_in_use = 0;
+  client_context->batch_operator_slots = 0;
+  client_context->batching_active = false;
+
+  size_t* levels = malloc(sizeof(size_t) * (num_commands + 1));
+  size_t num_levels = batch_levels(batch, num_commands, levels);
+  DbOperator** ops = malloc(sizeof(DbOperator*) * (num_commands + 1));
+  // parse_command works in place and fetches keep pointers into the text, so
+  // each level parses copies which live until the level is done
+  char** texts = malloc(sizeof(char*) * (num_commands + 1));
+  char* res_string = " ";
+  for (size_t level = 0; level < num_levels && !is_error_string(res_string);
+       level++) {
+    size_t num_ops = 0;
+    for (size_t i = 0; i < num_commands; i++) {
+      if (levels[i] != level) {
+        continue;
+      }
+      char* command = batch[i].operator_fields.batched_operator.command;
+      texts[num_ops] = malloc(strlen(command) + 1);
+      strcpy(texts[num_ops], command);
+      message parse_message;
+      DbOperator* op = parse_command(texts[num_ops], &parse_message,
+                                     batch[i].client_fd, client_context);
+      num_ops += 1;
+      if (op == NULL || !batchable(op->type)) {
+        log_err("%s:%d Cannot batch command %s\n", __FILE__, __LINE__,
+                command);
+        free(op);
+        res_string = "Batched operators only support select, fetch, "
+                     "aggregates, add, sub, and, or and not";
+        break;
+      }
+      ops[num_ops - 1] = op;
+    }
+    if (!is_error_string(res_string)) {
+      res_string = execute_batch_level(ops, num_ops, client_context);
+    } else {
+      for (size_t o = 0; o + 1 < num_ops; o++) {
+        free_batch_operator(ops[o]);
+      }
+    }
+    for (size_t o = 0; o < num_ops; o++) {
+      free(texts[o]);
+    }
+  }
+
+  for (size_t i = 0; i < num_commands; i++) {
+    free(batch[i].operator_fields.batched_operator.command);
+  }
+  free(batch);
+  free(levels);
+  free(ops);
+  free(texts);
+  return res_string;
+}
+
+// ****************************************************************************
+// Joins
+// ****************************************************************************
+
+static HashTable* build_join_table(int* values, size_t* positions,
+                                   size_t length) {
+  HashTable* ht = ht_allocate(length);
+  bulk_ht_load(ht, values, positions, length);
+  return ht;
+}
+
+/*
+ * Joins a pair of partitions, or a chunk of one with the shared table of the
+ * other side. Unless args holds a shared table, the table is built on the
+ * smaller side and probed with the larger side.
+ */
+void* hash_join_thread(void* hj_args) {
+  HashJoinThreadArgs* args = (HashJoinThreadArgs*)hj_args;
+  bool build_left = args->table != NULL ? args->table_left
+                                        : args->left_len <= args->right_len;
+  HashTable* own_ht = NULL;
+  if (args->table == NULL) {
+    own_ht = build_left ? build_join_table(args->left_vals, args->left_pos,
+                                           args->left_len)
+                        : build_join_table(args->right_vals, args->right_pos,
+                                           args->right_len);
+  }
+  const HashTable* ht = own_ht != NULL ? own_ht : args->table;
+
+  // probe_many puts the table's positions on the left of the matches
+  if (build_left) {
+    probe_many(ht, args->right_vals, args->right_pos, args->right_len,
+               &args->matches, NULL);
+  } else {
+    probe_many(ht, args->left_vals, args->left_pos, args->left_len,
+               &args->matches, NULL);
+    args->matches.swapped = true;
+  }
+  if (own_ht != NULL) {
+    ht_deallocate(own_ht);
+  }
+  return NULL;
+}
+
+/*
+ * Semi, anti and left outer join of a pair of partitions, or of a chunk of
+ * the left one with the shared table of the right one. The table is always
+ * built on the right side, so the output can be decided left row by
+ * left row: semi and anti joins keep the left positions whose key is or is
+ * not in the table, and left outer joins add every left row without a match
+ * to the inner join's matches, paired with NULL_POSITION.
+ */
+void* left_probe_join_thread(void* lp_args) {
+  HashJoinThreadArgs* args = (HashJoinThreadArgs*)lp_args;
+  HashTable* own_ht = NULL;
+  if (args->table == NULL) {
+    own_ht = build_join_table(args->right_vals, args->right_pos,
+                              args->right_len);
+  }
+  const HashTable* ht = own_ht != NULL ? own_ht : args->table;
+  bool* found = malloc((args->left_len + 1) * sizeof(bool));
+  if (args->join_type == LEFT_OUTER) {
+    // the table's positions go on the left of the matches
+    probe_many(ht, args->left_vals, args->left_pos, args->left_len,
+               &args->matches, found);
+    args->matches.swapped = true;
+    for (size_t i = 0; i < args->left_len; i++) {
+      if (!found[i]) {
+        join_matches_reserve(&args->matches, 1);
+        join_matches_add(&args->matches, NULL_POSITION, args->left_pos[i]);
+      }
+    }
+  } else {
+    probe_exists(ht, args->left_vals, args->left_len, found);
+    args->matches.left_only = true;
+    bool keep = args->join_type == SEMI;
+    for (size_t i = 0; i < args->left_len; i++) {
+      if (found[i] == keep) {
+        join_matches_reserve(&args->matches, 1);
+        join_matches_add_left(&args->matches, args->left_pos[i]);
+      }
+    }
+  }
+  free(found);
+  if (own_ht != NULL) {
+    ht_deallocate(own_ht);
+  }
+  return NULL;
+}
+
+/*
+ * Copies the chunks of one task's matches to its range of the join result,
+ * freeing each chunk once it is copied.
+ */
+typedef struct JoinGatherTask {
+  JoinMatches* matches;
+  size_t* left_out;
+  size_t* right_out;
+} JoinGatherTask;
+
+static void* join_gather_task(void* gather_arg) {
+  JoinGatherTask* task = (JoinGatherTask*)gather_arg;
+  size_t* left_out = task->left_out;
+  size_t* right_out = task->right_out;
+  if (task->matches->swapped) {
+    left_out = task->right_out;
+    right_out = task->left_out;
+  }
+  size_t offset = 0;
+  JoinChunk* chunk = task->matches->head;
+  while (chunk != NULL) {
+    JoinChunk* next = chunk->next;
+    memcpy(&left_out[offset], chunk->left_positions,
+           chunk->length * sizeof(size_t));
+    if (right_out != NULL) {
+      memcpy(&right_out[offset], chunk->right_positions,
+             chunk->length * sizeof(size_t));
+    }
+    offset += chunk->length;
+    free(chunk->left_positions);
+    free(chunk->right_positions);
+    free(chunk);
+    chunk = next;
+  }
+  return NULL;
+}
+
+/*
+ * Gathers the matches of every task, in task order, into left and right
+ * result position lists of exactly the right size and frees the tasks. The
+ * offset of every task's matches is the prefix sum of the counts before it,
+ * so each task's chunks are copied straight to their place, all tasks at
+ * once on the pool, and every pair is written to the result once. Semi and
+ * anti joins only have a left result.
+ */
+static char* insert_join_results(HashJoinThreadArgs* tasks, size_t num_tasks,
+                                 DbOperator* query,
+                                 ClientContext* client_context) {
+  size_t join_len = 0;
+  for (size_t i = 0; i < num_tasks; i++) {
+    join_len += tasks[i].matches.length;
+  }
+
+  JoinType join_type = query->operator_fields.join_operator.join_type;
+  bool left_only = join_type == SEMI || join_type == ANTI;
+  Result* left_res = malloc(sizeof(Result));
+  Result* right_res = malloc(sizeof(Result));
+  left_res->data_type = POSITIONLIST;
+  right_res->data_type = POSITIONLIST;
+  left_res->payload = malloc(sizeof(size_t) * join_len);
+  right_res->payload = left_only ? NULL : malloc(sizeof(size_t) * join_len);
+  left_res->num_tuples = join_len;
+  right_res->num_tuples = join_len;
+  left_res->num_update_tuples = 0;
+  right_res->num_update_tuples = 0;
+
+  JoinGatherTask* gather_tasks =
+      malloc((num_tasks + 1) * sizeof(JoinGatherTask));
+  TaskGroup group = {0};
+  size_t offset = 0;
+  for (size_t i = 0; i < num_tasks; i++) {
+    gather_tasks[i] = (JoinGatherTask){
+        .matches = &tasks[i].matches,
+        .left_out = &((size_t*)left_res->payload)[offset],
+        .right_out = left_only ? NULL
+                               : &((size_t*)right_res->payload)[offset]};
+    offset += tasks[i].matches.length;
+    if (tasks[i].matches.head != NULL) {
+      threadpool_submit(g_pool, &group, &join_gather_task, &gather_tasks[i]);
+    }
+  }
+  threadpool_wait(g_pool, &group);
+  free(gather_tasks);
+  free(tasks);
+
+  insert_result_context(left_res,
+                        query->operator_fields.join_operator.handle_left,
+                        client_context);
+  if (left_only) {
+    free(right_res);
+    return "";
+  }
+  insert_result_context(right_res,
+                        query->operator_fields.join_operator.handle_right,
+                        client_context);
+  return "";
+}
+
+/*
+ * Bloom filter of the build side of a hash join, or NULL if the probe side is
+ * too small to be worth filtering or too much of a sample of it passes.
  */
-
-char* execute_batch(ClientContext* client_context) {
-  // num_sub_batches is the total number of sub batches
-  // we may not run them all at the same time due to number of available logical
-  // threads/tlb size
-  size_t num_sub_batches =
-      client_context->batch_operators_in_use / QUERIES_PER_THREAD;
-  // ensure we have the right number of threads.
-  if (num_sub_batches == 0 ||
-      client_context->batch_operators_in_use % QUERIES_PER_THREAD != 0) {
-    num_sub_batches += 1;
+static BloomFilter* join_filter(const int* build_data, size_t build_length,
+                                const int* probe_data, size_t probe_length) {
+  if (probe_length <= MORSEL_SIZE || build_length >= probe_length) {
+    return NULL;
   }
-
-  // array of args to be passed to each thread call.
-  SharedScanArgs ss_args[num_sub_batches];
-  const size_t num_rows = *(client_context->batch_operators[0]
-                                .operator_fields.select_operator.src
-                                ->column_pointer.column->num_rows);
-
-  // j indexes sub batches, i indexes into queries per thread with k offset.
-  size_t k = 0;
-  for (size_t j = 0; j < num_sub_batches; j++) {
-    ss_args[j].num_queries = 0;
-    for (size_t i = 0; i < QUERIES_PER_THREAD; i++) {
-      if (k + i >= client_context->batch_operators_in_use) {
-        break;
-      }
-      if (client_context->batch_operators[i].type != SELECT) {
-        // printf("enum operator type %d\n",
-        // client_context->batch_operators[i].type);
-        return "Batched operators currently only supports selects";
-      }
-
-      ss_args[j].comps[i].p_low = client_context->batch_operators[k + i]
-                                      .operator_fields.select_operator.minimum;
-      ss_args[j].comps[i].p_high = client_context->batch_operators[k + i]
-                                       .operator_fields.select_operator.maximum;
-      // printf("low: %d, high %d \n", ss_args[j].comps[i].p_low,
-      // ss_args[j].comps[i].p_high );
-      ss_args[j].data_type = INT;
-
-      Result* result = malloc(sizeof(Result));
-      result->num_tuples = 0;
-      result->num_update_tuples = 0;
-      result->data_type = POSITIONLIST;
-      result->payload = malloc(sizeof(int) * num_rows);
-      // printf("result handles %s\n",
-      // client_context->batch_operators[k+i].operator_fields.select_operator.handle);
-      insert_result_context(result,
-                            client_context->batch_operators[k + i]
-                                .operator_fields.select_operator.handle,
-                            client_context);
-      ss_args[j].results[i] = result;
-      ss_args[j].num_queries += 1;
-    }
-    k += QUERIES_PER_THREAD;
+  BloomFilter* filter = bloom_create(build_data, build_length);
+  if (bloom_pass_rate(filter, probe_data, probe_length) >
+      BLOOM_MAX_PASS_RATE) {
+    bloom_free(filter);
+    return NULL;
   }
+  return filter;
+}
 
-  size_t num_batches = num_sub_batches / QUERIES_PER_THREAD;
-  if (num_batches == 0 || num_batches % QUERIES_PER_THREAD != 0) {
-    num_batches += 1;
+/*
+ * First index in [lo, hi) of sorted values whose value is greater than key,
+ * or not less than key if or_equal is set.
+ */
+static size_t sorted_bound(const int* values, size_t lo, size_t hi, int key,
+                           bool or_equal) {
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (values[mid] < key || (!or_equal && values[mid] == key)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
+  return lo;
+}
 
-  size_t num_vectors = num_rows / SS_VECTOR_SIZE;
-  if (num_vectors == 0 || num_rows % SS_VECTOR_SIZE != 0) {
-    num_vectors += 1;
+/*
+ * Swaps the left and right result positions of every task, for joins which
+ * put the side they iterate over on the left whichever side it came from.
+ */
+static void swap_join_sides(HashJoinThreadArgs* tasks, size_t num_tasks) {
+  for (size_t m = 0; m < num_tasks; m++) {
+    tasks[m].matches.swapped = !tasks[m].matches.swapped;
   }
+}
 
-  pthread_t* threads = malloc(NUM_THREADS * sizeof(pthread_t));
+/*
+ * Merge joins a chunk of the sorted left side with the part of the sorted
+ * right side holding the same values. Every run of equal values is joined
+ * with the matching run on the right, left row by left row.
+ */
+void* merge_join_thread(void* mj_args) {
+  HashJoinThreadArgs* args = (HashJoinThreadArgs*)mj_args;
 
-  // still only supporting int data, to support other types we would check the
-  // passed datatype.
-  int* data =
-      client_context->batch_operators[0]
-          .operator_fields.select_operator.src->column_pointer.column->data;
-
-  // printf(" num sub batches %d\n", num_sub_batches );
-  size_t completed_sub_batches = 0;
-  for (size_t i = 0; i < num_batches; i++) {
-    size_t v_index = 0;
-    for (size_t j = 0; j < num_vectors; j++) {
-      size_t vector_index = j * SS_VECTOR_SIZE;
-
-      int* vector = &data[vector_index];
-      // printf("start of vector %d with index %ld \n", vector[0],
-      // vector_index); if remaining # rows < vector size then use vector size,
-      // else use remaining number of rows.
-      size_t vector_length = num_rows - vector_index < SS_VECTOR_SIZE
-                                 ? num_rows - vector_index
-                                 : SS_VECTOR_SIZE;
-      // printf(" v index  %d , v length%d , data index %d\n", v_index,
-      // vector_length, vector_index); printf(" num rows %d\n", num_rows );
-      v_index += vector_length;
-      for (size_t k = 0; k < NUM_THREADS; k++) {
-        // printf("i:%d, num completed_sub_batches %d, k %d \n",i,
-        // completed_sub_batches, k );
-        if (k + completed_sub_batches >= num_sub_batches) {
-          break;
-        }
-        // in future may want to play around with pinning threads to specific
-        // CPU cores
-        ss_args[completed_sub_batches + k].data = vector;
-        ss_args[completed_sub_batches + k].vect_size = vector_length;
-        ss_args[completed_sub_batches + k].position_offset = vector_index;
-        pthread_create(&threads[k], NULL, &execute_shared_select,
-                       (void*)(&ss_args[completed_sub_batches + k]));
+  size_t i = 0;
+  size_t j = 0;
+  while (i < args->left_len && j < args->right_len) {
+    if (args->left_vals[i] < args->right_vals[j]) {
+      i++;
+    } else if (args->left_vals[i] > args->right_vals[j]) {
+      j++;
+    } else {
+      int value = args->left_vals[i];
+      size_t i_end = i + 1;
+      while (i_end < args->left_len && args->left_vals[i_end] == value) {
+        i_end++;
       }
-
-      for (size_t k = 0; k < NUM_THREADS; k++) {
-        if (k + completed_sub_batches >= num_sub_batches) {
-          break;
-        }
-        // block on waiting for threads to finish
-        if (pthread_join(threads[k], NULL) != 0) {
-          log_err("%s:%d Failed to join pthread", __FILE__, __LINE__);
+      size_t j_end = j + 1;
+      while (j_end < args->right_len && args->right_vals[j_end] == value) {
+        j_end++;
+      }
+      for (size_t l = i; l < i_end; l++) {
+        join_matches_reserve(&args->matches, j_end - j);
+        for (size_t r = j; r < j_end; r++) {
+          join_matches_add(&args->matches, args->left_pos[l],
+                           args->right_pos[r]);
         }
-        // printf("Joined thread #%d\n", k);
       }
+      i = i_end;
+      j = j_end;
     }
-    completed_sub_batches += NUM_THREADS;
   }
-  // printf(" returning from ss select \n");
-  return " ";
+  return NULL;
 }
 
-// ****************************************************************************
-// Joins
-// ****************************************************************************
+/*
+ * Rows of the larger side of a hash join partition given to each task
+ * joining it. A partition whose larger side is more than SKEW_HEAVY_FACTOR
+ * times the average of that side is split into chunks of that size, each
+ * joined with the whole smaller side by a task of its own, so that it does
+ * not hold up the whole join.
+ */
+static size_t partition_chunk_rows(size_t smaller_len, size_t larger_total,
+                                   size_t num_parts) {
+  size_t chunk_rows = SKEW_HEAVY_FACTOR * (larger_total / num_parts + 1);
+  chunk_rows = chunk_rows > smaller_len ? chunk_rows : smaller_len;
+  return chunk_rows > JOIN_PARTITION_ROWS ? chunk_rows : JOIN_PARTITION_ROWS;
+}
 
 /*
- * first implementation will be single threaded, but this is where I would
- * vectorize Split up partitions across cores a vector at a time so that the
- * vector is in l3 then merge together in this thread.
- */
-void* radix_parition_thread(void* radix_args) {
-  PartitionThreadArgs* args = (PartitionThreadArgs*)radix_args;
-
-  int bit_mask = args->num_parts - 1;
-  for (size_t i = 0; i < args->data_length; i++) {
-    // printf("part %d, pos%ld, val %d \n",args->vals[i] & bit_mask,
-    // args->positions[i],  args->vals[i]);
-    args->pos_partitions[args->vals[i] & bit_mask]
-                        [args->partition_lengths[args->vals[i] & bit_mask]] =
-        args->positions[i];
-    args->val_partitions[args->vals[i] & bit_mask]
-                        [args->partition_lengths[args->vals[i] & bit_mask]] =
-        args->vals[i];
-    args->partition_lengths[args->vals[i] & bit_mask] += 1;
+ * The table of the side of a partition which is not split, loaded once by a
+ * task of its own, which then submits the partition's chunk tasks to group.
+ * They all probe the table, which is freed once the join is done.
+ */
+typedef struct JoinTableBuild {
+  HashTable* table;
+  int* values;
+  size_t* positions;
+  size_t length;
+  HashJoinThreadArgs* tasks;
+  size_t num_tasks;
+  TaskFunc probe_func;
+  TaskGroup* group;
+} JoinTableBuild;
+
+static void* join_table_build_thread(void* build_arg) {
+  JoinTableBuild* build = (JoinTableBuild*)build_arg;
+  bulk_ht_load(build->table, build->values, build->positions, build->length);
+  for (size_t t = 0; t < build->num_tasks; t++) {
+    threadpool_submit(g_pool, build->group, build->probe_func,
+                      &build->tasks[t]);
   }
   return NULL;
 }
 
 /*
- * Starting with a single pass, paritions both columns at the same time
- * next stop would be to partition on two cores
- * could multi thread by partitioning a vector at a time and have different
- * cores responsible for different bits, also gets around the TLB limit since
- * each core has its own TLB. num_parts MUST be a power of 2
- */
-JoinPartitions* radix_parition(size_t num_parts, size_t* left_pos,
-                               size_t* right_pos, int* left_val, int* right_val,
-                               size_t left_len, size_t right_len) {
-  // prepare args for left thread and right thread
-  PartitionThreadArgs* left_args = calloc(1, sizeof(PartitionThreadArgs));
-  PartitionThreadArgs* right_args = calloc(1, sizeof(PartitionThreadArgs));
-
-  left_args->positions = left_pos;
-  left_args->vals = left_val;
-  left_args->data_length = left_len;
-  left_args->num_parts = num_parts;
-  left_args->partition_lengths = calloc(num_parts, sizeof(size_t));
-  left_args->pos_partitions = malloc(sizeof(size_t*) * num_parts);
-  left_args->val_partitions = malloc(sizeof(int*) * num_parts);
-
-  right_args->positions = right_pos;
-  right_args->vals = right_val;
-  right_args->data_length = right_len;
-  right_args->num_parts = num_parts;
-  right_args->partition_lengths = calloc(num_parts, sizeof(size_t));
-  right_args->pos_partitions = malloc(sizeof(size_t*) * num_parts);
-  right_args->val_partitions = malloc(sizeof(int*) * num_parts);
-
-  for (size_t i = 0; i < num_parts; i++) {
-    left_args->pos_partitions[i] = malloc(sizeof(size_t) * left_len);
-    left_args->val_partitions[i] = malloc(sizeof(int) * left_len);
-    right_args->pos_partitions[i] = malloc(sizeof(size_t) * right_len);
-    right_args->val_partitions[i] = malloc(sizeof(int) * right_len);
+ * Hash join tasks of partition p, one per chunk of its larger side, written
+ * to tasks unless it is NULL. Returns the number of tasks. Semi, anti and
+ * left outer joins build on the right side and decide each left row in a
+ * single task, so they always split the left side, and anti and left outer
+ * joins also join left rows with an empty right partition. When there is more
+ * than one chunk, the table of the other side is allocated in build and
+ * shared by the tasks, which only split the probes.
+ */
+static size_t partition_tasks(const RadixPartitions* left_parts,
+                              const RadixPartitions* right_parts, size_t p,
+                              JoinType join_type, HashJoinThreadArgs* tasks,
+                              JoinTableBuild* build) {
+  size_t left_start = left_parts->starts[p];
+  size_t right_start = right_parts->starts[p];
+  size_t left_len = left_parts->starts[p + 1] - left_start;
+  size_t right_len = right_parts->starts[p + 1] - right_start;
+  bool keeps_unmatched = join_type == ANTI || join_type == LEFT_OUTER;
+  if (left_len == 0 || (right_len == 0 && !keeps_unmatched)) {
+    return 0;
   }
-
-  pthread_t* threads = malloc(2 * sizeof(pthread_t));
-
-  pthread_create(&threads[0], NULL, &radix_parition_thread, (void*)(left_args));
-  pthread_create(&threads[1], NULL, &radix_parition_thread,
-                 (void*)(right_args));
-
-  if (pthread_join(threads[0], NULL) != 0) {
-    log_err("%s:%d Failed to join pthread", __FILE__, __LINE__);
+  bool left_larger = join_type != HASH || left_len >= right_len;
+  size_t larger_len = left_larger ? left_len : right_len;
+  size_t chunk_rows = partition_chunk_rows(
+      left_larger ? right_len : left_len,
+      left_larger ? left_parts->starts[left_parts->num_parts]
+                  : right_parts->starts[right_parts->num_parts],
+      left_parts->num_parts);
+  size_t num_chunks = (larger_len + chunk_rows - 1) / chunk_rows;
+  if (tasks == NULL) {
+    return num_chunks;
   }
-
-  if (pthread_join(threads[1], NULL) != 0) {
-    log_err("%s:%d Failed to join pthread", __FILE__, __LINE__);
+  HashTable* table = NULL;
+  if (num_chunks > 1) {
+    size_t table_start = left_larger ? right_start : left_start;
+    const RadixPartitions* table_parts =
+        left_larger ? right_parts : left_parts;
+    *build = (JoinTableBuild){
+        .values = &table_parts->values[table_start],
+        .positions = &table_parts->positions[table_start],
+        .length = left_larger ? right_len : left_len,
+        .tasks = tasks,
+        .num_tasks = num_chunks};
+    build->table = ht_allocate(build->length);
+    table = build->table;
   }
-
-  JoinPartitions* part_struct = malloc(sizeof(JoinPartitions));
-  part_struct->num_parts = num_parts;
-  part_struct->left_pos_partitions = left_args->pos_partitions;
-  part_struct->left_val_partitions = left_args->val_partitions;
-  part_struct->left_partition_lengths = left_args->partition_lengths;
-  part_struct->right_pos_partitions = right_args->pos_partitions;
-  part_struct->right_val_partitions = right_args->val_partitions;
-  part_struct->right_partition_lengths = right_args->partition_lengths;
-
-  return part_struct;
+  for (size_t c = 0; c < num_chunks; c++) {
+    size_t start = c * chunk_rows;
+    size_t len = larger_len - start < chunk_rows ? larger_len - start
+                                                 : chunk_rows;
+    HashJoinThreadArgs* task = &tasks[c];
+    task->join_type = join_type;
+    task->table = table;
+    task->table_left = !left_larger;
+    task->left_pos = &left_parts->positions[left_start];
+    task->left_vals = &left_parts->values[left_start];
+    task->left_len = left_len;
+    task->right_pos = &right_parts->positions[right_start];
+    task->right_vals = &right_parts->values[right_start];
+    task->right_len = right_len;
+    if (left_larger) {
+      task->left_pos += start;
+      task->left_vals += start;
+      task->left_len = len;
+    } else {
+      task->right_pos += start;
+      task->right_vals += start;
+      task->right_len = len;
+    }
+  }
+  return num_chunks;
 }
 
-// need to malloc space for join positions
-void* hash_join_thread(void* hj_args) {
-  HashJoinThreadArgs* args = (HashJoinThreadArgs*)hj_args;
-  HashTable* ht;
-
-  size_t alloc_size =
-      args->left_len > args->right_len ? args->left_len : args->right_len;
-
-  args->left_join_positions = malloc(alloc_size * sizeof(size_t));
-  args->right_join_positions = malloc(alloc_size * sizeof(size_t));
-
-  // printf("Hash join left len %ld right len %ld\n", args->left_len,
-  // args->right_len); raise(SIGINT); 12 is arbitrary ptr to ptr because I want
-  // to minimise memory allocs and the get function will realloc only if it need
-  // to, but I also don't want to loose track of the ret_pos pointer value
-  size_t* ret_pos = malloc(sizeof(size_t) * 12);
-  size_t** ret_pos_ptr = malloc(sizeof(size_t*));
-  *ret_pos_ptr = ret_pos;
-  size_t value_init_length = 12;
-  size_t num_values;  // number if items returned by the hash lookup
-  // Create hash table on smalled side and iterate through larger side.
-  if (args->left_len > args->right_len) {
-    ht = ht_allocate(args->right_len);
-    bulk_ht_load(ht, args->right_vals, args->right_pos, args->right_len);
-
-    for (size_t i = 0; i < args->left_len; i++) {
-      num_values = 0;
-
-      get(ht, args->left_vals[i], ret_pos_ptr, &num_values, &value_init_length);
-      // printf("Num values in threads %ld \n", num_values );
-
-      if (args->join_len + num_values > alloc_size) {
-        args->left_join_positions =
-            realloc(args->left_join_positions, 2 * alloc_size * sizeof(size_t));
-        args->right_join_positions = realloc(args->right_join_positions,
-                                             2 * alloc_size * sizeof(size_t));
-        alloc_size = 2 * alloc_size;
-      }
-      for (size_t j = 0; j < num_values; j++) {
-        // printf("Probe val %d, ret pos %ld \n", args->left_vals[i], ret_pos[j]
-        // );
-        args->left_join_positions[args->join_len] = args->left_pos[i];
-        args->right_join_positions[args->join_len] = (*ret_pos_ptr)[j];
-        args->join_len += 1;
-      }
+/*
+ * Merge join tasks for the heavy hitter rows of both sides, sorted on value,
+ * written to tasks unless it is NULL. The side with more heavy rows goes on
+ * the left of every task and is split into chunks of JOIN_PARTITION_ROWS
+ * rows. Every chunk is joined with all rows of the other side holding its
+ * values, which are broadcast, i.e. read by every task that needs them, so a
+ * single value is joined by as many tasks as it has chunks. Returns the
+ * number of tasks.
+ */
+static size_t heavy_join_tasks(const JoinRows* larger, const JoinRows* other,
+                               HashJoinThreadArgs* tasks) {
+  size_t num_tasks = 0;
+  for (size_t start = 0; start < larger->length;
+       start += JOIN_PARTITION_ROWS) {
+    size_t end = start + JOIN_PARTITION_ROWS < larger->length
+                     ? start + JOIN_PARTITION_ROWS
+                     : larger->length;
+    size_t other_start = sorted_bound(other->values, 0, other->length,
+                                      larger->values[start], true);
+    size_t other_end =
+        sorted_bound(other->values, other_start, other->length,
+                     larger->values[end - 1], false);
+    if (other_start == other_end) {
+      continue;
     }
-
-  } else {
-    // left smaller
-
-    ht = ht_allocate(args->left_len);
-    bulk_ht_load(ht, args->left_vals, args->left_pos, args->left_len);
-    for (size_t i = 0; i < args->right_len; i++) {
-      num_values = 0;
-
-      get(ht, args->right_vals[i], ret_pos_ptr, &num_values,
-          &value_init_length);
-      // printf("Num values %ld\n", num_values );
-
-      if (args->join_len + num_values > alloc_size) {
-        args->left_join_positions =
-            realloc(args->left_join_positions, 2 * alloc_size * sizeof(size_t));
-        args->right_join_positions = realloc(args->right_join_positions,
-                                             2 * alloc_size * sizeof(size_t));
-        alloc_size = 2 * alloc_size;
-      }
-      for (size_t j = 0; j < num_values; j++) {
-        // printf("Probe val %d, ret pos %ld \n", args->left_vals[i], ret_pos[j]
-        // );
-        args->left_join_positions[args->join_len] = (*ret_pos_ptr)[j];
-        args->right_join_positions[args->join_len] = args->right_pos[i];
-        args->join_len += 1;
-      }
+    if (tasks != NULL) {
+      tasks[num_tasks].left_vals = &larger->values[start];
+      tasks[num_tasks].left_pos = &larger->positions[start];
+      tasks[num_tasks].left_len = end - start;
+      tasks[num_tasks].right_vals = &other->values[other_start];
+      tasks[num_tasks].right_pos = &other->positions[other_start];
+      tasks[num_tasks].right_len = other_end - other_start;
     }
+    num_tasks++;
   }
+  return num_tasks;
+}
 
-  args->left_join_positions =
-      realloc(args->left_join_positions, args->join_len * sizeof(size_t));
-  args->right_join_positions =
-      realloc(args->right_join_positions, args->join_len * sizeof(size_t));
-  ht_deallocate(ht);
-  return NULL;
+/*
+ * Sorts rows on value in place of the unsorted ones.
+ */
+static void sort_join_rows(JoinRows* rows) {
+  int* sorted_values;
+  size_t* sorted_positions;
+  sort_pairs(rows->values, rows->positions, rows->length, &sorted_values,
+             &sorted_positions);
+  join_rows_free(rows);
+  rows->values = sorted_values;
+  rows->positions = sorted_positions;
 }
 
+/*
+ * Radix partitions both sides and joins every pair of partitions with a
+ * hash table. Inner joins which run in parallel first sample both sides for
+ * heavy hitters: their rows are taken out before partitioning and merge
+ * joined apart, and partitions which are still far larger than the average
+ * are split across several tasks. Semi, anti and left outer joins build on
+ * the right side and probe with the left; their output per left row is at
+ * most one row, or all of its matches, so they skip the heavy hitters.
+ */
 char* execute_hash_join(DbOperator* query, ClientContext* client_context,
                         int* left_data, size_t* left_pos, int* right_data,
                         size_t* right_pos, size_t left_length,
                         size_t right_length) {
-  size_t num_parts = TLB / 2;
-  JoinPartitions* parts =
-      radix_parition(num_parts, left_pos, right_pos, left_data, right_data,
-                     left_length, right_length);
-
-  // for (size_t i =0; i < num_parts; i++){
-  //     printf("Left partition\n");
-  //     for (size_t j = 0; j < parts->left_partition_lengths[i]; j++){
-  //         printf("val %d, pos %ld\n", parts->left_val_partitions[i][j],
-  //         parts->left_pos_partitions[i][j] );
-
-  //     }
-  //     printf("right partition\n");
-  //     for (size_t j = 0; j < parts->right_partition_lengths[i]; j++){
-  //          printf("val %d, pos %ld\n", parts->right_val_partitions[i][j],
-  //          parts->right_pos_partitions[i][j] );
-  //     }
-  // }
-
-  // Spining off theads, keeping in mind that partitions need to fit in L3
-  // cache. icremented when thread is spawned
+  // partition both sides the same way so that equal values land in
+  // partitions of equal index
+  JoinType join_type = query->operator_fields.join_operator.join_type;
+  bool left_smaller = join_type == HASH && left_length < right_length;
+  size_t num_parts = radix_num_partitions(
+      left_smaller ? left_length : right_length, left_length + right_length);
+
+  size_t num_heavy = 0;
+  int* heavy = NULL;
+  if (join_type == HASH && left_length + right_length > MORSEL_SIZE) {
+    heavy = join_heavy_hitters(left_data, left_length, right_data,
+                               right_length, num_parts, &num_heavy);
+  }
+  JoinRows left_light = {0};
+  JoinRows right_light = {0};
+  JoinRows left_heavy = {0};
+  JoinRows right_heavy = {0};
+  if (heavy != NULL) {
+    split_heavy_rows(left_data, left_pos, left_length, heavy, num_heavy,
+                     &left_light, &left_heavy);
+    split_heavy_rows(right_data, right_pos, right_length, heavy, num_heavy,
+                     &right_light, &right_heavy);
+    free(heavy);
+    sort_join_rows(&left_heavy);
+    sort_join_rows(&right_heavy);
+    left_data = left_light.values;
+    left_pos = left_light.positions;
+    left_length = left_light.length;
+    right_data = right_light.values;
+    right_pos = right_light.positions;
+    right_length = right_light.length;
+  }
 
-  Result* left_res = malloc(sizeof(Result));
-  Result* right_res = malloc(sizeof(Result));
-  left_res->data_type = POSITIONLIST;
-  right_res->data_type = POSITIONLIST;
-  left_res->payload = malloc(sizeof(size_t) * left_length);
-  right_res->payload = malloc(sizeof(size_t) * left_length);
-  size_t payload_alloc_length = left_length;
-  left_res->num_tuples = 0;
-  right_res->num_tuples = 0;
-  left_res->num_update_tuples = 0;
-  right_res->num_update_tuples = 0;
+  // rows of the larger side without a match on the smaller side are dropped
+  // while partitioning, as long as the filter drops enough of them. Anti and
+  // left outer joins return the unmatched left rows, so keep them.
+  BloomFilter* filter = NULL;
+  if (join_type == HASH || join_type == SEMI) {
+    filter = join_filter(left_smaller ? left_data : right_data,
+                         left_smaller ? left_length : right_length,
+                         left_smaller ? right_data : left_data,
+                         left_smaller ? right_length : left_length);
+  }
+  RadixPartitions left_parts;
+  RadixPartitions right_parts;
+  radix_partition(left_data, left_pos, left_length,
+                  left_smaller ? NULL : filter, num_parts, &left_parts);
+  radix_partition(right_data, right_pos, right_length,
+                  left_smaller ? filter : NULL, num_parts, &right_parts);
+  if (filter != NULL) {
+    bloom_free(filter);
+  }
 
-  size_t completed_parts = 0;
+  // Every pair of non empty partitions is joined as one or more tasks on the
+  // pool, partitions need to fit in L2 cache. The heavy hitters are joined
+  // by the tasks after them.
+  bool heavy_left = left_heavy.length >= right_heavy.length;
+  const JoinRows* heavy_larger = heavy_left ? &left_heavy : &right_heavy;
+  const JoinRows* heavy_other = heavy_left ? &right_heavy : &left_heavy;
+  size_t num_part_tasks = 0;
+  size_t num_builds = 0;
+  for (size_t i = 0; i < num_parts; i++) {
+    size_t num_chunks =
+        partition_tasks(&left_parts, &right_parts, i, join_type, NULL, NULL);
+    num_part_tasks += num_chunks;
+    num_builds += num_chunks > 1;
+  }
+  size_t num_heavy_tasks = heavy_join_tasks(heavy_larger, heavy_other, NULL);
+  HashJoinThreadArgs* thread_args_arr = calloc(
+      num_part_tasks + num_heavy_tasks + 1, sizeof(HashJoinThreadArgs));
+  JoinTableBuild* builds = malloc((num_builds + 1) * sizeof(JoinTableBuild));
+  size_t num_tasks = 0;
+  num_builds = 0;
+  for (size_t i = 0; i < num_parts; i++) {
+    size_t num_chunks =
+        partition_tasks(&left_parts, &right_parts, i, join_type,
+                        &thread_args_arr[num_tasks], &builds[num_builds]);
+    num_tasks += num_chunks;
+    num_builds += num_chunks > 1;
+  }
+  heavy_join_tasks(heavy_larger, heavy_other, &thread_args_arr[num_tasks]);
+  TaskGroup group = {0};
+  TaskFunc part_func =
+      join_type == HASH ? &hash_join_thread : &left_probe_join_thread;
+  // split partitions are the largest, so their tables are loaded first, and
+  // each submits its chunk tasks once it is loaded
+  for (size_t b = 0; b < num_builds; b++) {
+    builds[b].probe_func = part_func;
+    builds[b].group = &group;
+    threadpool_submit(g_pool, &group, &join_table_build_thread, &builds[b]);
+  }
+  for (size_t t = 0; t < num_part_tasks + num_heavy_tasks; t++) {
+    if (t < num_part_tasks && thread_args_arr[t].table != NULL) {
+      continue;
+    }
+    threadpool_submit(g_pool, &group,
+                      t < num_part_tasks ? part_func : &merge_join_thread,
+                      &thread_args_arr[t]);
+  }
+  threadpool_wait(g_pool, &group);
+  for (size_t b = 0; b < num_builds; b++) {
+    ht_deallocate(builds[b].table);
+  }
+  free(builds);
+  radix_partitions_free(&left_parts);
+  radix_partitions_free(&right_parts);
+  join_rows_free(&left_light);
+  join_rows_free(&right_light);
+  join_rows_free(&left_heavy);
+  join_rows_free(&right_heavy);
+
+  // heavy hitter tasks have the side with more heavy rows on the left
+  if (!heavy_left) {
+    swap_join_sides(&thread_args_arr[num_part_tasks], num_heavy_tasks);
+  }
+  return insert_join_results(thread_args_arr,
+                             num_part_tasks + num_heavy_tasks, query,
+                             client_context);
+}
 
-  pthread_t* threads = malloc(JOINTHREADS * sizeof(pthread_t));
+/*
+ * Sorts each side on value, unless it already is, e.g. when it was fetched
+ * from a column with a clustered sorted index, then merge joins them. The
+ * sorted left side is split into a chunk a morsel long per task, moving each
+ * split forward past any run of equal values, and each task joins its chunk
+ * with the range of the right side holding the same values. The results come
+ * out ordered on the left side's value, and on position among equal values.
+ */
+char* execute_merge_join(DbOperator* query, ClientContext* client_context,
+                         int* left_data, size_t* left_pos, int* right_data,
+                         size_t* right_pos, size_t left_length,
+                         size_t right_length) {
+  int* left_sorted_data = NULL;
+  size_t* left_sorted_pos = NULL;
+  int* right_sorted_data = NULL;
+  size_t* right_sorted_pos = NULL;
+  if (!ints_sorted(left_data, left_length)) {
+    sort_pairs(left_data, left_pos, left_length, &left_sorted_data,
+               &left_sorted_pos);
+    left_data = left_sorted_data;
+    left_pos = left_sorted_pos;
+  }
+  if (!ints_sorted(right_data, right_length)) {
+    sort_pairs(right_data, right_pos, right_length, &right_sorted_data,
+               &right_sorted_pos);
+    right_data = right_sorted_data;
+    right_pos = right_sorted_pos;
+  }
 
-  HashJoinThreadArgs** thread_args_arr =
-      malloc(sizeof(HashJoinThreadArgs*) * JOINTHREADS);
+  size_t num_tasks = morsel_num(left_length);
+  size_t* chunk_starts = malloc((num_tasks + 1) * sizeof(size_t));
+  chunk_starts[0] = 0;
+  for (size_t m = 1; m < num_tasks; m++) {
+    size_t start = m * MORSEL_SIZE;
+    start = start > chunk_starts[m - 1] ? start : chunk_starts[m - 1];
+    chunk_starts[m] = start == 0 ? 0
+                                 : sorted_bound(left_data, start, left_length,
+                                                left_data[start - 1], false);
+  }
+  chunk_starts[num_tasks] = left_length;
+
+  HashJoinThreadArgs* thread_args_arr =
+      calloc(num_tasks + 1, sizeof(HashJoinThreadArgs));
+  TaskGroup group = {0};
+  for (size_t m = 0; m < num_tasks; m++) {
+    size_t start = chunk_starts[m];
+    size_t end = chunk_starts[m + 1];
+    if (start == end) {
+      continue;
+    }
+    size_t right_start =
+        sorted_bound(right_data, 0, right_length, left_data[start], true);
+    size_t right_end =
+        end == left_length
+            ? right_length
+            : sorted_bound(right_data, right_start, right_length,
+                           left_data[end], true);
+    thread_args_arr[m].left_vals = &left_data[start];
+    thread_args_arr[m].left_pos = &left_pos[start];
+    thread_args_arr[m].left_len = end - start;
+    thread_args_arr[m].right_vals = &right_data[right_start];
+    thread_args_arr[m].right_pos = &right_pos[right_start];
+    thread_args_arr[m].right_len = right_end - right_start;
+    threadpool_submit(g_pool, &group, &merge_join_thread, &thread_args_arr[m]);
+  }
+  threadpool_wait(g_pool, &group);
+  free(chunk_starts);
+  free(left_sorted_data);
+  free(left_sorted_pos);
+  free(right_sorted_data);
+  free(right_sorted_pos);
+
+  return insert_join_results(thread_args_arr, num_tasks, query,
+                             client_context);
+}
 
-  while (completed_parts < num_parts) {
-    size_t threads_to_create = (JOINTHREADS > num_parts - completed_parts)
-                                   ? JOINTHREADS
-                                   : num_parts - completed_parts;
-    size_t threads_in_use = 0;
-    // printf("Threads to create %ld\n", threads_to_create);
-    for (size_t i = 0; i < threads_to_create; i++) {
-      while (parts->left_partition_lengths[completed_parts] == 0 ||
-             parts->right_partition_lengths[completed_parts] == 0) {
-        completed_parts += 1;
-      }
+/*
+ * The inner side of an index join: an indexed base column and its pending
+ * updates, which the index does not hold until they are flushed. deleted are
+ * sorted base positions with pending deletes, insert_vals and insert_pos the
+ * pending inserts sorted on value.
+ */
+typedef struct IndexJoinInner {
+  Column* column;
+  size_t* deleted;
+  size_t num_deleted;
+  int* insert_vals;
+  size_t* insert_pos;
+  size_t num_inserts;
+} IndexJoinInner;
+
+typedef struct IndexJoinTask {
+  HashJoinThreadArgs* args;
+  const IndexJoinInner* inner;
+} IndexJoinTask;
+
+static bool position_deleted(const IndexJoinInner* inner, size_t pos) {
+  size_t lo = 0;
+  size_t hi = inner->num_deleted;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (inner->deleted[mid] < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < inner->num_deleted && inner->deleted[lo] == pos;
+}
 
-      if (completed_parts > num_parts) {
+/*
+ * Joins a chunk of the sorted outer side, the left side of args, with the
+ * index. Every run of equal outer values seeks the index once and is joined
+ * with the live inner rows holding that value.
+ */
+void* index_join_thread(void* ij_args) {
+  IndexJoinTask* task = (IndexJoinTask*)ij_args;
+  HashJoinThreadArgs* args = task->args;
+  const IndexJoinInner* inner = task->inner;
+  size_t run_alloc_size = 16;
+  size_t* run = malloc(run_alloc_size * sizeof(size_t));
+
+  IndexCursor cursor;
+  index_cursor_init(&cursor, inner->column);
+  size_t ins = 0;
+  size_t i = 0;
+  while (i < args->left_len) {
+    int value = args->left_vals[i];
+    size_t i_end = i + 1;
+    while (i_end < args->left_len && args->left_vals[i_end] == value) {
+      i_end++;
+    }
+    size_t run_len = 0;
+    index_cursor_seek(&cursor, value);
+    ins = sorted_bound(inner->insert_vals, ins, inner->num_inserts, value,
+                       true);
+    while (true) {
+      size_t pos;
+      if (index_cursor_valid(&cursor) && index_cursor_key(&cursor) == value) {
+        pos = index_cursor_position(&cursor);
+        index_cursor_next(&cursor);
+        if (position_deleted(inner, pos)) {
+          continue;
+        }
+      } else if (ins < inner->num_inserts &&
+                 inner->insert_vals[ins] == value) {
+        pos = inner->insert_pos[ins++];
+      } else {
         break;
       }
-      // printf("completed_parts %ld \n", completed_parts);
-      // printf("left part size %ld right part size %ld \n",
-      // parts->left_partition_lengths[completed_parts],
-      // parts->right_partition_lengths[completed_parts] );
-      thread_args_arr[threads_in_use] = calloc(1, sizeof(HashJoinThreadArgs));
-      thread_args_arr[threads_in_use]->left_pos =
-          parts->left_pos_partitions[completed_parts];
-      thread_args_arr[threads_in_use]->right_pos =
-          parts->right_pos_partitions[completed_parts];
-      thread_args_arr[threads_in_use]->left_vals =
-          parts->left_val_partitions[completed_parts];
-      thread_args_arr[threads_in_use]->right_vals =
-          parts->right_val_partitions[completed_parts];
-      thread_args_arr[threads_in_use]->left_len =
-          parts->left_partition_lengths[completed_parts];
-      thread_args_arr[threads_in_use]->right_len =
-          parts->right_partition_lengths[completed_parts];
-
-      // printf(" pre pthread create: Hash join left len %ld right len %ld\n",
-      // thread_args_arr[threads_in_use]->left_len,
-      // thread_args_arr[threads_in_use]->right_len);
-
-      pthread_create(&threads[threads_in_use], NULL, &hash_join_thread,
-                     (void*)(thread_args_arr[threads_in_use]));
-      completed_parts += 1;
-      threads_in_use += 1;
-    }
-
-    // Join all threads, copy results to left and right results
-    for (size_t i = 0; i < threads_in_use; i++) {
-      if (pthread_join(threads[i], NULL) != 0) {
-        log_err("%s:%d Failed to join pthread num %ld ", __FILE__, __LINE__, i);
+      if (run_len == run_alloc_size) {
+        run_alloc_size *= 2;
+        run = realloc(run, run_alloc_size * sizeof(size_t));
       }
+      run[run_len++] = pos;
     }
-
-    for (size_t i = 0; i < threads_in_use; i++) {
-      // resize results as needed
-      if (thread_args_arr[i]->join_len + left_res->num_tuples >
-          payload_alloc_length) {
-        left_res->payload =
-            realloc(left_res->payload,
-                    (2 * thread_args_arr[i]->join_len + left_res->num_tuples) *
-                        sizeof(size_t));
-        right_res->payload =
-            realloc(right_res->payload,
-                    (2 * thread_args_arr[i]->join_len + right_res->num_tuples) *
-                        sizeof(size_t));
+    for (size_t l = i; l < i_end; l++) {
+      join_matches_reserve(&args->matches, run_len);
+      for (size_t r = 0; r < run_len; r++) {
+        join_matches_add(&args->matches, args->left_pos[l], run[r]);
       }
-
-      memcpy(&(((size_t*)left_res->payload)[left_res->num_tuples]),
-             thread_args_arr[i]->left_join_positions,
-             thread_args_arr[i]->join_len * sizeof(size_t));
-      memcpy(&(((size_t*)right_res->payload)[right_res->num_tuples]),
-             thread_args_arr[i]->right_join_positions,
-             thread_args_arr[i]->join_len * sizeof(size_t));
-      // raise(SIGINT);
-      // printf("i%ld Join len as results copied %ld \n", i,
-      // thread_args_arr[i]->join_len);
-      left_res->num_tuples += thread_args_arr[i]->join_len;
-      right_res->num_tuples += thread_args_arr[i]->join_len;
-      free(thread_args_arr[i]);
     }
+    i = i_end;
   }
+  free(run);
+  return NULL;
+}
 
-  // for (size_t i=0; i < left_res->num_tuples; i++){
-  //     printf("left res pos %ld, right res_pos %ld \n",
-  //     ((size_t*)left_res->payload)[i], ((size_t*)right_res->payload)[i] );
-  // }
+/*
+ * Whether a join of outer_length rows with an indexed base column should
+ * probe the index rather than hash both sides.
+ */
+static bool index_joinable(const Column* column, size_t outer_length) {
+  return INDEXES && column->index_type != NONE && column->index != NULL &&
+         outer_length * INDEX_JOIN_MIN_RATIO <= *column->num_rows;
+}
 
-  // printf("left handle name %s,  right_handle name %s
-  // \n",query->operator_fields.join_operator.handle_left,
-  // query->operator_fields.join_operator.handle_right); printf(" num_matches
-  // %ld \n", left_res->num_tuples);
-  insert_result_context(left_res,
-                        query->operator_fields.join_operator.handle_left,
-                        client_context);
-  insert_result_context(right_res,
-                        query->operator_fields.join_operator.handle_right,
-                        client_context);
-  return "";
+/*
+ * Joins the outer side with an indexed base column by probing its index, so
+ * a small outer side costs a few thousand tree descents instead of a pass
+ * over the column. The outer side is sorted and split into a chunk a morsel
+ * long per task; each task's probes then come in ascending order and its
+ * cursor moves along the leaves from one key to the next, descending from the
+ * root only when the next key is further away.
+ */
+char* execute_index_join(DbOperator* query, ClientContext* client_context,
+                         Column* column, bool column_left, int* outer_data,
+                         size_t* outer_pos, size_t outer_length) {
+  int* sorted_data;
+  size_t* sorted_pos;
+  sort_pairs(outer_data, outer_pos, outer_length, &sorted_data, &sorted_pos);
+
+  IndexJoinInner inner = {.column = column};
+  inner.deleted = column_deleted_positions(column, &inner.num_deleted);
+  size_t* ins_positions =
+      malloc((column->update_struct.ins_length + 1) * sizeof(size_t));
+  for (size_t k = 0; k < column->update_struct.ins_length; k++) {
+    ins_positions[k] = *column->num_rows + k;
+  }
+  sort_pairs(column->update_struct.ins_val, ins_positions,
+             column->update_struct.ins_length, &inner.insert_vals,
+             &inner.insert_pos);
+  inner.num_inserts = column->update_struct.ins_length;
+  free(ins_positions);
+
+  size_t num_tasks = morsel_num(outer_length);
+  HashJoinThreadArgs* thread_args_arr =
+      calloc(num_tasks + 1, sizeof(HashJoinThreadArgs));
+  IndexJoinTask* tasks = malloc((num_tasks + 1) * sizeof(IndexJoinTask));
+  TaskGroup group = {0};
+  for (size_t m = 0; m < num_tasks; m++) {
+    size_t start = m * MORSEL_SIZE;
+    size_t end = start + MORSEL_SIZE < outer_length ? start + MORSEL_SIZE
+                                                    : outer_length;
+    thread_args_arr[m].left_vals = &sorted_data[start];
+    thread_args_arr[m].left_pos = &sorted_pos[start];
+    thread_args_arr[m].left_len = end - start;
+    tasks[m].args = &thread_args_arr[m];
+    tasks[m].inner = &inner;
+    threadpool_submit(g_pool, &group, &index_join_thread, &tasks[m]);
+  }
+  threadpool_wait(g_pool, &group);
+  free(tasks);
+  free(sorted_data);
+  free(sorted_pos);
+  free(inner.deleted);
+  free(inner.insert_vals);
+  free(inner.insert_pos);
+
+  // tasks put the outer side on the left
+  if (column_left) {
+    swap_join_sides(thread_args_arr, num_tasks);
+  }
+  return insert_join_results(thread_args_arr, num_tasks, query,
+                             client_context);
+}
+
+/*
+ * Positions of the rows of an inner block equal to value, written to matches
+ * by the SIMD range select kernel. value + 1 overflows for INT_MAX, so that
+ * value is compared a row at a time.
+ */
+static size_t block_matches(const int* values, const size_t* positions,
+                            size_t length, int value, size_t* matches) {
+  if (value < INT_MAX) {
+    return scan_select_range(values, positions, 0, length, value, value + 1,
+                             matches);
+  }
+  size_t num_matches = 0;
+  for (size_t j = 0; j < length; j++) {
+    matches[num_matches] = positions[j];
+    num_matches += values[j] == value;
+  }
+  return num_matches;
 }
 
 /*
- * I am pretty sure all arguments will be results as opposed to columns, since
- * positions also need to be passed in.
+ * Joins a block of outer rows, the left side of args, with all of the inner
+ * side, the right side of args, a block of NESTEDLOOP_BLOCK_ROWS inner rows
+ * at a time. Every outer row of the task is compared with an inner block
+ * while it is in L1, before moving on to the next block.
  */
+void* nestedloop_join_thread(void* nl_args) {
+  HashJoinThreadArgs* args = (HashJoinThreadArgs*)nl_args;
+  size_t* matches = malloc(NESTEDLOOP_BLOCK_ROWS * sizeof(size_t));
+
+  for (size_t block = 0; block < args->right_len;
+       block += NESTEDLOOP_BLOCK_ROWS) {
+    size_t block_len = args->right_len - block < NESTEDLOOP_BLOCK_ROWS
+                           ? args->right_len - block
+                           : NESTEDLOOP_BLOCK_ROWS;
+    for (size_t i = 0; i < args->left_len; i++) {
+      size_t num_matches =
+          block_matches(&args->right_vals[block], &args->right_pos[block],
+                        block_len, args->left_vals[i], matches);
+      join_matches_reserve(&args->matches, num_matches);
+      for (size_t k = 0; k < num_matches; k++) {
+        join_matches_add(&args->matches, args->left_pos[i], matches[k]);
+      }
+    }
+  }
+  free(matches);
+  return NULL;
+}
 
+/*
+ * Cache blocked nested loop join. The larger side is the outer one, split
+ * into blocks of NESTEDLOOP_OUTER_ROWS rows which are joined in parallel, and
+ * each task scans the inner side a block of NESTEDLOOP_BLOCK_ROWS rows at a
+ * time, comparing the block with every row of its outer block. Only matches
+ * are written. Within an outer block the results are ordered on inner block,
+ * then outer row.
+ */
 char* execute_nestedloop_join(DbOperator* query, ClientContext* client_context,
                               int* left_data, size_t* left_pos, int* right_data,
                               size_t* right_pos, size_t left_length,
                               size_t right_length) {
-  // printf("Nested loop join start\n");
-
-  Result* left_res = malloc(sizeof(Result));
-  Result* right_res = malloc(sizeof(Result));
-  left_res->data_type = POSITIONLIST;
-  right_res->data_type = POSITIONLIST;
+  bool left_outer = left_length >= right_length;
+  int* outer_data = left_outer ? left_data : right_data;
+  size_t* outer_pos = left_outer ? left_pos : right_pos;
+  size_t outer_length = left_outer ? left_length : right_length;
+  size_t num_tasks =
+      (outer_length + NESTEDLOOP_OUTER_ROWS - 1) / NESTEDLOOP_OUTER_ROWS;
+
+  HashJoinThreadArgs* thread_args_arr =
+      calloc(num_tasks + 1, sizeof(HashJoinThreadArgs));
+  TaskGroup group = {0};
+  for (size_t m = 0; m < num_tasks; m++) {
+    size_t start = m * NESTEDLOOP_OUTER_ROWS;
+    size_t end = start + NESTEDLOOP_OUTER_ROWS < outer_length
+                     ? start + NESTEDLOOP_OUTER_ROWS
+                     : outer_length;
+    thread_args_arr[m].left_vals = &outer_data[start];
+    thread_args_arr[m].left_pos = &outer_pos[start];
+    thread_args_arr[m].left_len = end - start;
+    thread_args_arr[m].right_vals = left_outer ? right_data : left_data;
+    thread_args_arr[m].right_pos = left_outer ? right_pos : left_pos;
+    thread_args_arr[m].right_len = left_outer ? right_length : left_length;
+    threadpool_submit(g_pool, &group, &nestedloop_join_thread,
+                      &thread_args_arr[m]);
+  }
+  threadpool_wait(g_pool, &group);
 
-  size_t result_alloc_size =
-      left_length > right_length ? left_length : right_length;
-  left_res->payload = malloc(sizeof(size_t) * result_alloc_size);
-  right_res->payload = malloc(sizeof(size_t) * result_alloc_size);
+  // tasks put the outer side on the left
+  if (!left_outer) {
+    swap_join_sides(thread_args_arr, num_tasks);
+  }
+  return insert_join_results(thread_args_arr, num_tasks, query,
+                             client_context);
+}
 
-  /*
-   * This can be done on multiple cores, breaking the larger value vector down
-   * into smaller vectors. even without multi core vectorizing it will improve
-   * cache performance
-   */
-  size_t num_matches = 0;
-  for (size_t i = 0; i < left_length; i++) {
-    if (result_alloc_size < num_matches + right_length) {
-      left_res->payload =
-          realloc(left_res->payload,
-                  sizeof(size_t) * (result_alloc_size + num_matches));
-      right_res->payload =
-          realloc(right_res->payload,
-                  sizeof(size_t) * (result_alloc_size + num_matches));
-    }
-    for (size_t j = 0; j < right_length; j++) {
-      ((size_t*)left_res->payload)[num_matches] = left_pos[i];
-      ((size_t*)right_res->payload)[num_matches] = right_pos[j];
-      num_matches += left_data[i] == right_data[j];
-    }
-  }
-
-  left_res->payload =
-      realloc(left_res->payload, sizeof(size_t) * (num_matches));
-  right_res->payload =
-      realloc(right_res->payload, sizeof(size_t) * (num_matches));
-  left_res->num_tuples = num_matches;
-  left_res->num_update_tuples = 0;
-  right_res->num_tuples = num_matches;
-  right_res->num_update_tuples = 0;
-  // printf("left handle name %s,  right_handle name %s
-  // \n",query->operator_fields.join_operator.handle_left,
-  // query->operator_fields.join_operator.handle_right); printf(" num_matches
-  // %ld \n", num_matches);
-  insert_result_context(left_res,
-                        query->operator_fields.join_operator.handle_left,
-                        client_context);
-  insert_result_context(right_res,
-                        query->operator_fields.join_operator.handle_right,
-                        client_context);
-  return "";
+/*
+ * Values and positions of the live rows of a base column, its base rows less
+ * pending deletes followed by its pending inserts, in newly allocated arrays.
+ */
+static void column_join_input(Column* column, int** data, size_t** positions,
+                              size_t* length) {
+  size_t num_rows = *column->num_rows;
+  size_t num_deleted;
+  size_t* deleted = column_deleted_positions(column, &num_deleted);
+  size_t total = num_rows - num_deleted + column->update_struct.ins_length;
+  *data = malloc((total + 1) * sizeof(int));
+  *positions = malloc((total + 1) * sizeof(size_t));
+  size_t n = 0;
+  size_t d = 0;
+  for (size_t i = 0; i < num_rows; i++) {
+    if (d < num_deleted && deleted[d] == i) {
+      d++;
+      continue;
+    }
+    (*data)[n] = column->data[i];
+    (*positions)[n] = i;
+    n++;
+  }
+  for (size_t k = 0; k < column->update_struct.ins_length; k++) {
+    (*data)[n] = column->update_struct.ins_val[k];
+    (*positions)[n] = num_rows + k;
+    n++;
+  }
+  free(deleted);
+  *length = n;
 }
 
 /*
- * Consider pros/cons of passing left and right pos and val arrays to the join
- * functions rather than calculating inside of them
+ * Values and positions of one side of a join. A base column joins all of its
+ * live rows and its position argument is ignored, the arrays are then
+ * allocated and owned is set. Returns val_error or pos_error if the arguments
+ * have the wrong type, else NULL.
  */
+static char* join_input(GeneralizedColumn* val, GeneralizedColumn* pos,
+                        char* val_error, char* pos_error, int** data,
+                        size_t** positions, size_t* length, bool* owned) {
+  *owned = val->column_type == COLUMN;
+  if (*owned) {
+    column_join_input(val->column_pointer.column, data, positions, length);
+    return NULL;
+  }
+  if (val->column_pointer.result->data_type != INT) {
+    return val_error;
+  }
+  *data = (int*)val->column_pointer.result->payload;
+  *length = val->column_pointer.result->num_tuples;
+  // joins need explicit positions, decode any bitvector inputs in place
+  if (pos->column_type != RESULT ||
+      !result_to_positionlist(pos->column_pointer.result)) {
+    return pos_error;
+  }
+  *positions = (size_t*)pos->column_pointer.result->payload;
+  // the unmatched rows of a left outer join have no value to join on
+  *owned = drop_null_positions(*data, *positions, *length, data, positions,
+                               length);
+  return NULL;
+}
 
+/*
+ * An inner join of a base column with an index against a result much smaller
+ * than the column probes the index. Other base columns are materialised, and
+ * the inputs are joined with the requested join type.
+ */
 char* execute_join(DbOperator* query, ClientContext* client_context) {
+  JoinOperator* join_op = &query->operator_fields.join_operator;
+  GeneralizedColumn* left_val = join_op->left_val;
+  GeneralizedColumn* right_val = join_op->right_val;
   int* left_data;
   size_t* left_pos;
   int* right_data;
   size_t* right_pos;
   size_t left_length;
   size_t right_length;
-
-  if (query->operator_fields.join_operator.left_val->column_pointer.result
-          ->data_type != INT) {
-    return "Left value vector must be integer type\n";
-  }
-  left_data = (int*)query->operator_fields.join_operator.left_val
-                  ->column_pointer.result->payload;
-  left_length = query->operator_fields.join_operator.left_val->column_pointer
-                    .result->num_tuples;
-
-  if (query->operator_fields.join_operator.right_val->column_pointer.result
-          ->data_type != INT) {
-    return "Right value vector must be integer type\n";
+  bool left_owned;
+  bool right_owned;
+  char* error;
+
+  bool inner_join = join_op->join_type == HASH ||
+                    join_op->join_type == MERGE ||
+                    join_op->join_type == NESTEDLOOP;
+  if (inner_join && left_val->column_type != right_val->column_type) {
+    bool column_left = left_val->column_type == COLUMN;
+    Column* column = column_left ? left_val->column_pointer.column
+                                 : right_val->column_pointer.column;
+    GeneralizedColumn* outer_val = column_left ? right_val : left_val;
+    GeneralizedColumn* outer_pos =
+        column_left ? join_op->right_pos : join_op->left_pos;
+    if (index_joinable(column, outer_val->column_pointer.result->num_tuples)) {
+      int* outer_data;
+      size_t* outer_positions;
+      size_t outer_length;
+      bool outer_owned;
+      error = join_input(outer_val, outer_pos,
+                         "Value vector must be integer type\n",
+                         "Position vector must be integer type\n",
+                         &outer_data, &outer_positions, &outer_length,
+                         &outer_owned);
+      if (error != NULL) {
+        return error;
+      }
+      char* res_string =
+          execute_index_join(query, client_context, column, column_left,
+                             outer_data, outer_positions, outer_length);
+      if (outer_owned) {
+        free(outer_data);
+        free(outer_positions);
+      }
+      return res_string;
+    }
   }
-  right_data = (int*)query->operator_fields.join_operator.right_val
-                   ->column_pointer.result->payload;
-  right_length = query->operator_fields.join_operator.right_val->column_pointer
-                     .result->num_tuples;
 
-  if (query->operator_fields.join_operator.left_pos->column_pointer.result
-          ->data_type != POSITIONLIST) {
-    return "Left position vector must be integer type\n";
+  error = join_input(left_val, join_op->left_pos,
+                     "Left value vector must be integer type\n",
+                     "Left position vector must be integer type\n",
+                     &left_data, &left_pos, &left_length, &left_owned);
+  if (error != NULL) {
+    return error;
   }
-  left_pos = (size_t*)query->operator_fields.join_operator.left_pos
-                 ->column_pointer.result->payload;
-
-  if (query->operator_fields.join_operator.right_pos->column_pointer.result
-          ->data_type != POSITIONLIST) {
-    return "Right position vector must be integer type\n";
+  error = join_input(right_val, join_op->right_pos,
+                     "Right value vector must be integer type\n",
+                     "Right position vector must be integer type\n",
+                     &right_data, &right_pos, &right_length, &right_owned);
+  if (error != NULL) {
+    if (left_owned) {
+      free(left_data);
+      free(left_pos);
+    }
+    return error;
   }
-  right_pos = (size_t*)query->operator_fields.join_operator.right_pos
-                  ->column_pointer.result->payload;
 
-  if (query->operator_fields.join_operator.join_type == HASH) {
-    return execute_hash_join(query, client_context, left_data, left_pos,
-                             right_data, right_pos, left_length, right_length);
-  } else if (query->operator_fields.join_operator.join_type == NESTEDLOOP) {
-    // printf("Nested loop about to be called \n");
-    return execute_nestedloop_join(query, client_context, left_data, left_pos,
-                                   right_data, right_pos, left_length,
-                                   right_length);
+  char* res_string;
+  if (join_op->join_type == HASH || join_op->join_type == SEMI ||
+      join_op->join_type == ANTI || join_op->join_type == LEFT_OUTER) {
+    res_string =
+        execute_hash_join(query, client_context, left_data, left_pos,
+                          right_data, right_pos, left_length, right_length);
+  } else if (join_op->join_type == MERGE) {
+    res_string =
+        execute_merge_join(query, client_context, left_data, left_pos,
+                           right_data, right_pos, left_length, right_length);
+  } else if (join_op->join_type == NESTEDLOOP) {
+    res_string = execute_nestedloop_join(query, client_context, left_data,
+                                         left_pos, right_data, right_pos,
+                                         left_length, right_length);
   } else {
-    return "Only Hash and loop joins are implemented";
+    res_string = "Only hash, merge, loop, semi, anti and left outer joins are "
+                 "implemented";
+  }
+  if (left_owned) {
+    free(left_data);
+    free(left_pos);
+  }
+  if (right_owned) {
+    free(right_data);
+    free(right_pos);
   }
+  return res_string;
 }
 
 // ****************************************************************************
@@ -1424,16 +3157,83 @@ char* execute_insert(DbOperator* query) {
         .update_struct.ins_val[table->columns[i].update_struct.ins_length] =
         query->operator_fields.insert_operator.values[i];
     table->columns[i].update_struct.ins_length += 1;
+    stats_add(&table->columns[i],
+              query->operator_fields.insert_operator.values[i]);
     // raise(SIGINT);
   }
 
   return "";
 }
 
+static int compare_positions(const void* a, const void* b) {
+  size_t left = *(const size_t*)a;
+  size_t right = *(const size_t*)b;
+  return (left > right) - (left < right);
+}
+
+/*
+ * The positions of a position list sorted and without repeats or
+ * NULL_POSITION, in a newly allocated array.
+ */
+static size_t* unique_positions(const Result* positions, size_t* num_unique) {
+  size_t* unique = malloc((positions->num_tuples + 1) * sizeof(size_t));
+  memcpy(unique, positions->payload, positions->num_tuples * sizeof(size_t));
+  qsort(unique, positions->num_tuples, sizeof(size_t), &compare_positions);
+  *num_unique = 0;
+  for (size_t k = 0; k < positions->num_tuples; k++) {
+    if (unique[k] == NULL_POSITION) {
+      break;
+    }
+    if (*num_unique == 0 || unique[k] != unique[*num_unique - 1]) {
+      unique[(*num_unique)++] = unique[k];
+    }
+  }
+  return unique;
+}
+
+static bool positions_contain(const size_t* sorted, size_t length,
+                              size_t pos) {
+  size_t lo = 0;
+  size_t hi = length;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (sorted[mid] < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < length && sorted[lo] == pos;
+}
+
+/*
+ * Grows the pending deletes of every column of table to hold num_deletes
+ * more positions. Pending deletes are never flushed by a delete, since that
+ * would move the rows its positions refer to.
+ */
+static void reserve_deletes(Table* table, size_t num_deletes) {
+  for (size_t i = 0; i < table->col_count; i++) {
+    DiffUpdate* update = &table->columns[i].update_struct;
+    if (update->del_length + num_deletes <= update->alloc_size) {
+      continue;
+    }
+    size_t alloc_size = 2 * update->alloc_size;
+    if (alloc_size < update->del_length + num_deletes) {
+      alloc_size = update->del_length + num_deletes;
+    }
+    update->del_pos = realloc(update->del_pos, alloc_size * sizeof(size_t));
+    update->del_val = realloc(update->del_val, alloc_size * sizeof(int));
+    update->alloc_size = alloc_size;
+  }
+}
+
 char* execute_delete(DbOperator* query) {
   printf("db delete\n");
   Table* table = query->operator_fields.delete_operator.table;
   Result* positions = query->operator_fields.delete_operator.positions;
+  if (!result_to_positionlist(positions)) {
+    return "Delete positions must be a position list or bitvector";
+  }
   // old non differential delets
   // delete from base data first
   // size_t init_num_rows = table->table_length;
@@ -1450,31 +3250,46 @@ char* execute_delete(DbOperator* query) {
   // table->table_length -= positions->num_tuples;
   // }
 
-  for (size_t j = 0; j < positions->num_tuples; j++) {
-    if (table->columns[0].update_struct.del_length >= UPDATE_BATCH_SIZE) {
-      flush_updates(table);
+  // each row once, without the unmatched rows of a left outer join, and a
+  // row already pending deletion is not deleted again
+  size_t num_delete;
+  size_t* delete_pos = unique_positions(positions, &num_delete);
+  size_t num_pending;
+  size_t* pending = column_deleted_positions(&table->columns[0], &num_pending);
+  reserve_deletes(table, num_delete);
+  // from the highest position down, so removing a pending insert does not
+  // move the positions still to be deleted
+  for (size_t j = num_delete; j-- > 0;) {
+    if (delete_pos[j] < table->table_length &&
+        positions_contain(pending, num_pending, delete_pos[j])) {
+      continue;
     }
 
     for (size_t i = 0; i < table->col_count; i++) {
       // remove from pending inserts if it is there, else append to pending
       // deletes
 
-      if (((size_t*)positions->payload)[j] > table->table_length) {
-        size_t ins_offset =
-            ((size_t*)positions->payload)[j] - table->table_length;
+      if (delete_pos[j] >= table->table_length) {
+        size_t ins_offset = delete_pos[j] - table->table_length;
+        stats_remove(&table->columns[i],
+                     table->columns[i].update_struct.ins_val[ins_offset]);
         memmove(&table->columns[i].update_struct.ins_val[ins_offset],
                 &table->columns[i].update_struct.ins_val[ins_offset + 1],
-                (table->columns[i].update_struct.ins_length - ins_offset) *
-                    sizeof(size_t));
+                (table->columns[i].update_struct.ins_length - ins_offset - 1) *
+                    sizeof(int));
         table->columns[i].update_struct.ins_length -= 1;
       } else {
+        size_t del_pos = delete_pos[j];
+        stats_remove(&table->columns[i], table->columns[i].data[del_pos]);
         table->columns[i]
             .update_struct.del_pos[table->columns[i].update_struct.del_length] =
-            ((size_t*)positions->payload)[j];
+            del_pos;
         table->columns[i].update_struct.del_length += 1;
       }
     }
   }
+  free(delete_pos);
+  free(pending);
 
   return "";
 }
@@ -1482,24 +3297,27 @@ char* execute_delete(DbOperator* query) {
 char* execute_update(DbOperator* query) {
   Column* column = query->operator_fields.update_operator.column;
   Result* positions = query->operator_fields.update_operator.positions;
-  printf("running update \n");
-  for (size_t i = 0; i < positions->num_tuples - positions->num_update_tuples;
-       i++) {
-    printf("prev value %d, new value %d \n",
-           column->data[((size_t*)positions->payload)[i]],
-           query->operator_fields.update_operator.value);
-    column->data[((size_t*)positions->payload)[i]] =
-        query->operator_fields.update_operator.value;
+  if (!result_to_positionlist(positions)) {
+    return "Update positions must be a position list or bitvector";
   }
-
-  for (size_t i = 0; i < positions->num_update_tuples; i++) {
-    printf("prev value %d, new value %d \n",
-           column->update_struct
-               .ins_val[((size_t*)positions->payload)[i] - *column->num_rows],
-           query->operator_fields.update_operator.value);
-    column->update_struct
-        .ins_val[((size_t*)positions->payload)[i] - *column->num_rows] =
-        query->operator_fields.update_operator.value;
+  printf("running update \n");
+  const int value = query->operator_fields.update_operator.value;
+  // positions at or past num_rows are pending inserts
+  for (size_t i = 0; i < positions->num_tuples; i++) {
+    size_t pos = ((size_t*)positions->payload)[i];
+    if (pos == NULL_POSITION) {
+      continue;
+    }
+    int* old_value =
+        pos < *column->num_rows
+            ? &column->data[pos]
+            : &column->update_struct.ins_val[pos - *column->num_rows];
+    printf("prev value %d, new value %d \n", *old_value, value);
+    stats_replace(column, *old_value, value);
+    *old_value = value;
+    if (pos < *column->num_rows) {
+      zonemap_widen(column, pos, value);
+    }
   }
 
   return "";
@@ -1536,15 +3354,15 @@ char* execute_DbOperator(DbOperator* query, ClientContext* client_context) {
         log_err("Attempt to start new batch while already batching");
         res_string = "Cannot start a new batch inside an exisiting batch\n";
         break;
-      case SELECT:
+      case BATCHED:
         res_string = append_batch_operator(query);
         break;
       case BATCH_EXECUTE:
         res_string = execute_batch(client_context);
-        query->context->batching_active = false;
         break;
       default:
-        log_err("currently only batched selects are implemented");
+        log_err("%s:%d unexpected operator while batching\n", __FILE__,
+                __LINE__);
     }
   } else {
     switch (query->type) {
@@ -1651,9 +3469,26 @@ char* execute_DbOperator(DbOperator* query, ClientContext* client_context) {
       case PRINT_INDEX:
         res_string = execute_print_index(query);
         break;
+      case AND:
+      case OR:
+      case NOT:
+        res_string = execute_bitwise(query, client_context);
+        break;
       case JOIN:
         res_string = execute_join(query, client_context);
         break;
+      case SELECT_AGG:
+        res_string = execute_select_agg(query, client_context);
+        break;
+      case GROUP_BY:
+        res_string = execute_group_by(query, client_context);
+        break;
+      case COUNT:
+        res_string = execute_count(query, client_context);
+        break;
+      case COUNT_DISTINCT:
+        res_string = execute_count_distinct(query, client_context);
+        break;
       default:
         log_err("No matching switch statement for query \n");
     }
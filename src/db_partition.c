@@ -0,0 +1,473 @@
+#include "db_partition.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "db_bloom.h"
+#include "db_hashtable.h"
+#include "db_morsel.h"
+#include "db_threadpool.h"
+
+_Static_assert((RADIX_PASS_FANOUT & (RADIX_PASS_FANOUT - 1)) == 0,
+               "RADIX_PASS_FANOUT must be a power of 2");
+
+#define RADIX_PASS_BITS ((unsigned)__builtin_ctz(RADIX_PASS_FANOUT))
+
+// joins big enough to run in parallel get at least this many partitions
+#define PARALLEL_JOIN_PARTITIONS 16
+
+// a value needs at least this many rows in a sample to count as a heavy
+// hitter, so that small samples do not pick out values by chance
+#define SKEW_MIN_SAMPLE_HITS 8
+
+#define CACHE_LINE 64
+// rows per write-combining buffer, one cache line of positions
+#define WC_ROWS (CACHE_LINE / sizeof(size_t))
+
+/*
+ * Software write-combining buffer of one partition. Rows are gathered in the
+ * slot they have within their cache line of the output, and a full line is
+ * written out at once with non-temporal stores, so a scatter only touches the
+ * buffers, which stay in L1 and need no TLB entry of their own, rather than
+ * a different page of the output for every row. offset is where the next row
+ * goes in the output, start is the first row of the partition written by this
+ * scatter. Rows before start in its first line belong to someone else.
+ */
+typedef struct WriteCombineBuffer {
+  _Alignas(CACHE_LINE) size_t positions[WC_ROWS];
+  int values[WC_ROWS];
+  size_t offset;
+  size_t start;
+} WriteCombineBuffer;
+
+/*
+ * The bits bits of value's 32 bit hash after skipping its top skip bits.
+ */
+static inline size_t hash_bits(int value, unsigned skip, unsigned bits) {
+  if (bits == 0) {
+    return 0;
+  }
+  uint32_t hash = (uint32_t)hash_func(value) << skip;
+  return hash >> (32 - bits);
+}
+
+/*
+ * Cache line aligned allocation, aligned_alloc needs a multiple of the
+ * alignment.
+ */
+static void* alloc_lines(size_t size) {
+  return aligned_alloc(CACHE_LINE, (size / CACHE_LINE + 1) * CACHE_LINE);
+}
+
+/*
+ * Copies slots [from, to) of buffer to the same rows of its line in the
+ * output.
+ */
+static inline void wc_copy(const WriteCombineBuffer* buffer, size_t line,
+                           size_t from, size_t to, int* out_values,
+                           size_t* out_positions) {
+  memcpy(&out_positions[line + from], &buffer->positions[from],
+         (to - from) * sizeof(size_t));
+  memcpy(&out_values[line + from], &buffer->values[from],
+         (to - from) * sizeof(int));
+}
+
+/*
+ * Writes out a full buffer, whose line ends at buffer->offset.
+ */
+static inline void wc_flush(const WriteCombineBuffer* buffer, int* out_values,
+                            size_t* out_positions) {
+  size_t line = buffer->offset - WC_ROWS;
+  if (line < buffer->start) {
+    wc_copy(buffer, line, buffer->start - line, WC_ROWS, out_values,
+            out_positions);
+    return;
+  }
+#ifdef __SSE2__
+  // line is a multiple of WC_ROWS and the outputs are cache line aligned
+  __m128i* positions = (__m128i*)&out_positions[line];
+  __m128i* values = (__m128i*)&out_values[line];
+  for (size_t k = 0; k < WC_ROWS * sizeof(size_t) / sizeof(__m128i); k++) {
+    _mm_stream_si128(&positions[k],
+                     _mm_load_si128((const __m128i*)buffer->positions + k));
+  }
+  for (size_t k = 0; k < WC_ROWS * sizeof(int) / sizeof(__m128i); k++) {
+    _mm_stream_si128(&values[k],
+                     _mm_load_si128((const __m128i*)buffer->values + k));
+  }
+#else
+  wc_copy(buffer, line, 0, WC_ROWS, out_values, out_positions);
+#endif
+}
+
+/*
+ * Scatters rows [start, end) to partitions on bits bits of the hash after
+ * the top skip, the next row of partition p going to offsets[p] of the
+ * output. Rows whose value is not in filter are dropped, unless it is NULL.
+ */
+static void scatter_rows(const int* values, const size_t* positions,
+                         size_t start, size_t end, const BloomFilter* filter,
+                         unsigned skip, unsigned bits, const size_t* offsets,
+                         int* out_values, size_t* out_positions) {
+  size_t fanout = (size_t)1 << bits;
+  WriteCombineBuffer* buffers =
+      aligned_alloc(CACHE_LINE, fanout * sizeof(WriteCombineBuffer));
+  for (size_t p = 0; p < fanout; p++) {
+    buffers[p].offset = offsets[p];
+    buffers[p].start = offsets[p];
+  }
+  for (size_t i = start; i < end; i++) {
+    if (filter != NULL && !bloom_contains(filter, values[i])) {
+      continue;
+    }
+    WriteCombineBuffer* buffer = &buffers[hash_bits(values[i], skip, bits)];
+    size_t slot = buffer->offset % WC_ROWS;
+    buffer->positions[slot] = positions[i];
+    buffer->values[slot] = values[i];
+    buffer->offset += 1;
+    if (slot == WC_ROWS - 1) {
+      wc_flush(buffer, out_values, out_positions);
+    }
+  }
+  // the last, partly filled, line of every partition
+  for (size_t p = 0; p < fanout; p++) {
+    size_t line = buffers[p].offset - buffers[p].offset % WC_ROWS;
+    size_t from = line < buffers[p].start ? buffers[p].start - line : 0;
+    wc_copy(&buffers[p], line, from, buffers[p].offset - line, out_values,
+            out_positions);
+  }
+#ifdef __SSE2__
+  _mm_sfence();
+#endif
+  free(buffers);
+}
+
+/*
+ * First pass, from the input into out. Morsel m counts its rows in partition
+ * p in histograms[m * fanout + p], which then becomes the offset in out of
+ * its first row in p.
+ */
+typedef struct PartitionArgs {
+  const int* values;
+  const size_t* positions;
+  const BloomFilter* filter;
+  int* out_values;
+  size_t* out_positions;
+  unsigned bits;
+  size_t fanout;
+  size_t* histograms;
+} PartitionArgs;
+
+/*
+ * Second pass over rows [start, end) of the first pass output, one partition
+ * of the first pass split on the next bits of the hash.
+ */
+typedef struct SubpartitionTask {
+  const int* values;
+  const size_t* positions;
+  int* out_values;
+  size_t* out_positions;
+  size_t start;
+  size_t end;
+  unsigned skip;
+  unsigned bits;
+  size_t* starts;
+} SubpartitionTask;
+
+static void histogram_morsel(void* arg, size_t morsel, size_t start,
+                             size_t end) {
+  PartitionArgs* args = (PartitionArgs*)arg;
+  const BloomFilter* filter = args->filter;
+  size_t* histogram = &args->histograms[morsel * args->fanout];
+  for (size_t i = start; i < end; i++) {
+    if (filter != NULL && !bloom_contains(filter, args->values[i])) {
+      continue;
+    }
+    histogram[hash_bits(args->values[i], 0, args->bits)] += 1;
+  }
+}
+
+static void scatter_morsel(void* arg, size_t morsel, size_t start,
+                           size_t end) {
+  PartitionArgs* args = (PartitionArgs*)arg;
+  scatter_rows(args->values, args->positions, start, end, args->filter, 0,
+               args->bits, &args->histograms[morsel * args->fanout],
+               args->out_values, args->out_positions);
+}
+
+static void* subpartition_task(void* task_arg) {
+  SubpartitionTask* task = (SubpartitionTask*)task_arg;
+  size_t fanout = (size_t)1 << task->bits;
+  size_t* counts = task->starts;
+  memset(counts, 0, fanout * sizeof(size_t));
+  for (size_t i = task->start; i < task->end; i++) {
+    counts[hash_bits(task->values[i], task->skip, task->bits)] += 1;
+  }
+  size_t offset = task->start;
+  for (size_t p = 0; p < fanout; p++) {
+    size_t count = counts[p];
+    task->starts[p] = offset;
+    offset += count;
+  }
+  scatter_rows(task->values, task->positions, task->start, task->end, NULL,
+               task->skip, task->bits, task->starts, task->out_values,
+               task->out_positions);
+  return NULL;
+}
+
+size_t radix_num_partitions(size_t build_length, size_t total_length) {
+  size_t min_parts = total_length > MORSEL_SIZE ? PARALLEL_JOIN_PARTITIONS : 1;
+  size_t num_parts = 1;
+  while (num_parts < RADIX_PASS_FANOUT * RADIX_PASS_FANOUT &&
+         (num_parts < min_parts ||
+          build_length > num_parts * JOIN_PARTITION_ROWS)) {
+    num_parts *= 2;
+  }
+  return num_parts;
+}
+
+void radix_partition(const int* values, const size_t* positions,
+                     size_t length, const BloomFilter* filter,
+                     size_t num_parts, RadixPartitions* parts) {
+  unsigned bits = (unsigned)__builtin_ctzl(num_parts);
+  unsigned first_bits = bits < RADIX_PASS_BITS ? bits : RADIX_PASS_BITS;
+  unsigned second_bits = bits - first_bits;
+  size_t fanout = (size_t)1 << first_bits;
+  size_t num_morsels = morsel_num(length);
+
+  PartitionArgs args = {
+      .values = values,
+      .positions = positions,
+      .filter = filter,
+      .bits = first_bits,
+      .fanout = fanout,
+      .histograms = calloc(num_morsels * fanout + 1, sizeof(size_t))};
+  morsel_run(length, &histogram_morsel, &args);
+
+  // partition major, morsel minor prefix sum so each partition's rows stay in
+  // input order
+  size_t* first_starts = malloc((fanout + 1) * sizeof(size_t));
+  size_t offset = 0;
+  for (size_t p = 0; p < fanout; p++) {
+    first_starts[p] = offset;
+    for (size_t m = 0; m < num_morsels; m++) {
+      size_t count = args.histograms[m * fanout + p];
+      args.histograms[m * fanout + p] = offset;
+      offset += count;
+    }
+  }
+  first_starts[fanout] = offset;
+
+  // offset is now the number of rows which passed the filter
+  parts->num_parts = num_parts;
+  parts->values = alloc_lines(offset * sizeof(int));
+  parts->positions = alloc_lines(offset * sizeof(size_t));
+  parts->starts = malloc((num_parts + 1) * sizeof(size_t));
+  parts->starts[num_parts] = offset;
+  args.out_values =
+      second_bits == 0 ? parts->values : alloc_lines(offset * sizeof(int));
+  args.out_positions = second_bits == 0 ? parts->positions
+                                        : alloc_lines(offset * sizeof(size_t));
+  morsel_run(length, &scatter_morsel, &args);
+  free(args.histograms);
+
+  if (second_bits == 0) {
+    for (size_t p = 0; p < fanout; p++) {
+      parts->starts[p] = first_starts[p];
+    }
+  } else {
+    SubpartitionTask* tasks = malloc(fanout * sizeof(SubpartitionTask));
+    TaskGroup group = {0};
+    for (size_t p = 0; p < fanout; p++) {
+      tasks[p] = (SubpartitionTask){
+          .values = args.out_values,
+          .positions = args.out_positions,
+          .out_values = parts->values,
+          .out_positions = parts->positions,
+          .start = first_starts[p],
+          .end = first_starts[p + 1],
+          .skip = first_bits,
+          .bits = second_bits,
+          .starts = &parts->starts[p << second_bits]};
+      threadpool_submit(g_pool, &group, &subpartition_task, &tasks[p]);
+    }
+    threadpool_wait(g_pool, &group);
+    free(tasks);
+    free(args.out_values);
+    free(args.out_positions);
+  }
+  free(first_starts);
+}
+
+void radix_partitions_free(RadixPartitions* parts) {
+  free(parts->values);
+  free(parts->positions);
+  free(parts->starts);
+}
+
+static int compare_ints(const void* a, const void* b) {
+  int left = *(const int*)a;
+  int right = *(const int*)b;
+  return (left > right) - (left < right);
+}
+
+/*
+ * Appends the heavy hitters of a sample of one side of a join to heavy.
+ */
+static size_t sample_heavy_hitters(const int* values, size_t length,
+                                   size_t num_parts, int* heavy,
+                                   size_t num_heavy) {
+  if (length == 0) {
+    return num_heavy;
+  }
+  size_t step = length / SKEW_SAMPLE_SIZE + 1;
+  int* sample = malloc((length / step + 1) * sizeof(int));
+  size_t sampled = 0;
+  for (size_t i = 0; i < length; i += step) {
+    sample[sampled++] = values[i];
+  }
+  qsort(sample, sampled, sizeof(int), &compare_ints);
+  size_t i = 0;
+  while (i < sampled) {
+    size_t run_end = i + 1;
+    while (run_end < sampled && sample[run_end] == sample[i]) {
+      run_end++;
+    }
+    size_t hits = run_end - i;
+    if (hits >= SKEW_MIN_SAMPLE_HITS &&
+        hits * num_parts > SKEW_HEAVY_FACTOR * sampled) {
+      heavy[num_heavy++] = sample[i];
+    }
+    i = run_end;
+  }
+  free(sample);
+  return num_heavy;
+}
+
+int* join_heavy_hitters(const int* left_values, size_t left_length,
+                        const int* right_values, size_t right_length,
+                        size_t num_parts, size_t* num_heavy) {
+  // each side has at most SKEW_SAMPLE_SIZE / SKEW_MIN_SAMPLE_HITS + 1
+  int* heavy =
+      malloc(2 * (SKEW_SAMPLE_SIZE / SKEW_MIN_SAMPLE_HITS + 1) * sizeof(int));
+  size_t n =
+      sample_heavy_hitters(left_values, left_length, num_parts, heavy, 0);
+  n = sample_heavy_hitters(right_values, right_length, num_parts, heavy, n);
+  if (n == 0) {
+    free(heavy);
+    *num_heavy = 0;
+    return NULL;
+  }
+  qsort(heavy, n, sizeof(int), &compare_ints);
+  *num_heavy = 0;
+  for (size_t k = 0; k < n; k++) {
+    if (*num_heavy == 0 || heavy[k] != heavy[*num_heavy - 1]) {
+      heavy[(*num_heavy)++] = heavy[k];
+    }
+  }
+  return heavy;
+}
+
+/*
+ * Morsel m counts its light rows in light_counts[m] and heavy rows in
+ * heavy_counts[m], which then become the offsets of its first rows in the
+ * outputs.
+ */
+typedef struct SplitHeavyArgs {
+  const int* values;
+  const size_t* positions;
+  const int* heavy;
+  size_t num_heavy;
+  size_t* light_counts;
+  size_t* heavy_counts;
+  JoinRows* light;
+  JoinRows* heavy_rows;
+} SplitHeavyArgs;
+
+static inline bool is_heavy(const SplitHeavyArgs* args, int value) {
+  size_t lo = 0;
+  size_t hi = args->num_heavy;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (args->heavy[mid] < value) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < args->num_heavy && args->heavy[lo] == value;
+}
+
+static void count_heavy_morsel(void* arg, size_t morsel, size_t start,
+                               size_t end) {
+  SplitHeavyArgs* args = (SplitHeavyArgs*)arg;
+  size_t heavy_count = 0;
+  for (size_t i = start; i < end; i++) {
+    heavy_count += is_heavy(args, args->values[i]);
+  }
+  args->heavy_counts[morsel] = heavy_count;
+  args->light_counts[morsel] = end - start - heavy_count;
+}
+
+static void split_heavy_morsel(void* arg, size_t morsel, size_t start,
+                               size_t end) {
+  SplitHeavyArgs* args = (SplitHeavyArgs*)arg;
+  size_t light_offset = args->light_counts[morsel];
+  size_t heavy_offset = args->heavy_counts[morsel];
+  for (size_t i = start; i < end; i++) {
+    JoinRows* out = args->light;
+    size_t* offset = &light_offset;
+    if (is_heavy(args, args->values[i])) {
+      out = args->heavy_rows;
+      offset = &heavy_offset;
+    }
+    out->values[*offset] = args->values[i];
+    out->positions[*offset] = args->positions[i];
+    *offset += 1;
+  }
+}
+
+static size_t prefix_sum(size_t* counts, size_t num_counts) {
+  size_t total = 0;
+  for (size_t m = 0; m < num_counts; m++) {
+    size_t count = counts[m];
+    counts[m] = total;
+    total += count;
+  }
+  return total;
+}
+
+void split_heavy_rows(const int* values, const size_t* positions,
+                      size_t length, const int* heavy, size_t num_heavy,
+                      JoinRows* light, JoinRows* heavy_rows) {
+  size_t num_morsels = morsel_num(length);
+  SplitHeavyArgs args = {.values = values,
+                         .positions = positions,
+                         .heavy = heavy,
+                         .num_heavy = num_heavy,
+                         .light_counts = malloc((num_morsels + 1) *
+                                                sizeof(size_t)),
+                         .heavy_counts = malloc((num_morsels + 1) *
+                                                sizeof(size_t)),
+                         .light = light,
+                         .heavy_rows = heavy_rows};
+  morsel_run(length, &count_heavy_morsel, &args);
+  light->length = prefix_sum(args.light_counts, num_morsels);
+  heavy_rows->length = prefix_sum(args.heavy_counts, num_morsels);
+  light->values = malloc((light->length + 1) * sizeof(int));
+  light->positions = malloc((light->length + 1) * sizeof(size_t));
+  heavy_rows->values = malloc((heavy_rows->length + 1) * sizeof(int));
+  heavy_rows->positions = malloc((heavy_rows->length + 1) * sizeof(size_t));
+  morsel_run(length, &split_heavy_morsel, &args);
+  free(args.light_counts);
+  free(args.heavy_counts);
+}
+
+void join_rows_free(JoinRows* rows) {
+  free(rows->values);
+  free(rows->positions);
+}
@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -17,6 +18,7 @@
 
 #include "common.h"
 #include "db_index.h"
+#include "db_zonemap.h"
 #include "main_api.h"
 #include "message.h"
 #include "parse.h"
@@ -24,6 +26,30 @@
 
 extern Db* g_db;
 
+/*
+ * Written at the start of the catalogue. The catalogue holds raw Db, Table
+ * and Column structs, so it can only be read by a build whose structs have
+ * the same sizes. Catalogues written before the header have no magic.
+ */
+typedef struct CatalogueHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t db_size;
+  uint32_t table_size;
+  uint32_t column_size;
+} CatalogueHeader;
+
+#define CATALOGUE_MAGIC 0x4244434e  // "NCDB"
+#define CATALOGUE_VERSION 1
+
+static CatalogueHeader catalogue_header(void) {
+  return (CatalogueHeader){.magic = CATALOGUE_MAGIC,
+                           .version = CATALOGUE_VERSION,
+                           .db_size = sizeof(Db),
+                           .table_size = sizeof(Table),
+                           .column_size = sizeof(Column)};
+}
+
 bool startup_db() {
   // Make the data directory, checking if it already exists
   if (mkdir(DATA_PATH, S_IRUSR | S_IWUSR) < 0) {
@@ -49,6 +75,17 @@ bool startup_db() {
     log_info("Attempting to load catalogue file\n");
   }
 
+  CatalogueHeader header;
+  CatalogueHeader expected = catalogue_header();
+  if (fread(&header, sizeof(CatalogueHeader), 1, cat_file) < 1 ||
+      memcmp(&header, &expected, sizeof(CatalogueHeader)) != 0) {
+    log_err("Catalogue %s was written by an incompatible version, remove %s "
+            "and load the data again\n",
+            cat_file_path, DATA_PATH);
+    fclose(cat_file);
+    return false;
+  }
+
   g_db = calloc(1, sizeof(Db));
   int read_bytes = fread(g_db, sizeof(Db), 1, cat_file);
   if (ferror(cat_file)) {
@@ -80,6 +117,7 @@ bool startup_db() {
                        current_table->table_alloc_size, current_table->name);
       current_table->columns[j].num_rows = &current_table->table_length;
       load_index(&current_table->columns[j], current_table->name);
+      load_zonemap(&current_table->columns[j], current_table->name);
       current_table->columns[j].update_struct.alloc_size = UPDATE_BATCH_SIZE;
       current_table->columns[j].update_struct.del_pos =
           malloc(sizeof(size_t) * UPDATE_BATCH_SIZE);
@@ -91,6 +129,10 @@ bool startup_db() {
       current_table->columns[j].update_struct.ins_length = 0;
     }
     g_db->tables[i] = *current_table;
+    // num_rows has to point at the table in g_db, current_table is reused
+    for (size_t j = 0; j < num_columns_to_read; j++) {
+      g_db->tables[i].columns[j].num_rows = &g_db->tables[i].table_length;
+    }
   }
   fclose(cat_file);
   return true;
@@ -99,8 +141,9 @@ bool startup_db() {
 /*
  * This function write the database to disk. This happens in two parts. First we
  * write the db, tb and column structs to catalogue.cat This is in the format
- * [db][tb1][tb1.cola][tb1.colb][tb2][tb2.cola], i.e the db struct followed by
- * each table and all of that tables associated columns. This is done because
+ * [header][db][tb1][tb1.cola][tb1.colb][tb2][tb2.cola], i.e a CatalogueHeader,
+ * the db struct followed by each table and all of that tables associated
+ * columns. This is done because
  * while reading we first find how many tables there are and then for each table
  * we find how many columns follow it before the next table. should I also free
  * memory here? yeah probs
@@ -120,6 +163,8 @@ bool write_db() {
   // possible to start the program and quit without creating a db and that
   // shouldn't fail
   assert(g_db != NULL);
+  CatalogueHeader header = catalogue_header();
+  fwrite(&header, sizeof(CatalogueHeader), 1, cat_file);
   fwrite(g_db, sizeof(Db), 1, cat_file);
 
   size_t num_tables_to_write = g_db->tables_size;
@@ -142,6 +187,8 @@ bool write_db() {
       if (current_table->columns[j].index_type != NONE) {
         save_index(&current_table->columns[j], current_table->name);
       }
+      save_zonemap(&current_table->columns[j], current_table->name);
+      zonemap_free(current_table->columns[j].zonemap);
       fwrite(&current_table->columns[j], sizeof(Column), 1, cat_file);
     }
     free(current_table->columns);
@@ -250,7 +297,7 @@ bool load_btree_index(Column* column, FILE* in_file) {
   // size of the file.
   BNode** all_node_ptrs = malloc(sizeof(BNode*) * num_nodes);
 
-  BNode* root = malloc(sizeof(BNode));
+  BNode* root = bnode_allocate(false);
   if (fread(root, sizeof(BNode), 1, in_file) < 1) {
     log_err("%s:%d Failed to read head of btree %d %s \n", __FILE__, __LINE__,
             errno, strerror(errno));
@@ -292,7 +339,7 @@ bool load_btree_index(Column* column, FILE* in_file) {
       // printf("ptrs_in_node %ld \n", ptrs_in_node );
 
       for (size_t i = 0; i < ptrs_in_node; i++) {
-        BNode* in_node = malloc(sizeof(BNode));
+        BNode* in_node = bnode_allocate(false);
         read_nodes += fread(in_node, sizeof(BNode), 1, in_file);
         curr_node->children.child_pointers[i] = in_node;
         all_node_ptrs[seen_nodes] = in_node;
@@ -380,4 +427,77 @@ bool load_index(Column* column, char* table_name) {
     return res;
   }
   return false;
-}
\ No newline at end of file
+}
+
+/*
+ * Zone maps are written to <column>.zmap as the number of blocks followed by
+ * the block minimums and then the block maximums.
+ */
+bool save_zonemap(Column* column, char* table_name) {
+  ZoneMap* zonemap = column->zonemap;
+  if (zonemap == NULL) {
+    return true;
+  }
+  int path_length =
+      LEN_DATA_PATH + strlen(table_name) + strlen(column->name) + 5 + 2;
+  char zonemap_path[path_length];
+  sprintf(zonemap_path, "%s%s/%s%s", DATA_PATH, table_name, column->name,
+          ".zmap");
+  FILE* zonemap_file = fopen(zonemap_path, "w");
+  if (zonemap_file == NULL) {
+    log_err("%s:%d Failed to open zone map %s, errno %d, %s \n", __FILE__,
+            __LINE__, zonemap_path, errno, strerror(errno));
+    return false;
+  }
+  fwrite(&zonemap->num_blocks, sizeof(size_t), 1, zonemap_file);
+  fwrite(zonemap->mins, sizeof(int), zonemap->num_blocks, zonemap_file);
+  fwrite(zonemap->maxs, sizeof(int), zonemap->num_blocks, zonemap_file);
+  fclose(zonemap_file);
+  return true;
+}
+
+/*
+ * The zone map is rebuilt from the column data if the file is missing or does
+ * not cover the column.
+ * Needs column->data and column->num_rows to be set up.
+ */
+bool load_zonemap(Column* column, char* table_name) {
+  column->zonemap = zonemap_create();
+  if (column->zonemap == NULL) {
+    return false;
+  }
+  int path_length =
+      LEN_DATA_PATH + strlen(table_name) + strlen(column->name) + 5 + 2;
+  char zonemap_path[path_length];
+  sprintf(zonemap_path, "%s%s/%s%s", DATA_PATH, table_name, column->name,
+          ".zmap");
+  FILE* zonemap_file = fopen(zonemap_path, "r");
+  size_t num_blocks = 0;
+  if (zonemap_file == NULL ||
+      fread(&num_blocks, sizeof(size_t), 1, zonemap_file) < 1 ||
+      num_blocks != zonemap_num_blocks(*column->num_rows)) {
+    log_info("Rebuilding zone map for column %s\n", column->name);
+    if (zonemap_file != NULL) {
+      fclose(zonemap_file);
+    }
+    zonemap_rebuild(column, 0);
+    return true;
+  }
+  ZoneMap* zonemap = column->zonemap;
+  zonemap->mins = malloc(sizeof(int) * (num_blocks + 1));
+  zonemap->maxs = malloc(sizeof(int) * (num_blocks + 1));
+  zonemap->alloc_blocks = num_blocks + 1;
+  if (fread(zonemap->mins, sizeof(int), num_blocks, zonemap_file) <
+          num_blocks ||
+      fread(zonemap->maxs, sizeof(int), num_blocks, zonemap_file) <
+          num_blocks) {
+    log_err("%s:%d Failed to read zone map for %s, rebuilding\n", __FILE__,
+            __LINE__, column->name);
+    fclose(zonemap_file);
+    zonemap_rebuild(column, 0);
+    return true;
+  }
+  zonemap->num_blocks = num_blocks;
+  fclose(zonemap_file);
+  return true;
+}
@@ -0,0 +1,509 @@
+#include "db_scan.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+typedef size_t (*ScanSelectFunc)(const int*, const size_t*, size_t, size_t, int,
+                                 int, size_t*);
+typedef size_t (*ScanBitvectorFunc)(const int*, size_t, int, int, uint64_t*);
+typedef void (*ScanSelectAggregateFunc)(const int*, const int*, size_t, int,
+                                        int, ScanAggregate*);
+typedef void (*ScanAggregateFunc)(const int*, size_t, ScanAggregate*);
+
+/*
+ * The tight branchless loop from the README, always writes the candidate
+ * position and only moves j forward if the predicate matched.
+ */
+static size_t scan_select_scalar(const int* data, const size_t* positions_in,
+                                 size_t position_offset, size_t num_rows,
+                                 int min_val, int max_val, size_t* result) {
+  size_t j = 0;
+  if (positions_in == NULL) {
+    for (size_t i = 0; i < num_rows; i++) {
+      result[j] = position_offset + i;
+      j += ((data[i] >= min_val) & (data[i] < max_val));
+    }
+  } else {
+    for (size_t i = 0; i < num_rows; i++) {
+      result[j] = positions_in[i];
+      j += ((data[i] >= min_val) & (data[i] < max_val));
+    }
+  }
+  return j;
+}
+
+/*
+ * Packs up to 64 comparisons into one word, the compiler is left to vectorise
+ * the inner loop.
+ */
+static size_t scan_bitvector_scalar(const int* data, size_t num_rows,
+                                    int min_val, int max_val, uint64_t* words) {
+  size_t count = 0;
+  for (size_t i = 0; i < num_rows; i += 64) {
+    size_t rows_in_word = num_rows - i < 64 ? num_rows - i : 64;
+    uint64_t word = 0;
+    for (size_t b = 0; b < rows_in_word; b++) {
+      word |= (uint64_t)((data[i + b] >= min_val) & (data[i + b] < max_val))
+              << b;
+    }
+    words[i / 64] = word;
+    count += __builtin_popcountll(word);
+  }
+  return count;
+}
+
+/*
+ * Branchless, rows which do not match contribute 0 to the sum and the
+ * identity to min and max.
+ */
+static void scan_select_aggregate_scalar(const int* keys,
+                                         const int* values, size_t num_rows,
+                                         int min_val, int max_val,
+                                         ScanAggregate* agg) {
+  size_t count = 0;
+  long sum = 0;
+  int min = agg->min;
+  int max = agg->max;
+  for (size_t i = 0; i < num_rows; i++) {
+    int match = (keys[i] >= min_val) & (keys[i] < max_val);
+    count += match;
+    sum += match ? values[i] : 0;
+    min = match && values[i] < min ? values[i] : min;
+    max = match && values[i] > max ? values[i] : max;
+  }
+  agg->count += count;
+  agg->sum += sum;
+  agg->min = min;
+  agg->max = max;
+}
+
+static void scan_aggregate_scalar(const int* values, size_t num_rows,
+                                  ScanAggregate* agg) {
+  long sum = 0;
+  int min = agg->min;
+  int max = agg->max;
+  for (size_t i = 0; i < num_rows; i++) {
+    sum += values[i];
+    min = values[i] < min ? values[i] : min;
+    max = values[i] > max ? values[i] : max;
+  }
+  agg->count += num_rows;
+  agg->sum += sum;
+  agg->min = min;
+  agg->max = max;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * permutevar8x32 indices that move the 64 bit lanes selected by a 4 bit mask
+ * to the front of a 256 bit register. Filled in once by init_scan_kernels.
+ */
+static uint32_t avx2_compact_lut[16][8] __attribute__((aligned(32)));
+
+static void build_avx2_compact_lut(void) {
+  for (uint32_t mask = 0; mask < 16; mask++) {
+    uint32_t k = 0;
+    for (uint32_t lane = 0; lane < 4; lane++) {
+      if (mask & (1u << lane)) {
+        avx2_compact_lut[mask][2 * k] = 2 * lane;
+        avx2_compact_lut[mask][2 * k + 1] = 2 * lane + 1;
+        k++;
+      }
+    }
+    for (; k < 4; k++) {
+      avx2_compact_lut[mask][2 * k] = 0;
+      avx2_compact_lut[mask][2 * k + 1] = 1;
+    }
+  }
+}
+
+/*
+ * 8 ints per comparison. The 8 bit mask is split into two nibbles, each of
+ * which compacts 4 positions (64 bit lanes) with a single permute.
+ */
+__attribute__((target("avx2,popcnt"))) static size_t scan_select_avx2(
+    const int* data, const size_t* positions_in, size_t position_offset,
+    size_t num_rows, int min_val, int max_val, size_t* result) {
+  const __m256i lo = _mm256_set1_epi32(min_val);
+  const __m256i hi = _mm256_set1_epi32(max_val);
+  const __m256i iota = _mm256_set_epi64x(3, 2, 1, 0);
+  size_t j = 0;
+  size_t i = 0;
+  for (; i + 8 <= num_rows; i += 8) {
+    __m256i vals = _mm256_loadu_si256((const __m256i*)&data[i]);
+    // min_val <= v is !(min_val > v)
+    __m256i match = _mm256_andnot_si256(_mm256_cmpgt_epi32(lo, vals),
+                                        _mm256_cmpgt_epi32(hi, vals));
+    unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(match));
+    __m256i pos_low, pos_high;
+    if (positions_in == NULL) {
+      pos_low = _mm256_add_epi64(
+          iota, _mm256_set1_epi64x((long long)(position_offset + i)));
+      pos_high = _mm256_add_epi64(
+          iota, _mm256_set1_epi64x((long long)(position_offset + i + 4)));
+    } else {
+      pos_low = _mm256_loadu_si256((const __m256i*)&positions_in[i]);
+      pos_high = _mm256_loadu_si256((const __m256i*)&positions_in[i + 4]);
+    }
+    unsigned low_mask = mask & 0xf;
+    unsigned high_mask = mask >> 4;
+    _mm256_storeu_si256(
+        (__m256i*)&result[j],
+        _mm256_permutevar8x32_epi32(
+            pos_low, _mm256_load_si256((const __m256i*)avx2_compact_lut[low_mask])));
+    j += __builtin_popcount(low_mask);
+    _mm256_storeu_si256(
+        (__m256i*)&result[j],
+        _mm256_permutevar8x32_epi32(
+            pos_high,
+            _mm256_load_si256((const __m256i*)avx2_compact_lut[high_mask])));
+    j += __builtin_popcount(high_mask);
+  }
+  return j + scan_select_scalar(&data[i],
+                                positions_in == NULL ? NULL : &positions_in[i],
+                                position_offset + i, num_rows - i, min_val,
+                                max_val, &result[j]);
+}
+
+/*
+ * 16 ints per comparison. Positions are 64 bit so each half of the 16 bit mask
+ * compresses 8 positions.
+ */
+__attribute__((target("avx512f,popcnt"))) static size_t scan_select_avx512(
+    const int* data, const size_t* positions_in, size_t position_offset,
+    size_t num_rows, int min_val, int max_val, size_t* result) {
+  const __m512i lo = _mm512_set1_epi32(min_val);
+  const __m512i hi = _mm512_set1_epi32(max_val);
+  const __m512i iota = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+  size_t j = 0;
+  size_t i = 0;
+  for (; i + 16 <= num_rows; i += 16) {
+    __m512i vals = _mm512_loadu_si512((const void*)&data[i]);
+    __mmask16 mask =
+        _mm512_mask_cmplt_epi32_mask(_mm512_cmpge_epi32_mask(vals, lo), vals, hi);
+    __m512i pos_low, pos_high;
+    if (positions_in == NULL) {
+      pos_low = _mm512_add_epi64(
+          iota, _mm512_set1_epi64((long long)(position_offset + i)));
+      pos_high = _mm512_add_epi64(
+          iota, _mm512_set1_epi64((long long)(position_offset + i + 8)));
+    } else {
+      pos_low = _mm512_loadu_si512((const void*)&positions_in[i]);
+      pos_high = _mm512_loadu_si512((const void*)&positions_in[i + 8]);
+    }
+    __mmask8 low_mask = (__mmask8)(mask & 0xff);
+    __mmask8 high_mask = (__mmask8)(mask >> 8);
+    // compress in register and do a full store, compressstoreu is microcoded
+    // on some cores
+    _mm512_storeu_si512((void*)&result[j],
+                        _mm512_maskz_compress_epi64(low_mask, pos_low));
+    j += __builtin_popcount(low_mask);
+    _mm512_storeu_si512((void*)&result[j],
+                        _mm512_maskz_compress_epi64(high_mask, pos_high));
+    j += __builtin_popcount(high_mask);
+  }
+  return j + scan_select_scalar(&data[i],
+                                positions_in == NULL ? NULL : &positions_in[i],
+                                position_offset + i, num_rows - i, min_val,
+                                max_val, &result[j]);
+}
+
+/*
+ * One word of the bitvector is built from 8 movemasks of 8 comparisons.
+ */
+__attribute__((target("avx2,popcnt"))) static size_t scan_bitvector_avx2(
+    const int* data, size_t num_rows, int min_val, int max_val,
+    uint64_t* words) {
+  const __m256i lo = _mm256_set1_epi32(min_val);
+  const __m256i hi = _mm256_set1_epi32(max_val);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 64 <= num_rows; i += 64) {
+    uint64_t word = 0;
+    for (size_t b = 0; b < 64; b += 8) {
+      __m256i vals = _mm256_loadu_si256((const __m256i*)&data[i + b]);
+      __m256i match = _mm256_andnot_si256(_mm256_cmpgt_epi32(lo, vals),
+                                          _mm256_cmpgt_epi32(hi, vals));
+      word |= (uint64_t)(unsigned)_mm256_movemask_ps(
+                  _mm256_castsi256_ps(match))
+              << b;
+    }
+    words[i / 64] = word;
+    count += __builtin_popcountll(word);
+  }
+  return count + scan_bitvector_scalar(&data[i], num_rows - i, min_val,
+                                       max_val, &words[i / 64]);
+}
+
+/*
+ * One word of the bitvector is built from 4 comparison masks of 16 ints.
+ */
+__attribute__((target("avx512f,popcnt"))) static size_t scan_bitvector_avx512(
+    const int* data, size_t num_rows, int min_val, int max_val,
+    uint64_t* words) {
+  const __m512i lo = _mm512_set1_epi32(min_val);
+  const __m512i hi = _mm512_set1_epi32(max_val);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 64 <= num_rows; i += 64) {
+    uint64_t word = 0;
+    for (size_t b = 0; b < 64; b += 16) {
+      __m512i vals = _mm512_loadu_si512((const void*)&data[i + b]);
+      __mmask16 mask = _mm512_mask_cmplt_epi32_mask(
+          _mm512_cmpge_epi32_mask(vals, lo), vals, hi);
+      word |= (uint64_t)mask << b;
+    }
+    words[i / 64] = word;
+    count += __builtin_popcountll(word);
+  }
+  return count + scan_bitvector_scalar(&data[i], num_rows - i, min_val,
+                                       max_val, &words[i / 64]);
+}
+
+/*
+ * Adds 4 lanes of 64 bit sums and 8 lanes of mins and maxs to agg.
+ */
+__attribute__((target("avx2"))) static inline void reduce_aggregate_avx2(
+    __m256i sums, __m256i mins, __m256i maxs, ScanAggregate* agg) {
+  long sum_lanes[4];
+  int min_lanes[8];
+  int max_lanes[8];
+  _mm256_storeu_si256((__m256i*)sum_lanes, sums);
+  _mm256_storeu_si256((__m256i*)min_lanes, mins);
+  _mm256_storeu_si256((__m256i*)max_lanes, maxs);
+  agg->sum += sum_lanes[0] + sum_lanes[1] + sum_lanes[2] + sum_lanes[3];
+  for (size_t l = 0; l < 8; l++) {
+    agg->min = min_lanes[l] < agg->min ? min_lanes[l] : agg->min;
+    agg->max = max_lanes[l] > agg->max ? max_lanes[l] : agg->max;
+  }
+}
+
+/*
+ * 8 rows per comparison. Matching values are widened to 64 bits before they
+ * are summed, rows which do not match are blended to the identity for min and
+ * max.
+ */
+__attribute__((target("avx2,popcnt"))) static void
+scan_select_aggregate_avx2(const int* keys, const int* values,
+                           size_t num_rows, int min_val, int max_val,
+                           ScanAggregate* agg) {
+  const __m256i lo = _mm256_set1_epi32(min_val);
+  const __m256i hi = _mm256_set1_epi32(max_val);
+  const __m256i int_max = _mm256_set1_epi32(INT32_MAX);
+  const __m256i int_min = _mm256_set1_epi32(INT32_MIN);
+  __m256i sums = _mm256_setzero_si256();
+  __m256i mins = _mm256_set1_epi32(agg->min);
+  __m256i maxs = _mm256_set1_epi32(agg->max);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= num_rows; i += 8) {
+    __m256i k = _mm256_loadu_si256((const __m256i*)&keys[i]);
+    __m256i v = _mm256_loadu_si256((const __m256i*)&values[i]);
+    __m256i match = _mm256_andnot_si256(_mm256_cmpgt_epi32(lo, k),
+                                        _mm256_cmpgt_epi32(hi, k));
+    count += __builtin_popcount(
+        (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(match)));
+    __m256i matched = _mm256_and_si256(v, match);
+    sums = _mm256_add_epi64(
+        sums, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(matched)));
+    sums = _mm256_add_epi64(
+        sums, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(matched, 1)));
+    mins = _mm256_min_epi32(mins, _mm256_blendv_epi8(int_max, v, match));
+    maxs = _mm256_max_epi32(maxs, _mm256_blendv_epi8(int_min, v, match));
+  }
+  agg->count += count;
+  reduce_aggregate_avx2(sums, mins, maxs, agg);
+  scan_select_aggregate_scalar(&keys[i], &values[i], num_rows - i, min_val,
+                               max_val, agg);
+}
+
+/*
+ * 16 rows per comparison, the comparison mask drives masked min, max and
+ * zeroing moves directly.
+ */
+__attribute__((target("avx512f,popcnt"))) static void
+scan_select_aggregate_avx512(const int* keys, const int* values,
+                             size_t num_rows, int min_val, int max_val,
+                             ScanAggregate* agg) {
+  const __m512i lo = _mm512_set1_epi32(min_val);
+  const __m512i hi = _mm512_set1_epi32(max_val);
+  __m512i sums = _mm512_setzero_si512();
+  __m512i mins = _mm512_set1_epi32(agg->min);
+  __m512i maxs = _mm512_set1_epi32(agg->max);
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 16 <= num_rows; i += 16) {
+    __m512i k = _mm512_loadu_si512((const void*)&keys[i]);
+    __m512i v = _mm512_loadu_si512((const void*)&values[i]);
+    __mmask16 match =
+        _mm512_mask_cmplt_epi32_mask(_mm512_cmpge_epi32_mask(k, lo), k, hi);
+    count += __builtin_popcount(match);
+    __m512i matched = _mm512_maskz_mov_epi32(match, v);
+    sums = _mm512_add_epi64(
+        sums, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(matched)));
+    sums = _mm512_add_epi64(
+        sums, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(matched, 1)));
+    mins = _mm512_mask_min_epi32(mins, match, mins, v);
+    maxs = _mm512_mask_max_epi32(maxs, match, maxs, v);
+  }
+  agg->count += count;
+  agg->sum += _mm512_reduce_add_epi64(sums);
+  int min = _mm512_reduce_min_epi32(mins);
+  int max = _mm512_reduce_max_epi32(maxs);
+  agg->min = min < agg->min ? min : agg->min;
+  agg->max = max > agg->max ? max : agg->max;
+  scan_select_aggregate_scalar(&keys[i], &values[i], num_rows - i, min_val,
+                               max_val, agg);
+}
+
+/*
+ * 16 values per iteration in two independent sets of accumulators, so
+ * consecutive adds do not wait on each other. Values are widened to 64 bits
+ * before they are summed so the sum cannot overflow.
+ */
+__attribute__((target("avx2"))) static void scan_aggregate_avx2(
+    const int* values, size_t num_rows, ScanAggregate* agg) {
+  __m256i sums0 = _mm256_setzero_si256();
+  __m256i sums1 = _mm256_setzero_si256();
+  __m256i mins0 = _mm256_set1_epi32(agg->min);
+  __m256i mins1 = mins0;
+  __m256i maxs0 = _mm256_set1_epi32(agg->max);
+  __m256i maxs1 = maxs0;
+  size_t i = 0;
+  for (; i + 16 <= num_rows; i += 16) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i*)&values[i]);
+    __m256i v1 = _mm256_loadu_si256((const __m256i*)&values[i + 8]);
+    sums0 = _mm256_add_epi64(sums0,
+                             _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v0)));
+    sums1 = _mm256_add_epi64(
+        sums1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v0, 1)));
+    sums0 = _mm256_add_epi64(sums0,
+                             _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v1)));
+    sums1 = _mm256_add_epi64(
+        sums1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v1, 1)));
+    mins0 = _mm256_min_epi32(mins0, v0);
+    mins1 = _mm256_min_epi32(mins1, v1);
+    maxs0 = _mm256_max_epi32(maxs0, v0);
+    maxs1 = _mm256_max_epi32(maxs1, v1);
+  }
+  agg->count += i;
+  reduce_aggregate_avx2(_mm256_add_epi64(sums0, sums1),
+                        _mm256_min_epi32(mins0, mins1),
+                        _mm256_max_epi32(maxs0, maxs1), agg);
+  scan_aggregate_scalar(&values[i], num_rows - i, agg);
+}
+
+__attribute__((target("avx512f"))) static void scan_aggregate_avx512(
+    const int* values, size_t num_rows, ScanAggregate* agg) {
+  __m512i sums0 = _mm512_setzero_si512();
+  __m512i sums1 = _mm512_setzero_si512();
+  __m512i mins = _mm512_set1_epi32(agg->min);
+  __m512i maxs = _mm512_set1_epi32(agg->max);
+  size_t i = 0;
+  for (; i + 16 <= num_rows; i += 16) {
+    __m512i v = _mm512_loadu_si512((const void*)&values[i]);
+    sums0 = _mm512_add_epi64(sums0,
+                             _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+    sums1 = _mm512_add_epi64(
+        sums1, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+    mins = _mm512_min_epi32(mins, v);
+    maxs = _mm512_max_epi32(maxs, v);
+  }
+  agg->count += i;
+  agg->sum += _mm512_reduce_add_epi64(_mm512_add_epi64(sums0, sums1));
+  agg->min = _mm512_reduce_min_epi32(mins);
+  agg->max = _mm512_reduce_max_epi32(maxs);
+  scan_aggregate_scalar(&values[i], num_rows - i, agg);
+}
+
+#endif
+
+static ScanSelectFunc scan_select_impl = &scan_select_scalar;
+static ScanBitvectorFunc scan_bitvector_impl = &scan_bitvector_scalar;
+static ScanSelectAggregateFunc scan_select_aggregate_impl =
+    &scan_select_aggregate_scalar;
+static ScanAggregateFunc scan_aggregate_impl = &scan_aggregate_scalar;
+static pthread_once_t scan_kernels_once = PTHREAD_ONCE_INIT;
+
+static void init_scan_kernels(void) {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    scan_select_impl = &scan_select_avx512;
+    scan_bitvector_impl = &scan_bitvector_avx512;
+    scan_select_aggregate_impl = &scan_select_aggregate_avx512;
+    scan_aggregate_impl = &scan_aggregate_avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    build_avx2_compact_lut();
+    scan_select_impl = &scan_select_avx2;
+    scan_bitvector_impl = &scan_bitvector_avx2;
+    scan_select_aggregate_impl = &scan_select_aggregate_avx2;
+    scan_aggregate_impl = &scan_aggregate_avx2;
+  }
+#endif
+}
+
+size_t scan_select_range(const int* data, const size_t* positions_in,
+                         size_t position_offset, size_t num_rows, int min_val,
+                         int max_val, size_t* result) {
+  pthread_once(&scan_kernels_once, &init_scan_kernels);
+  return scan_select_impl(data, positions_in, position_offset, num_rows,
+                          min_val, max_val, result);
+}
+
+size_t scan_select_bitvector(const int* data, size_t num_rows, int min_val,
+                             int max_val, uint64_t* words) {
+  pthread_once(&scan_kernels_once, &init_scan_kernels);
+  return scan_bitvector_impl(data, num_rows, min_val, max_val, words);
+}
+
+void scan_select_aggregate(const int* keys, const int* values, size_t num_rows,
+                           int min_val, int max_val, ScanAggregate* agg) {
+  pthread_once(&scan_kernels_once, &init_scan_kernels);
+  scan_select_aggregate_impl(keys, values, num_rows, min_val, max_val, agg);
+}
+
+void scan_aggregate(const int* values, size_t num_rows, ScanAggregate* agg) {
+  pthread_once(&scan_kernels_once, &init_scan_kernels);
+  scan_aggregate_impl(values, num_rows, agg);
+}
+
+/*
+ * Rows per tile of a shared scan, 8KB of ints so the tile stays in L1 while
+ * every query is evaluated over it.
+ */
+#define SHARED_SCAN_TILE 2048
+
+void scan_select_shared(const int* data, size_t position_offset,
+                        size_t num_rows, const int* lows, const int* highs,
+                        size_t num_queries, size_t** positions,
+                        size_t* counts) {
+  uint64_t masks[SHARED_SCAN_TILE / 64];
+  for (size_t start = 0; start < num_rows; start += SHARED_SCAN_TILE) {
+    size_t tile_rows = num_rows - start < SHARED_SCAN_TILE ? num_rows - start
+                                                           : SHARED_SCAN_TILE;
+    for (size_t q = 0; q < num_queries; q++) {
+      if (scan_select_bitvector(&data[start], tile_rows, lows[q], highs[q],
+                                masks) == 0) {
+        continue;
+      }
+      // compact the mask of this query into its positions
+      size_t* out = positions[q];
+      size_t j = counts[q];
+      for (size_t w = 0; w < (tile_rows + 63) / 64; w++) {
+        uint64_t word = masks[w];
+        while (word != 0) {
+          out[j++] = position_offset + start + w * 64 + __builtin_ctzll(word);
+          word &= word - 1;
+        }
+      }
+      counts[q] = j;
+    }
+  }
+}
@@ -0,0 +1,191 @@
+#include "db_sort.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "db_morsel.h"
+#include "db_threadpool.h"
+
+#define RADIX_DIGIT_BITS 8
+#define RADIX_DIGITS (1 << RADIX_DIGIT_BITS)
+
+typedef struct SortedMorselArgs {
+  const int* values;
+  bool* unsorted;
+} SortedMorselArgs;
+
+static void sorted_morsel(void* arg, size_t morsel, size_t start, size_t end) {
+  SortedMorselArgs* args = (SortedMorselArgs*)arg;
+  // also compare with the last value of the morsel before
+  size_t i = start == 0 ? 1 : start;
+  bool unsorted = false;
+  for (; i < end; i++) {
+    unsorted |= args->values[i - 1] > args->values[i];
+  }
+  args->unsorted[morsel] = unsorted;
+}
+
+bool ints_sorted(const int* values, size_t num_values) {
+  bool* unsorted = calloc(morsel_num(num_values) + 1, sizeof(bool));
+  SortedMorselArgs args = {.values = values, .unsorted = unsorted};
+  morsel_run(num_values, &sorted_morsel, &args);
+  bool sorted = true;
+  for (size_t m = 0; m < morsel_num(num_values); m++) {
+    sorted &= !unsorted[m];
+  }
+  free(unsorted);
+  return sorted;
+}
+
+/*
+ * Rows move back and forth between the buffers and the tmp buffers.
+ */
+typedef struct SortArgs {
+  int* values;
+  size_t* positions;
+  int* tmp_values;
+  size_t* tmp_positions;
+  size_t num_values;
+  // width in rows of the runs being merged
+  size_t run_width;
+} SortArgs;
+
+// flipping the sign bit orders ints as unsigned keys
+static inline size_t radix_digit(int value, unsigned shift) {
+  return (((uint32_t)value ^ 0x80000000u) >> shift) & (RADIX_DIGITS - 1);
+}
+
+/*
+ * Stable LSD radix sort of rows [start, end), the sorted rows end up back in
+ * values and positions. A pass is skipped if all rows share its digit.
+ */
+static void radix_sort_morsel(void* arg, size_t morsel, size_t start,
+                              size_t end) {
+  (void)morsel;
+  SortArgs* args = (SortArgs*)arg;
+  int* values = &args->values[start];
+  size_t* positions = &args->positions[start];
+  int* tmp_values = &args->tmp_values[start];
+  size_t* tmp_positions = &args->tmp_positions[start];
+  size_t n = end - start;
+  size_t counts[RADIX_DIGITS];
+  for (unsigned shift = 0; shift < 32; shift += RADIX_DIGIT_BITS) {
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++) {
+      counts[radix_digit(values[i], shift)] += 1;
+    }
+    if (counts[radix_digit(values[0], shift)] == n) {
+      continue;
+    }
+    size_t offset = 0;
+    for (size_t d = 0; d < RADIX_DIGITS; d++) {
+      size_t count = counts[d];
+      counts[d] = offset;
+      offset += count;
+    }
+    for (size_t i = 0; i < n; i++) {
+      size_t dest = counts[radix_digit(values[i], shift)]++;
+      tmp_values[dest] = values[i];
+      tmp_positions[dest] = positions[i];
+    }
+    int* swap_values = values;
+    values = tmp_values;
+    tmp_values = swap_values;
+    size_t* swap_positions = positions;
+    positions = tmp_positions;
+    tmp_positions = swap_positions;
+  }
+  // an odd number of passes leaves the rows in the tmp buffers
+  if (values != &args->values[start]) {
+    memcpy(tmp_values, values, n * sizeof(int));
+    memcpy(tmp_positions, positions, n * sizeof(size_t));
+  }
+}
+
+/*
+ * Number of rows of a among the first d rows of the stable merge of a and b,
+ * rows of a going first among equal values.
+ */
+static size_t merge_path(const int* a, size_t a_len, const int* b,
+                         size_t b_len, size_t d) {
+  size_t lo = d > b_len ? d - b_len : 0;
+  size_t hi = d < a_len ? d : a_len;
+  while (true) {
+    size_t i = lo + (hi - lo) / 2;
+    size_t j = d - i;
+    if (i > 0 && j < b_len && a[i - 1] > b[j]) {
+      hi = i - 1;
+    } else if (j > 0 && i < a_len && b[j - 1] >= a[i]) {
+      lo = i + 1;
+    } else {
+      return i;
+    }
+  }
+}
+
+/*
+ * Output morsel of a merge round. The pair of runs starting at
+ * pair_start is merged from the buffers into the tmp buffers, this morsel
+ * writes its rows [start, end) of the round's output.
+ */
+static void merge_morsel(void* arg, size_t morsel, size_t start, size_t end) {
+  (void)morsel;
+  SortArgs* args = (SortArgs*)arg;
+  size_t pair_start = start - start % (2 * args->run_width);
+  size_t mid = pair_start + args->run_width;
+  size_t pair_end = pair_start + 2 * args->run_width;
+  mid = mid < args->num_values ? mid : args->num_values;
+  pair_end = pair_end < args->num_values ? pair_end : args->num_values;
+  const int* a = &args->values[pair_start];
+  const int* b = &args->values[mid];
+  size_t a_len = mid - pair_start;
+  size_t b_len = pair_end - mid;
+  size_t i = merge_path(a, a_len, b, b_len, start - pair_start);
+  size_t j = start - pair_start - i;
+  size_t i_end = merge_path(a, a_len, b, b_len, end - pair_start);
+  size_t j_end = end - pair_start - i_end;
+  const size_t* a_pos = &args->positions[pair_start];
+  const size_t* b_pos = &args->positions[mid];
+  size_t k = start;
+  while (i < i_end && j < j_end) {
+    bool take_a = a[i] <= b[j];
+    args->tmp_values[k] = take_a ? a[i] : b[j];
+    args->tmp_positions[k] = take_a ? a_pos[i] : b_pos[j];
+    i += take_a;
+    j += !take_a;
+    k++;
+  }
+  memcpy(&args->tmp_values[k], &a[i], (i_end - i) * sizeof(int));
+  memcpy(&args->tmp_positions[k], &a_pos[i], (i_end - i) * sizeof(size_t));
+  k += i_end - i;
+  memcpy(&args->tmp_values[k], &b[j], (j_end - j) * sizeof(int));
+  memcpy(&args->tmp_positions[k], &b_pos[j], (j_end - j) * sizeof(size_t));
+}
+
+void sort_pairs(const int* values, const size_t* positions, size_t num_values,
+                int** sorted_values, size_t** sorted_positions) {
+  SortArgs args = {.values = malloc((num_values + 1) * sizeof(int)),
+                   .positions = malloc((num_values + 1) * sizeof(size_t)),
+                   .tmp_values = malloc((num_values + 1) * sizeof(int)),
+                   .tmp_positions = malloc((num_values + 1) * sizeof(size_t)),
+                   .num_values = num_values,
+                   .run_width = MORSEL_SIZE};
+  memcpy(args.values, values, num_values * sizeof(int));
+  memcpy(args.positions, positions, num_values * sizeof(size_t));
+  morsel_run(num_values, &radix_sort_morsel, &args);
+  // runs are whole morsels, so every output morsel lies in a single pair
+  for (; args.run_width < num_values; args.run_width *= 2) {
+    morsel_run(num_values, &merge_morsel, &args);
+    int* swap_values = args.values;
+    args.values = args.tmp_values;
+    args.tmp_values = swap_values;
+    size_t* swap_positions = args.positions;
+    args.positions = args.tmp_positions;
+    args.tmp_positions = swap_positions;
+  }
+  free(args.tmp_values);
+  free(args.tmp_positions);
+  *sorted_values = args.values;
+  *sorted_positions = args.positions;
+}
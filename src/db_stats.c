@@ -0,0 +1,257 @@
+#include "db_stats.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "db_hashtable.h"
+#include "db_morsel.h"
+
+#define SKETCH_SIZE (1 << STATS_SKETCH_BITS)
+
+/*
+ * Batched operators on different columns run at the same time and may
+ * rebuild statistics while others read them.
+ */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The top bits of the hash pick a register, which keeps the highest position
+ * of the first set bit in the rest of the hash.
+ */
+static inline void sketch_add(unsigned char* sketch, int value) {
+  uint64_t hash = mix_hash(value);
+  size_t reg = hash >> (64 - STATS_SKETCH_BITS);
+  uint64_t rest = hash << STATS_SKETCH_BITS;
+  unsigned char rank =
+      rest == 0 ? 64 - STATS_SKETCH_BITS + 1 : __builtin_clzll(rest) + 1;
+  sketch[reg] = rank > sketch[reg] ? rank : sketch[reg];
+}
+
+static void sketch_merge(unsigned char* sketch, const unsigned char* other) {
+  for (size_t r = 0; r < SKETCH_SIZE; r++) {
+    sketch[r] = other[r] > sketch[r] ? other[r] : sketch[r];
+  }
+}
+
+/*
+ * HyperLogLog estimate, with linear counting of the empty registers while
+ * the estimate is small enough for it to be more accurate.
+ */
+static size_t sketch_estimate(const unsigned char* sketch) {
+  const double m = SKETCH_SIZE;
+  double inverse_sum = 0.0;
+  size_t empty = 0;
+  for (size_t r = 0; r < SKETCH_SIZE; r++) {
+    inverse_sum += ldexp(1.0, -sketch[r]);
+    empty += sketch[r] == 0;
+  }
+  double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / inverse_sum;
+  if (estimate <= 2.5 * m && empty > 0) {
+    estimate = m * log(m / (double)empty);
+  }
+  return (size_t)(estimate + 0.5);
+}
+
+static int compare_positions(const void* a, const void* b) {
+  size_t left = *(const size_t*)a;
+  size_t right = *(const size_t*)b;
+  return (left > right) - (left < right);
+}
+
+size_t* column_deleted_positions(const Column* column, size_t* num_deleted) {
+  const size_t num_rows = *column->num_rows;
+  size_t* deleted =
+      malloc((column->update_struct.del_length + 1) * sizeof(size_t));
+  size_t n = 0;
+  for (size_t k = 0; k < column->update_struct.del_length; k++) {
+    if (column->update_struct.del_pos[k] < num_rows) {
+      deleted[n++] = column->update_struct.del_pos[k];
+    }
+  }
+  qsort(deleted, n, sizeof(size_t), &compare_positions);
+  *num_deleted = 0;
+  for (size_t k = 0; k < n; k++) {
+    if (*num_deleted == 0 || deleted[k] != deleted[*num_deleted - 1]) {
+      deleted[(*num_deleted)++] = deleted[k];
+    }
+  }
+  return deleted;
+}
+
+/*
+ * Per worker partial aggregates and sketches over rows of data, skipping the
+ * sorted positions in deleted. sketches is NULL if the sketch is not needed.
+ */
+typedef struct StatsMorselArgs {
+  const int* data;
+  const size_t* deleted;
+  size_t num_deleted;
+  ScanAggregate* partials;
+  unsigned char (*sketches)[SKETCH_SIZE];
+} StatsMorselArgs;
+
+static void stats_range(StatsMorselArgs* args, size_t worker, size_t start,
+                        size_t end) {
+  scan_aggregate(&args->data[start], end - start, &args->partials[worker]);
+  if (args->sketches != NULL) {
+    for (size_t i = start; i < end; i++) {
+      sketch_add(args->sketches[worker], args->data[i]);
+    }
+  }
+}
+
+static void stats_morsel(void* arg, size_t worker, size_t morsel,
+                         size_t start, size_t end) {
+  (void)morsel;
+  StatsMorselArgs* args = (StatsMorselArgs*)arg;
+  // first pending delete at or after start
+  size_t lo = 0;
+  size_t hi = args->num_deleted;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (args->deleted[mid] < start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  for (size_t d = lo; d < args->num_deleted && args->deleted[d] < end; d++) {
+    stats_range(args, worker, start, args->deleted[d]);
+    start = args->deleted[d] + 1;
+  }
+  stats_range(args, worker, start, end);
+}
+
+/*
+ * Scans num_rows values of data in parallel into agg and, if it is not NULL,
+ * sketch.
+ */
+static void stats_scan(const int* data, size_t num_rows, const size_t* deleted,
+                       size_t num_deleted, ScanAggregate* agg,
+                       unsigned char* sketch) {
+  size_t num_workers = morsel_num_workers(num_rows);
+  StatsMorselArgs args = {
+      .data = data,
+      .deleted = deleted,
+      .num_deleted = num_deleted,
+      .partials = malloc(num_workers * sizeof(ScanAggregate)),
+      .sketches = sketch == NULL ? NULL
+                                 : calloc(num_workers, sizeof(*args.sketches))};
+  for (size_t w = 0; w < num_workers; w++) {
+    args.partials[w] = SCAN_AGGREGATE_INIT;
+  }
+  morsel_run_workers(num_rows, &stats_morsel, &args);
+  for (size_t w = 0; w < num_workers; w++) {
+    scan_aggregate_merge(agg, &args.partials[w]);
+    if (sketch != NULL) {
+      sketch_merge(sketch, args.sketches[w]);
+    }
+  }
+  free(args.partials);
+  free(args.sketches);
+}
+
+/*
+ * Rebuilds with stats_lock held, the sketch only if with_sketch is set.
+ */
+static void stats_rebuild_locked(Column* column, bool with_sketch) {
+  ColumnStats* stats = &column->stats;
+  ScanAggregate agg = SCAN_AGGREGATE_INIT;
+  size_t num_deleted;
+  size_t* deleted = column_deleted_positions(column, &num_deleted);
+  if (with_sketch) {
+    memset(stats->sketch, 0, sizeof(stats->sketch));
+  }
+  stats_scan(column->data, *column->num_rows, deleted, num_deleted, &agg,
+             with_sketch ? stats->sketch : NULL);
+  free(deleted);
+  scan_aggregate(column->update_struct.ins_val,
+                 column->update_struct.ins_length, &agg);
+  if (with_sketch) {
+    for (size_t k = 0; k < column->update_struct.ins_length; k++) {
+      sketch_add(stats->sketch, column->update_struct.ins_val[k]);
+    }
+    stats->sketch_stale = false;
+  }
+  stats->count = agg.count;
+  stats->sum = agg.sum;
+  stats->min = agg.min;
+  stats->max = agg.max;
+  stats->stale = false;
+}
+
+void stats_rebuild(Column* column) {
+  pthread_mutex_lock(&stats_lock);
+  stats_rebuild_locked(column, true);
+  pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_add_rows(Column* column, size_t first_row) {
+  ColumnStats* stats = &column->stats;
+  ScanAggregate agg = SCAN_AGGREGATE_INIT;
+  pthread_mutex_lock(&stats_lock);
+  stats_scan(&column->data[first_row], *column->num_rows - first_row, NULL, 0,
+             &agg, stats->sketch_stale ? NULL : stats->sketch);
+  stats->count += agg.count;
+  stats->sum += agg.sum;
+  stats->min = agg.min < stats->min ? agg.min : stats->min;
+  stats->max = agg.max > stats->max ? agg.max : stats->max;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_add(Column* column, int value) {
+  ColumnStats* stats = &column->stats;
+  stats->count += 1;
+  stats->sum += value;
+  stats->min = value < stats->min ? value : stats->min;
+  stats->max = value > stats->max ? value : stats->max;
+  sketch_add(stats->sketch, value);
+}
+
+void stats_remove(Column* column, int value) {
+  ColumnStats* stats = &column->stats;
+  stats->count -= 1;
+  stats->sum -= value;
+  if (value <= stats->min || value >= stats->max) {
+    stats->stale = true;
+  }
+  stats->sketch_stale = true;
+}
+
+void stats_replace(Column* column, int old_value, int new_value) {
+  stats_remove(column, old_value);
+  stats_add(column, new_value);
+}
+
+void stats_aggregate(Column* column, ScanAggregate* agg) {
+  pthread_mutex_lock(&stats_lock);
+  if (column->stats.stale) {
+    stats_rebuild_locked(column, false);
+  }
+  *agg = (ScanAggregate){.count = column->stats.count,
+                         .sum = column->stats.sum,
+                         .min = column->stats.min,
+                         .max = column->stats.max};
+  pthread_mutex_unlock(&stats_lock);
+}
+
+size_t stats_count_distinct(Column* column) {
+  pthread_mutex_lock(&stats_lock);
+  if (column->stats.sketch_stale) {
+    stats_rebuild_locked(column, true);
+  }
+  size_t estimate = sketch_estimate(column->stats.sketch);
+  pthread_mutex_unlock(&stats_lock);
+  return estimate;
+}
+
+size_t count_distinct(const int* values, size_t num_values) {
+  unsigned char* sketch = calloc(SKETCH_SIZE, sizeof(unsigned char));
+  ScanAggregate agg = SCAN_AGGREGATE_INIT;
+  stats_scan(values, num_values, NULL, 0, &agg, sketch);
+  size_t estimate = sketch_estimate(sketch);
+  free(sketch);
+  return estimate;
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include "db_threadpool.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main_api.h"
+#include "utils.h"
+
+ThreadPool* g_pool = NULL;
+
+size_t threadpool_default_size(void) {
+  cpu_set_t cpus;
+  size_t num_cpus = 1;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+    num_cpus = CPU_COUNT(&cpus);
+  }
+  return num_cpus < NUM_THREADS ? num_cpus : NUM_THREADS;
+}
+
+/*
+ * Removes the task at the front of the queue, called with the lock held and
+ * at least one task queued.
+ */
+static Task pop_task(ThreadPool* pool) {
+  Task task = pool->tasks[pool->head];
+  pool->head = (pool->head + 1) % pool->task_slots;
+  pool->num_tasks -= 1;
+  return task;
+}
+
+/*
+ * Runs task without the lock and marks it done, called with the lock held.
+ */
+static void run_task(ThreadPool* pool, Task task) {
+  pthread_mutex_unlock(&pool->lock);
+  task.func(task.arg);
+  pthread_mutex_lock(&pool->lock);
+  task.group->pending -= 1;
+  if (task.group->pending == 0) {
+    pthread_cond_broadcast(&pool->task_done);
+  }
+}
+
+static void* worker_main(void* arg) {
+  ThreadPool* pool = (ThreadPool*)arg;
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (pool->num_tasks == 0 && !pool->shutting_down) {
+      pthread_cond_wait(&pool->task_ready, &pool->lock);
+    }
+    if (pool->num_tasks == 0) {
+      break;
+    }
+    run_task(pool, pop_task(pool));
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/*
+ * Pins worker i to the ith cpu this process is allowed on. Failing to pin
+ * is not fatal, the worker just floats.
+ */
+static void pin_worker(pthread_t thread, size_t i) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return;
+  }
+  size_t seen = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) {
+      continue;
+    }
+    if (seen == i % (size_t)CPU_COUNT(&allowed)) {
+      cpu_set_t target;
+      CPU_ZERO(&target);
+      CPU_SET(cpu, &target);
+      if (pthread_setaffinity_np(thread, sizeof(target), &target) != 0) {
+        log_info("Could not pin worker %ld to cpu %d\n", i, cpu);
+      }
+      return;
+    }
+    seen += 1;
+  }
+}
+
+ThreadPool* threadpool_create(size_t num_threads) {
+  ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+  if (pool == NULL) {
+    log_err("%s:%d Failed to allocate thread pool\n", __FILE__, __LINE__);
+    return NULL;
+  }
+  pool->task_slots = 64;
+  pool->tasks = malloc(sizeof(Task) * pool->task_slots);
+  pool->threads = malloc(sizeof(pthread_t) * num_threads);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->task_ready, NULL);
+  pthread_cond_init(&pool->task_done, NULL);
+  for (size_t i = 0; i < num_threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, &worker_main, pool) != 0) {
+      log_err("%s:%d Failed to create worker %ld\n", __FILE__, __LINE__, i);
+      break;
+    }
+    pin_worker(pool->threads[i], i);
+    pool->num_threads += 1;
+  }
+  log_info("Started thread pool with %ld workers\n", pool->num_threads);
+  return pool;
+}
+
+void threadpool_destroy(ThreadPool* pool) {
+  if (pool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->shutting_down = true;
+  pthread_cond_broadcast(&pool->task_ready);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 0; i < pool->num_threads; i++) {
+    if (pthread_join(pool->threads[i], NULL) != 0) {
+      log_err("%s:%d Failed to join worker %ld\n", __FILE__, __LINE__, i);
+    }
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->task_ready);
+  pthread_cond_destroy(&pool->task_done);
+  free(pool->tasks);
+  free(pool->threads);
+  free(pool);
+}
+
+/*
+ * Doubles the ring buffer, unwrapping it so head is back at 0.
+ * Called with the lock held.
+ */
+static bool grow_tasks(ThreadPool* pool) {
+  Task* tasks = malloc(sizeof(Task) * pool->task_slots * 2);
+  if (tasks == NULL) {
+    log_err("%s:%d Failed to grow task queue\n", __FILE__, __LINE__);
+    return false;
+  }
+  for (size_t i = 0; i < pool->num_tasks; i++) {
+    tasks[i] = pool->tasks[(pool->head + i) % pool->task_slots];
+  }
+  free(pool->tasks);
+  pool->tasks = tasks;
+  pool->head = 0;
+  pool->task_slots *= 2;
+  return true;
+}
+
+void threadpool_submit(ThreadPool* pool, TaskGroup* group, TaskFunc func,
+                       void* arg) {
+  if (pool == NULL || pool->num_threads == 0) {
+    func(arg);
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  if (pool->num_tasks == pool->task_slots && !grow_tasks(pool)) {
+    pthread_mutex_unlock(&pool->lock);
+    func(arg);
+    return;
+  }
+  pool->tasks[(pool->head + pool->num_tasks) % pool->task_slots] =
+      (Task){.func = func, .arg = arg, .group = group};
+  pool->num_tasks += 1;
+  group->pending += 1;
+  pthread_cond_signal(&pool->task_ready);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_wait(ThreadPool* pool, TaskGroup* group) {
+  if (pool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  while (group->pending > 0) {
+    if (pool->num_tasks > 0) {
+      run_task(pool, pop_task(pool));
+    } else {
+      pthread_cond_wait(&pool->task_done, &pool->lock);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
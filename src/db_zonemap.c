@@ -0,0 +1,83 @@
+#include "db_zonemap.h"
+
+#include <limits.h>
+
+#include "utils.h"
+
+// blocks start on a word of a bitvector, so whole blocks can be set at once
+_Static_assert(ZONEMAP_BLOCK_SIZE % 64 == 0,
+               "ZONEMAP_BLOCK_SIZE must be a multiple of 64");
+
+ZoneMap* zonemap_create(void) { return calloc(1, sizeof(ZoneMap)); }
+
+void zonemap_free(ZoneMap* zonemap) {
+  if (zonemap == NULL) {
+    return;
+  }
+  free(zonemap->mins);
+  free(zonemap->maxs);
+  free(zonemap);
+}
+
+static bool zonemap_reserve(ZoneMap* zonemap, size_t num_blocks) {
+  if (num_blocks <= zonemap->alloc_blocks) {
+    return true;
+  }
+  size_t alloc_blocks = zonemap->alloc_blocks == 0 ? 16 : zonemap->alloc_blocks;
+  while (alloc_blocks < num_blocks) {
+    alloc_blocks *= 2;
+  }
+  int* mins = realloc(zonemap->mins, alloc_blocks * sizeof(int));
+  if (mins == NULL) {
+    log_err("%s:%d failed to grow zone map\n", __FILE__, __LINE__);
+    return false;
+  }
+  zonemap->mins = mins;
+  int* maxs = realloc(zonemap->maxs, alloc_blocks * sizeof(int));
+  if (maxs == NULL) {
+    log_err("%s:%d failed to grow zone map\n", __FILE__, __LINE__);
+    return false;
+  }
+  zonemap->maxs = maxs;
+  zonemap->alloc_blocks = alloc_blocks;
+  return true;
+}
+
+void zonemap_rebuild(Column* column, size_t first_row) {
+  ZoneMap* zonemap = column->zonemap;
+  if (zonemap == NULL) {
+    return;
+  }
+  const size_t num_rows = *column->num_rows;
+  const size_t num_blocks = zonemap_num_blocks(num_rows);
+  if (!zonemap_reserve(zonemap, num_blocks)) {
+    // without bounds for every block the zone map cannot be trusted
+    zonemap->num_blocks = 0;
+    return;
+  }
+  for (size_t b = first_row / ZONEMAP_BLOCK_SIZE; b < num_blocks; b++) {
+    size_t start = b * ZONEMAP_BLOCK_SIZE;
+    size_t end = num_rows - start < ZONEMAP_BLOCK_SIZE
+                     ? num_rows
+                     : start + ZONEMAP_BLOCK_SIZE;
+    int min = INT_MAX;
+    int max = INT_MIN;
+    for (size_t i = start; i < end; i++) {
+      min = column->data[i] < min ? column->data[i] : min;
+      max = column->data[i] > max ? column->data[i] : max;
+    }
+    zonemap->mins[b] = min;
+    zonemap->maxs[b] = max;
+  }
+  zonemap->num_blocks = num_blocks;
+}
+
+void zonemap_widen(Column* column, size_t pos, int value) {
+  ZoneMap* zonemap = column->zonemap;
+  if (zonemap == NULL || pos / ZONEMAP_BLOCK_SIZE >= zonemap->num_blocks) {
+    return;
+  }
+  size_t b = pos / ZONEMAP_BLOCK_SIZE;
+  zonemap->mins[b] = value < zonemap->mins[b] ? value : zonemap->mins[b];
+  zonemap->maxs[b] = value > zonemap->maxs[b] ? value : zonemap->maxs[b];
+}
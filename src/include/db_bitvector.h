@@ -0,0 +1,110 @@
+#ifndef DB_BITVECTOR_H
+#define DB_BITVECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "main_api.h"
+
+/*
+ * Payload of a BITVECTOR result, bit i is set if position i qualifies.
+ * The header and words are a single allocation so free_result_context can
+ * free it like any other payload. Bits at or past num_bits are always zero.
+ * The Result holding a bitvector keeps the number of set bits in num_tuples
+ * and the number of set bits at or past the column's num_rows (pending
+ * inserts) in num_update_tuples, the same as for a position list.
+ * column is the base column the positions refer to, or NULL if the bits came
+ * from a select on an intermediate result. not uses it to keep pending
+ * deletes out of the complement.
+ */
+typedef struct Bitvector {
+  size_t num_bits;
+  Column* column;
+  uint64_t words[];
+} Bitvector;
+
+static inline size_t bitvector_num_words(size_t num_bits) {
+  return (num_bits + 63) / 64;
+}
+
+static inline bool bitvector_test(const Bitvector* bits, size_t pos) {
+  return (bits->words[pos / 64] >> (pos % 64)) & 1;
+}
+
+static inline void bitvector_set(Bitvector* bits, size_t pos) {
+  bits->words[pos / 64] |= (uint64_t)1 << (pos % 64);
+}
+
+static inline void bitvector_clear(Bitvector* bits, size_t pos) {
+  bits->words[pos / 64] &= ~((uint64_t)1 << (pos % 64));
+}
+
+/*
+ * Sets bits [start, end), end must not be past num_bits.
+ */
+void bitvector_set_range(Bitvector* bits, size_t start, size_t end);
+
+/*
+ * Allocates a bitvector with all num_bits bits cleared.
+ */
+Bitvector* bitvector_allocate(size_t num_bits);
+
+/*
+ * Grows or shrinks bits to num_bits, new bits are cleared.
+ * Returns the (possibly moved) bitvector or NULL if realloc failed.
+ */
+Bitvector* bitvector_resize(Bitvector* bits, size_t num_bits);
+
+size_t bitvector_count(const Bitvector* bits);
+
+/*
+ * Number of set bits at positions >= start.
+ */
+size_t bitvector_count_from(const Bitvector* bits, size_t start);
+
+/*
+ * Number of set bits in words [first_word, last_word).
+ */
+size_t bitvector_count_words(const Bitvector* bits, size_t first_word,
+                             size_t last_word);
+
+/*
+ * Writes the positions of the set bits to positions in increasing order.
+ * positions needs room for bitvector_count(bits) entries.
+ * Returns the number of positions written.
+ */
+size_t bitvector_to_positions(const Bitvector* bits, size_t* positions);
+
+/*
+ * Same as bitvector_to_positions for words [first_word, last_word) only, so
+ * ranges of a bitvector can be decoded in parallel.
+ */
+size_t bitvector_words_to_positions(const Bitvector* bits, size_t first_word,
+                                    size_t last_word, size_t* positions);
+
+/*
+ * Builds a bitvector of num_bits bits from a position list, positions at or
+ * past num_bits are ignored.
+ */
+Bitvector* positions_to_bitvector(const size_t* positions, size_t num_positions,
+                                  size_t num_bits);
+
+/*
+ * Word at a time and, or and not. For and/or the result has as many bits as
+ * the longer input and the shorter input is treated as zero past its end.
+ * not clears the pending deletes of bits->column so deleted rows do not come
+ * back.
+ */
+Bitvector* bitvector_and(const Bitvector* left, const Bitvector* right);
+Bitvector* bitvector_or(const Bitvector* left, const Bitvector* right);
+Bitvector* bitvector_not(const Bitvector* bits);
+
+/*
+ * Converts a BITVECTOR result into a POSITIONLIST in place, so operators which
+ * need explicit positions (joins, updates, deletes, index vectors) can take
+ * either. Position lists are left as is.
+ * Returns false if the result is neither or allocation failed.
+ */
+bool result_to_positionlist(Result* result);
+
+#endif
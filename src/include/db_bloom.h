@@ -0,0 +1,54 @@
+#ifndef DB_BLOOM_H
+#define DB_BLOOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "db_hashtable.h"
+#include "main_api.h"
+
+#define BLOOM_BITS_SET 4
+
+/*
+ * Register blocked Bloom filter. A value only ever sets bits of one 64 bit
+ * word, picked by the top bits of its hash, and sets BLOOM_BITS_SET bits of
+ * it picked by 6 bit slices of the bottom of the hash. A lookup is a single
+ * load and compare, at the cost of a slightly higher false positive rate than
+ * a filter whose bits are spread over the whole array.
+ */
+typedef struct BloomFilter {
+  uint64_t* words;
+  unsigned word_shift;
+} BloomFilter;
+
+static inline uint64_t bloom_mask(uint64_t hash) {
+  uint64_t mask = 0;
+  for (unsigned b = 0; b < BLOOM_BITS_SET; b++) {
+    mask |= (uint64_t)1 << ((hash >> (6 * b)) & 63);
+  }
+  return mask;
+}
+
+static inline bool bloom_contains(const BloomFilter* filter, int value) {
+  uint64_t hash = mix_hash(value);
+  uint64_t mask = bloom_mask(hash);
+  return (filter->words[hash >> filter->word_shift] & mask) == mask;
+}
+
+/*
+ * Filter of num_values values with at least BLOOM_BITS_PER_KEY bits per
+ * value, built in parallel on the thread pool.
+ */
+BloomFilter* bloom_create(const int* values, size_t num_values);
+
+/*
+ * Fraction of up to BLOOM_SAMPLE_SIZE values, spread evenly over values,
+ * which pass the filter.
+ */
+double bloom_pass_rate(const BloomFilter* filter, const int* values,
+                       size_t num_values);
+
+void bloom_free(BloomFilter* filter);
+
+#endif
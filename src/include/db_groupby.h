@@ -0,0 +1,34 @@
+#ifndef DB_GROUPBY_H
+#define DB_GROUPBY_H
+
+#include <stddef.h>
+
+#include "main_api.h"
+
+/*
+ * One group of a group_by: its key, the number of rows with that key and the
+ * sum, min and max of each value column over those rows. Only the first
+ * num_values entries of sums, mins and maxs are used.
+ */
+typedef struct GroupEntry {
+  int key;
+  size_t count;
+  long sums[GROUP_BY_MAX_AGGREGATES];
+  int mins[GROUP_BY_MAX_AGGREGATES];
+  int maxs[GROUP_BY_MAX_AGGREGATES];
+} GroupEntry;
+
+/*
+ * Hash aggregation of num_rows rows by keys. Every worker of the thread pool
+ * aggregates the morsels it claims into its own hash table, so the hot loop
+ * takes no locks. The thread-local tables are then merged in parallel: their
+ * groups are radix partitioned on the hash with two pass counting, like the
+ * partitions of a hash join, and each partition is merged on its own since
+ * no key appears in two partitions.
+ * Returns the groups sorted by key and sets num_groups, NULL if there are no
+ * rows. values holds num_values columns of num_rows values each.
+ */
+GroupEntry* group_by(const int* keys, const int* const* values,
+                     size_t num_values, size_t num_rows, size_t* num_groups);
+
+#endif
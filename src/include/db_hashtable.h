@@ -1,36 +1,91 @@
 #ifndef DB_HASH_TABLE
 #define DB_HASH_TABLE
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "main_api.h"
+
 /* This is a static hash two pass counting hash table
 * It does not support updates since it does not need to in order to be used for joins
 * Keys are stored in a single contiguous array and matching positions are stored in another
 * contiguous array. The hash table is built by passing over the data once, in the first pass
 * offsets for each  "bucket" are calculated by counting how many items match each bucket
 * in the second pass we then insert items into the arrays.
-* num_buckets is set to size / 4 since when we search though a bucket we load a cache line at a 
-* time up the memory hierarchy and each cache line stores 64/4 = 16 ints. If the data were perfectly 
-* uniform we would have size/16 buckets, but non uniform data is likely so we should have some overhead.
-* although buckets are not constructed to be cacheline size aligned. 
+* num_buckets is the power of 2 at or above size / 4, so a bucket is picked by masking the
+* low bits of the hash. Buckets hold 4 keys or fewer on average, and a probe compares its key
+* against all keys of the bucket a SIMD register at a time, 8 (AVX2) or 16 (AVX-512) at once,
+* which is usually a single comparison within one cache line.
+* keys is padded past size so that a comparison may read past the last bucket.
 */
 typedef struct HashTable {
 	int* keys;
 	size_t* positions;
-	size_t* offsets;
-	size_t* bucket_counts;
-	size_t* bucket_offsets; // used as we load the table, offset past start of bucket to insert next item
+	size_t* offsets; // bucket b is [offsets[b], offsets[b + 1]) of keys and positions
     size_t size; // length of keys and positions in # of items
     size_t num_buckets;
+    size_t bucket_mask;
 } HashTable;
 
 
 
-HashTable* ht_allocate(size_t size); // allocates hashtable struct and datastructures 
+
+// Adpated from
+// https://stackoverflow.com/questions/664014/what-integer-hash-function-are-good-that-accepts-an-integer-hash-key
+static inline size_t hash_func(int x) {
+  x = ((x >> 16) ^ x) * 0x45d9f3b;
+  x = ((x >> 16) ^ x) * 0x45d9f3b;
+  x = (x >> 16) ^ x;
+  return (size_t)x;
+}
+
+// 64 bit finaliser from MurmurHash3, for Bloom filters and sketches whose bits
+// must be independent of the hash partition and bucket hash_func gives a value.
+// The constant keeps 0 from hashing to 0.
+static inline uint64_t mix_hash(int value) {
+  uint64_t x = (uint64_t)(uint32_t)value + 0x9e3779b97f4a7c15ULL;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+HashTable* ht_allocate(size_t size); // allocates hashtable struct and datastructures
 int bulk_ht_load(HashTable* ht, int* keys, size_t* values, size_t num_values);
-// returns all matching values in hashtable in values and number in num_values
-int get(HashTable* ht, int key, size_t** values, size_t* num_values, size_t* value_init_length);
+// probes the table with num_keys keys and appends a pair of positions to matches for
+// every key in the table equal to a probe key, in probe order. The positions loaded
+// into the table go on the left of matches and those of the probe keys on the right.
+// If found is not NULL, found[i] is set to whether key i has any match
+void probe_many(const HashTable* ht, const int* keys, const size_t* positions,
+                size_t num_keys, JoinMatches* matches, bool* found);
+// probes the table with num_keys keys and sets found[i] if the table holds key i,
+// stopping at its first match
+void probe_exists(const HashTable* ht, const int* keys, size_t num_keys, bool* found);
 int ht_deallocate(HashTable* ht);
-#endif
 
+// makes room in the last chunk of matches for extra more pairs, starting a new chunk
+// if it is full
+void join_matches_reserve(JoinMatches* matches, size_t extra);
+void join_matches_free(JoinMatches* matches);
+
+// appends a pair, which join_matches_reserve made room for
+static inline void join_matches_add(JoinMatches* matches, size_t left_position,
+                                    size_t right_position) {
+  JoinChunk* chunk = matches->tail;
+  chunk->left_positions[chunk->length] = left_position;
+  chunk->right_positions[chunk->length] = right_position;
+  chunk->length += 1;
+  matches->length += 1;
+}
+
+// appends the left position of a semi or anti join match
+static inline void join_matches_add_left(JoinMatches* matches, size_t left_position) {
+  JoinChunk* chunk = matches->tail;
+  chunk->left_positions[chunk->length] = left_position;
+  chunk->length += 1;
+  matches->length += 1;
+}
+#endif
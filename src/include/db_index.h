@@ -64,24 +64,28 @@ Result* sorted_range_select(SortedIndex* sorted_index, int lower, int upper);
 // ****************************************************************************
 
 
-#define NODE_SIZE 1024
-// actual size is 992 bytes which is < 16 cache lines
-#define FAN_OUT 80 // this makes num_elements and positions/child_pointers each fit on 
-
+#define CACHE_LINE_SIZE 64
+// keys compared by one AVX-512 instruction, FAN_OUT is a multiple of it
+#define NODE_SEARCH_WIDTH 16
+// each key takes 4 bytes and a child 8, 64 bytes are left for the rest
+#define FAN_OUT \
+	((NODE_SIZE - 64) / 12 / NODE_SEARCH_WIDTH * NODE_SEARCH_WIDTH)
 
 /*
 * The index pointer in the column will point to the root of the tree. 
-* union of either array of pointers to children nodes or array of positions
-* this means the positions/child pointers are exactly 10 cache lines 
-* the vals are 5 and the meta data fits in the last cache line
+* union of either array of pointers to children nodes or array of positions.
+* The keys come first, so a node is searched in its first
+* FAN_OUT * 4 / CACHE_LINE_SIZE cache lines (5 with the default NODE_SIZE)
+* and only the line holding the chosen child or position is read after them.
+* Nodes are cache line aligned, allocate them with bnode_allocate.
 */
 struct BNode;
 typedef struct BNode {	
+	int vals[FAN_OUT];
 	union {
 		size_t positions[FAN_OUT+1];
 		struct BNode* child_pointers[FAN_OUT+1];
 	} children;
-	int vals[FAN_OUT];
 	size_t num_elements;
 	struct BNode* previous; // only used in leaf nodes
 	struct BNode* next;  
@@ -89,6 +93,19 @@ typedef struct BNode {
 	bool is_root;
 } BNode;
 
+_Static_assert(sizeof(BNode) <= NODE_SIZE, "BNode does not fit in NODE_SIZE");
+
+// zeroed, cache line aligned node
+BNode* bnode_allocate(bool is_leaf);
+
+/*
+* Index of the first of the node's keys from from on which is >= key, or
+* num_elements if there is none. Compares 16 (AVX-512) or 8 (AVX2) keys at a
+* time and counts those below key, stopping at the first block which is not
+* all below, falling back to binary search without SIMD.
+*/
+size_t bnode_lower_bound(const BNode* node, size_t from, int key);
+
 
 
 /*
@@ -134,6 +151,33 @@ Result* BTree_clustered_select(BNode* root, int lower, int upper);
 
 
 
+// ****************************************************************************
+// Index cursors
+// ****************************************************************************
+
+/*
+* Cursor over the entries of a BTREE or SORTED index in key order, used to
+* probe an index with many keys. Keys must be sought in ascending order: each
+* seek starts from where the last one ended, moving along the current B-tree
+* leaf or its neighbour, or galloping forward in the sorted keys, and only
+* descends from the root again when the key is further away. A batch of sorted
+* probes then shares most of its tree paths.
+*/
+typedef struct IndexCursor {
+	IndexType index_type;
+	void* index;
+	BNode* leaf;
+	size_t idx;
+} IndexCursor;
+
+void index_cursor_init(IndexCursor* cursor, Column* column);
+// moves to the first entry with a key >= key
+void index_cursor_seek(IndexCursor* cursor, int key);
+bool index_cursor_valid(const IndexCursor* cursor);
+int index_cursor_key(const IndexCursor* cursor);
+size_t index_cursor_position(const IndexCursor* cursor);
+void index_cursor_next(IndexCursor* cursor);
+
 // ****************************************************************************
 // Helper functions 
 // ****************************************************************************
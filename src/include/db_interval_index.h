@@ -0,0 +1,61 @@
+#ifndef DB_INTERVAL_INDEX_H
+#define DB_INTERVAL_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Index over a batch of range predicates low <= v < high used by large shared
+ * scans. The distinct bounds of every predicate are sorted, which splits the
+ * value domain into num_bounds + 1 elementary intervals:
+ *   interval 0 is v < bounds[0], interval i is bounds[i - 1] <= v < bounds[i]
+ *   and interval num_bounds is v >= bounds[num_bounds - 1].
+ * Every value of an elementary interval satisfies exactly the same queries,
+ * so a row only has to find its interval and then touches just the queries
+ * it satisfies. The queries covering interval e are
+ * queries[query_offsets[e]] .. queries[query_offsets[e + 1] - 1] in
+ * increasing order. Query q covers the contiguous intervals
+ * [first_interval[q], end_interval[q]).
+ */
+typedef struct IntervalIndex {
+  size_t num_bounds;
+  int* bounds;
+  size_t num_queries;
+  size_t* first_interval;
+  size_t* end_interval;
+  size_t* query_offsets;
+  uint32_t* queries;
+} IntervalIndex;
+
+static inline size_t interval_index_num_intervals(const IntervalIndex* index) {
+  return index->num_bounds + 1;
+}
+
+/*
+ * Elementary interval holding value, the number of bounds <= value.
+ * Branchless so the search does not mispredict on random data.
+ */
+static inline size_t interval_index_find(const IntervalIndex* index,
+                                         int value) {
+  const int* base = index->bounds;
+  size_t n = index->num_bounds;
+  if (n == 0) {
+    return 0;
+  }
+  while (n > 1) {
+    size_t half = n / 2;
+    base = base[half] <= value ? base + half : base;
+    n -= half;
+  }
+  return (base - index->bounds) + (base[0] <= value);
+}
+
+/*
+ * Builds the index for num_queries predicates lows[q] <= v < highs[q].
+ * Returns NULL if allocation failed.
+ */
+IntervalIndex* interval_index_create(const int* lows, const int* highs,
+                                     size_t num_queries);
+void interval_index_free(IntervalIndex* index);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef DB_MORSEL_H
+#define DB_MORSEL_H
+
+#include <stddef.h>
+
+#include "main_api.h"
+
+/*
+ * Morsel driven execution of single operators. A column of num_rows rows is
+ * split into morsels of MORSEL_SIZE rows, morsel m covers rows
+ * [m * MORSEL_SIZE, min((m + 1) * MORSEL_SIZE, num_rows)). Workers on the
+ * thread pool claim morsels one at a time until none are left, so a slow
+ * morsel does not hold up the others. Operators keep one partial result per
+ * morsel and merge them in morsel order, which keeps position lists sorted.
+ */
+typedef void (*MorselFunc)(void* arg, size_t morsel, size_t start, size_t end);
+
+static inline size_t morsel_num(size_t num_rows) {
+  return (num_rows + MORSEL_SIZE - 1) / MORSEL_SIZE;
+}
+
+/*
+ * Calls func once for every morsel of num_rows rows and returns when all of
+ * them are done. A single morsel runs inline on the calling thread.
+ */
+void morsel_run(size_t num_rows, MorselFunc func, void* arg);
+
+/*
+ * Same as morsel_run, but func is also given the index of the worker calling
+ * it, below morsel_num_workers(num_rows). A worker runs its morsels one after
+ * another, so operators can keep thread-local state per worker across
+ * morsels without locking.
+ */
+typedef void (*WorkerMorselFunc)(void* arg, size_t worker, size_t morsel,
+                                 size_t start, size_t end);
+
+size_t morsel_num_workers(size_t num_rows);
+
+void morsel_run_workers(size_t num_rows, WorkerMorselFunc func, void* arg);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef DB_PARTITION_H
+#define DB_PARTITION_H
+
+#include <stddef.h>
+
+#include "db_bloom.h"
+#include "main_api.h"
+
+/*
+ * Radix partitioning of join inputs on the top bits of each value's hash.
+ * Partition p holds rows [starts[p], starts[p + 1]) of positions and values,
+ * so all partitions of a column sit in one contiguous buffer. Rows keep their
+ * input order within a partition. Both sides of a join partitioned into the
+ * same number of partitions put equal values in partitions of equal index.
+ */
+typedef struct RadixPartitions {
+  size_t* positions;
+  int* values;
+  size_t* starts;
+  size_t num_parts;
+} RadixPartitions;
+
+/*
+ * Number of partitions, a power of 2, for a join whose smaller side has
+ * build_length rows and which reads total_length rows in all.
+ */
+size_t radix_num_partitions(size_t build_length, size_t total_length);
+
+/*
+ * Partitions length rows into num_parts partitions, a power of 2 of at most
+ * RADIX_PASS_FANOUT squared. The first pass runs on all threads of the pool:
+ * each morsel builds a histogram of its rows, the histograms are prefix summed
+ * into the offset of every morsel's rows within every partition and each
+ * morsel then scatters its rows without locking. Scattered rows are gathered
+ * in a cache line buffer per partition and written out a full line at a time
+ * with non-temporal stores. More than RADIX_PASS_FANOUT partitions take a
+ * second pass, which splits each partition of the first pass on the next bits
+ * of the hash as a task of its own. Unless filter is NULL, the first pass
+ * drops every row whose value is not in it.
+ */
+void radix_partition(const int* values, const size_t* positions,
+                     size_t length, const BloomFilter* filter,
+                     size_t num_parts, RadixPartitions* parts);
+
+void radix_partitions_free(RadixPartitions* parts);
+
+/*
+ * Rows of one side of a join, in newly allocated arrays.
+ */
+typedef struct JoinRows {
+  int* values;
+  size_t* positions;
+  size_t length;
+} JoinRows;
+
+/*
+ * Heavy hitters of a join split into num_parts partitions: values which a
+ * sample of up to SKEW_SAMPLE_SIZE rows of either side puts at more than
+ * SKEW_HEAVY_FACTOR times the average partition of that side. All rows of a
+ * value hash to the same partition, so such a value would make one
+ * partition far slower than the others. Returns the heavy values sorted, or
+ * NULL if there are none, and sets num_heavy.
+ */
+int* join_heavy_hitters(const int* left_values, size_t left_length,
+                        const int* right_values, size_t right_length,
+                        size_t num_parts, size_t* num_heavy);
+
+/*
+ * Splits length rows into light rows, whose value is not one of the
+ * num_heavy sorted heavy values, and heavy_rows, which are. Both keep the
+ * input order. Rows are counted and then copied a morsel at a time on the
+ * thread pool.
+ */
+void split_heavy_rows(const int* values, const size_t* positions,
+                      size_t length, const int* heavy, size_t num_heavy,
+                      JoinRows* light, JoinRows* heavy_rows);
+
+void join_rows_free(JoinRows* rows);
+
+#endif
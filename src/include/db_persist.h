@@ -20,5 +20,8 @@ bool load_column_data(Column *col, size_t tables_size, char* table_name);
 bool save_index(Column* column, char* table_name);
 bool load_index(Column* column, char* table_name);
 
+bool save_zonemap(Column* column, char* table_name);
+bool load_zonemap(Column* column, char* table_name);
+
 
 #endif
\ No newline at end of file
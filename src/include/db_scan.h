@@ -0,0 +1,82 @@
+#ifndef DB_SCAN_H
+#define DB_SCAN_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Scan kernels for range selects (min_val <= data[i] < max_val).
+ * On x86 the kernel is chosen at runtime from the instruction sets the CPU
+ * supports: AVX-512 uses a compress of the qualifying positions, AVX2 uses a
+ * shuffle lookup table keyed on the comparison mask, and everything else falls
+ * back to the scalar branchless loop.
+ *
+ * If positions_in is NULL the position written for row i is
+ * position_offset + i, otherwise positions_in[i] is written.
+ * result must have room for num_rows positions, kernels write whole vectors
+ * past the last qualifying position but never past num_rows.
+ * Returns the number of qualifying positions written to result.
+ */
+size_t scan_select_range(const int* data, const size_t* positions_in,
+                         size_t position_offset, size_t num_rows, int min_val,
+                         int max_val, size_t* result);
+
+/*
+ * Same predicate as scan_select_range, but sets bit i of words for each
+ * qualifying row instead of writing positions. words needs room for
+ * (num_rows + 63) / 64 words, bits past num_rows in the last word are zeroed.
+ * Returns the number of bits set.
+ */
+size_t scan_select_bitvector(const int* data, size_t num_rows, int min_val,
+                             int max_val, uint64_t* words);
+
+/*
+ * Evaluates num_queries range predicates lows[q] <= data[i] < highs[q] over
+ * the same rows for a shared scan. Rows are taken a tile at a time, and each
+ * query runs the bitvector kernel over the tile into a mask which is then
+ * compacted into that query's positions. The position written for row i is
+ * position_offset + i, appended at positions[q][counts[q]] with counts[q]
+ * moved past them.
+ */
+void scan_select_shared(const int* data, size_t position_offset,
+                        size_t num_rows, const int* lows, const int* highs,
+                        size_t num_queries, size_t** positions,
+                        size_t* counts);
+
+/*
+ * Running count, sum, min and max of the values of matching rows. Start from
+ * SCAN_AGGREGATE_INIT, no matches leaves min at INT_MAX and max at INT_MIN.
+ */
+typedef struct ScanAggregate {
+  size_t count;
+  long sum;
+  int min;
+  int max;
+} ScanAggregate;
+
+#define SCAN_AGGREGATE_INIT \
+  ((ScanAggregate){.count = 0, .sum = 0, .min = INT_MAX, .max = INT_MIN})
+
+static inline void scan_aggregate_merge(ScanAggregate* agg,
+                                        const ScanAggregate* partial) {
+  agg->count += partial->count;
+  agg->sum += partial->sum;
+  agg->min = partial->min < agg->min ? partial->min : agg->min;
+  agg->max = partial->max > agg->max ? partial->max : agg->max;
+}
+
+/*
+ * Fused select and aggregate: adds values[i] to agg for every row with
+ * min_val <= keys[i] < max_val, without materialising positions or values.
+ */
+void scan_select_aggregate(const int* keys, const int* values, size_t num_rows,
+                           int min_val, int max_val, ScanAggregate* agg);
+
+/*
+ * Adds every value to agg, for whole column aggregates and blocks where every
+ * row is known to match. Min and max are found in the same pass as the sum.
+ */
+void scan_aggregate(const int* values, size_t num_rows, ScanAggregate* agg);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef DB_SORT_H
+#define DB_SORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "main_api.h"
+
+/*
+ * Whether values is in ascending order, checked a morsel at a time on the
+ * thread pool.
+ */
+bool ints_sorted(const int* values, size_t num_values);
+
+/*
+ * Sorts num_values (value, position) pairs on value into newly allocated
+ * sorted_values and sorted_positions, leaving the inputs alone. The sort is
+ * stable, so equal values keep the order of their positions in the input.
+ * Every morsel is first radix sorted on its own, 8 bits a pass, then runs are
+ * merged pairwise until one is left. A pair of runs is merged by as many
+ * tasks as it has morsels of output: each task finds where its part of the
+ * output starts in both runs by binary search (merge path) and merges just
+ * that part, so even the last merge uses every thread.
+ */
+void sort_pairs(const int* values, const size_t* positions, size_t num_values,
+                int** sorted_values, size_t** sorted_positions);
+
+#endif
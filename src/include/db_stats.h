@@ -0,0 +1,60 @@
+#ifndef DB_STATS_H
+#define DB_STATS_H
+
+#include <stddef.h>
+
+#include "db_scan.h"
+#include "main_api.h"
+
+/*
+ * Whole column statistics kept up to date as the column changes, so whole
+ * column aggregates are answered without reading the data. Count and sum are
+ * always exact. Inserts only widen min and max, removing a value inside the
+ * bounds leaves them exact and removing one on a bound marks them stale. The
+ * distinct count is a HyperLogLog sketch: every value sets one register to the
+ * largest number of leading zeros seen in the hashes of its values, and the
+ * harmonic mean of the registers estimates the number of distinct values.
+ */
+
+/*
+ * Recomputes every statistic from the column's data and pending updates.
+ */
+void stats_rebuild(Column* column);
+
+/*
+ * Adds rows [first_row, *num_rows) of the base data, after a load appends
+ * them.
+ */
+void stats_add_rows(Column* column, size_t first_row);
+
+void stats_add(Column* column, int value);
+void stats_remove(Column* column, int value);
+
+/*
+ * A value changed in place by an update.
+ */
+void stats_replace(Column* column, int old_value, int new_value);
+
+/*
+ * Count, sum, min and max of the column, rebuilt first if they are stale.
+ */
+void stats_aggregate(Column* column, ScanAggregate* agg);
+
+/*
+ * Estimated number of distinct values in the column.
+ */
+size_t stats_count_distinct(Column* column);
+
+/*
+ * Estimated number of distinct values in num_values ints, for results which
+ * have no statistics of their own.
+ */
+size_t count_distinct(const int* values, size_t num_values);
+
+/*
+ * Sorted base positions with pending deletes, each given once. Positions of
+ * pending inserts are left out. Sets num_deleted, the caller frees the array.
+ */
+size_t* column_deleted_positions(const Column* column, size_t* num_deleted);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef DB_THREADPOOL_H
+#define DB_THREADPOOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Tasks take the same form as pthread start routines so existing thread
+ * functions can be submitted as they are, the return value is ignored.
+ */
+typedef void* (*TaskFunc)(void*);
+
+/*
+ * A set of tasks which are waited on together. pending is only touched with
+ * the pool lock held, declare groups as TaskGroup group = {0}.
+ */
+typedef struct TaskGroup {
+  size_t pending;
+} TaskGroup;
+
+typedef struct Task {
+  TaskFunc func;
+  void* arg;
+  TaskGroup* group;
+} Task;
+
+/*
+ * Fixed set of worker threads, each pinned to its own cpu, pulling tasks from
+ * a single FIFO queue. tasks is a ring buffer of task_slots entries starting
+ * at head which grows when full.
+ */
+typedef struct ThreadPool {
+  pthread_t* threads;
+  size_t num_threads;
+  Task* tasks;
+  size_t task_slots;
+  size_t head;
+  size_t num_tasks;
+  pthread_mutex_t lock;
+  pthread_cond_t task_ready;
+  pthread_cond_t task_done;
+  bool shutting_down;
+} ThreadPool;
+
+/*
+ * WARNING GLOBAL
+ * Server wide pool shared by every operator, created in server.c.
+ * If it is NULL tasks run inline on the submitting thread.
+ */
+extern ThreadPool* g_pool;
+
+/*
+ * Number of cpus this process may run on, capped at NUM_THREADS.
+ */
+size_t threadpool_default_size(void);
+
+ThreadPool* threadpool_create(size_t num_threads);
+
+/*
+ * Runs every queued task, then stops and joins the workers.
+ */
+void threadpool_destroy(ThreadPool* pool);
+
+void threadpool_submit(ThreadPool* pool, TaskGroup* group, TaskFunc func,
+                       void* arg);
+
+/*
+ * Blocks until every task in group has run. The waiting thread runs queued
+ * tasks itself while it waits, so tasks can submit and wait on their own
+ * groups without deadlocking the pool.
+ */
+void threadpool_wait(ThreadPool* pool, TaskGroup* group);
+
+#endif
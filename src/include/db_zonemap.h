@@ -0,0 +1,59 @@
+#ifndef DB_ZONEMAP_H
+#define DB_ZONEMAP_H
+
+#include <stddef.h>
+
+#include "main_api.h"
+
+/*
+ * Per block min/max synopsis of a column's base data. Block b covers rows
+ * [b * ZONEMAP_BLOCK_SIZE, (b + 1) * ZONEMAP_BLOCK_SIZE). Pending inserts in
+ * the differential structure are not covered, selects handle them separately.
+ * The bounds are allowed to be wider than the data (updates only widen them),
+ * they are tightened whenever the block is rebuilt.
+ */
+typedef struct ZoneMap {
+  size_t num_blocks;
+  size_t alloc_blocks;
+  int* mins;
+  int* maxs;
+} ZoneMap;
+
+/*
+ * How a block relates to the range predicate low <= v < high.
+ * ZONE_NONE means no row can match, ZONE_ALL means every row matches.
+ */
+typedef enum ZoneMatch { ZONE_NONE, ZONE_SOME, ZONE_ALL } ZoneMatch;
+
+static inline size_t zonemap_num_blocks(size_t num_rows) {
+  return (num_rows + ZONEMAP_BLOCK_SIZE - 1) / ZONEMAP_BLOCK_SIZE;
+}
+
+static inline ZoneMatch zonemap_match(const ZoneMap* zonemap, size_t block,
+                                      int low, int high) {
+  if (zonemap->maxs[block] < low || zonemap->mins[block] >= high) {
+    return ZONE_NONE;
+  }
+  if (zonemap->mins[block] >= low && zonemap->maxs[block] < high) {
+    return ZONE_ALL;
+  }
+  return ZONE_SOME;
+}
+
+ZoneMap* zonemap_create(void);
+void zonemap_free(ZoneMap* zonemap);
+
+/*
+ * Recomputes the bounds of every block from the one holding first_row up to
+ * the end of the column, and drops blocks past the end.
+ * Called after loads and flushes, which only change rows from some position
+ * onwards.
+ */
+void zonemap_rebuild(Column* column, size_t first_row);
+
+/*
+ * Widens the bounds of the block holding row pos to include value.
+ */
+void zonemap_widen(Column* column, size_t pos, int value);
+
+#endif
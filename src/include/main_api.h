@@ -25,6 +25,7 @@ SOFTWARE.
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 // Limits the size of a name in our database to 64 characters
@@ -35,14 +36,83 @@ SOFTWARE.
 #define QUERIES_PER_THREAD 5
 #define MULTI_THEADING 1
 #define SS_VECTOR_SIZE 1000000
+// batches with at least this many selects use an interval index over the
+// predicates rather than checking every predicate for every row
+#define SS_INTERVAL_QUERIES 64
 
 #define INDEXES 0
 
-#define TLB 16
-#define JOINTHREADS 8
+// bytes of a B-tree node, a multiple of the cache line size. The keys of a
+// 1024 byte node fill its first 5 cache lines, a 4096 byte node is a page
+#define NODE_SIZE 1024
+
+// bulk loaded B-tree leaves are filled to BTREE_LEAF_FILL of the fanout and
+// inner nodes to BTREE_INNER_FILL, leaving room for inserts, which do not
+// split nodes
+#define BTREE_LEAF_FILL 0.9
+#define BTREE_INNER_FILL 1.0
+
+// partitions a radix pass of a hash join writes to at once, a power of 2.
+// Rows go through a cache line write-combining buffer per partition, so this
+// can be well above the number of TLB entries
+#define RADIX_PASS_FANOUT 256
+
+// hash join partitions are made small enough that the hash table built on
+// the smaller side of each holds at most this many rows and stays in L2
+#define JOIN_PARTITION_ROWS 16384
+
+// hash join probes hash and prefetch this many keys before comparing any of
+// them, so that the cache misses of a batch overlap
+#define PROBE_BATCH_SIZE 16
+
+// hash joins filter the larger side with a Bloom filter of the smaller side
+// of BLOOM_BITS_PER_KEY bits per value, unless more than BLOOM_MAX_PASS_RATE
+// of a sample of BLOOM_SAMPLE_SIZE values of the larger side pass it
+#define BLOOM_BITS_PER_KEY 16
+#define BLOOM_MAX_PASS_RATE 0.5
+#define BLOOM_SAMPLE_SIZE 4096
+
+// hash joins sample SKEW_SAMPLE_SIZE rows of each side for heavy hitters,
+// values with more than SKEW_HEAVY_FACTOR times the rows of an average
+// partition, and join them apart. A partition whose larger side is more than
+// SKEW_HEAVY_FACTOR times the average is split across several tasks
+#define SKEW_SAMPLE_SIZE 4096
+#define SKEW_HEAVY_FACTOR 4
+
+// a join of a base column with an index probes the index with the other side
+// instead of hashing both, when the indexed column has at least this many
+// times as many rows as the other side
+#define INDEX_JOIN_MIN_RATIO 64
+
+// nested loop joins compare blocks of NESTEDLOOP_BLOCK_ROWS inner rows with
+// blocks of NESTEDLOOP_OUTER_ROWS outer rows per task. An inner block is 4 KB
+// of values and 8 KB of positions, and its matches buffer another 8 KB, so
+// together they fit in a 32 KB L1 with room for the outer rows
+#define NESTEDLOOP_BLOCK_ROWS 1024
+#define NESTEDLOOP_OUTER_ROWS 1024
+
+// join tasks write their matches to chunks of at most this many pairs, bar a
+// single run of matches which does not fit
+#define JOIN_OUTPUT_CHUNK_ROWS 16384
 
 #define UPDATE_BATCH_SIZE  15000
 
+// selects keep their result as a bitvector (1 bit per row) when at least one
+// in BITVECTOR_DENSITY rows qualifies, sparser results become position lists
+// (64 bits per qualifying row)
+#define BITVECTOR_DENSITY 64
+
+// rows per zone map block, must be a multiple of 64
+#define ZONEMAP_BLOCK_SIZE 65536
+
+// rows per unit of work for parallel selects, fetches and aggregates, must be
+// a multiple of 64. 64K ints is 256KB, small enough to stay in L2
+#define MORSEL_SIZE 65536
+
+// each column's distinct count sketch has 2^STATS_SKETCH_BITS one byte
+// registers, estimates are within about 1.04 / sqrt(2^STATS_SKETCH_BITS)
+#define STATS_SKETCH_BITS 12
+
 
 /**
  * EXTRA
@@ -50,8 +120,8 @@ SOFTWARE.
  * Flag to mark what type of data is held in the struct.
  * You can support additional types by including this enum and using void*
  * in place of int* in db_operator simliar to the way IndexType supports
- * additional types. BICVECTOR not currently used, but could be one way 
- * to implement bitvectors as results without a new struct 
+ * additional types. BITVECTOR results hold a Bitvector (db_bitvector.h)
+ * with one bit per position of the source.
  * position lists uses size_t type
  **/
 
@@ -81,8 +151,27 @@ typedef struct DiffUpdate {
     size_t ins_length;
 } DiffUpdate;
 
+/*
+ * Running statistics of a column's logical contents, the base data less
+ * pending deletes plus pending inserts, see db_stats.h. They are stored in
+ * the Column struct so the catalogue persists them with the column.
+ * stale is set when a delete or update may have removed the minimum or
+ * maximum, sketch_stale when values were removed, since neither can be undone
+ * incrementally. They are rebuilt from the data on the next use.
+ */
+typedef struct ColumnStats {
+    size_t count;
+    long sum;
+    int min;
+    int max;
+    bool stale;
+    bool sketch_stale;
+    unsigned char sketch[1 << STATS_SKETCH_BITS];
+} ColumnStats;
+
 
 struct Comparator;
+struct ZoneMap;
 //struct ColumnIndex;
 struct Table;
 typedef struct Column {
@@ -94,6 +183,9 @@ typedef struct Column {
     size_t *num_rows;
     IndexType index_type;
     DiffUpdate update_struct;
+    // per block min/max of the base data, see db_zonemap.h
+    struct ZoneMap* zonemap;
+    ColumnStats stats;
     //struct ColumnIndex *index;
     bool clustered;
 } Column;
@@ -273,7 +365,15 @@ typedef enum OperatorType {
     BATCH_EXECUTE,
     JOIN,
     UPDATE,
-    DELETE
+    DELETE,
+    AND,
+    OR,
+    NOT,
+    BATCHED,
+    SELECT_AGG,
+    GROUP_BY,
+    COUNT,
+    COUNT_DISTINCT
 } OperatorType;
 
 
@@ -377,7 +477,7 @@ typedef struct LoadOperator {
 
 
 /*
-* Operator fields for avg, sum, min, max
+* Operator fields for avg, sum, min, max, count and count_distinct
 */
 
 typedef struct AggOperator {
@@ -386,7 +486,8 @@ typedef struct AggOperator {
 } AggOperator;
 
 /*
-* Operator fields for add, sub
+* Operator fields for add, sub and the and, or, not of position results.
+* not only uses left_column
 */
 typedef struct BinaryOperator {
     char handle[MAX_SIZE_NAME];
@@ -396,11 +497,26 @@ typedef struct BinaryOperator {
 
 
 
+/*
+* HASH, NESTEDLOOP and MERGE are inner joins, which return a pair of left and
+* right positions for every match. SEMI and ANTI joins return only the left
+* positions with at least one match or no match at all, each once.
+* LEFT_OUTER joins are inner joins which also return every unmatched left row
+* paired with NULL_POSITION. The last three are hash joins.
+*/
 typedef enum JoinType {
     HASH,
-    NESTEDLOOP
+    NESTEDLOOP,
+    MERGE,
+    SEMI,
+    ANTI,
+    LEFT_OUTER
 } JoinType;
 
+// position of the missing side of an unmatched row of an outer join, fetching
+// it gives 0 since results have no NULL values
+#define NULL_POSITION SIZE_MAX
+
 typedef struct JoinOperator{
     char handle_left[MAX_SIZE_NAME];
     char handle_right[MAX_SIZE_NAME];
@@ -411,9 +527,48 @@ typedef struct JoinOperator{
     JoinType join_type;
 } JoinOperator;
 
+/*
+* Operator fields for select_agg, a select on key_column followed by a fetch
+* from value_column and an aggregate, evaluated in one pass.
+* agg_type is one of AVG, SUM, MIN and MAX.
+*/
+typedef struct SelectAggOperator {
+    char handle[MAX_SIZE_NAME];
+    Column* key_column;
+    Column* value_column;
+    int minimum;
+    int maximum;
+    OperatorType agg_type;
+} SelectAggOperator;
+
+/*
+* Operator fields for group_by. Each aggregate i is agg_types[i] (one of AVG,
+* SUM, MIN and MAX) of values[i] per distinct value of key, stored under
+* agg_handles[i]. The distinct keys are stored under key_handle.
+*/
+#define GROUP_BY_MAX_AGGREGATES 4
+
+typedef struct GroupByOperator {
+    char key_handle[MAX_SIZE_NAME];
+    char agg_handles[GROUP_BY_MAX_AGGREGATES][MAX_SIZE_NAME];
+    GeneralizedColumn* key;
+    GeneralizedColumn* values[GROUP_BY_MAX_AGGREGATES];
+    OperatorType agg_types[GROUP_BY_MAX_AGGREGATES];
+    size_t num_aggregates;
+} GroupByOperator;
+
+/*
+* A command received while batching. It is kept as text and parsed when the
+* batch executes, since it may use handles produced earlier in the batch.
+*/
+typedef struct BatchedOperator {
+    char* command;
+} BatchedOperator;
+
 /*
  * union type holding the fields of any operator
  */
+
 typedef union OperatorFields {
     CreateOperator create_operator;
     InsertOperator insert_operator;
@@ -426,6 +581,9 @@ typedef union OperatorFields {
     JoinOperator join_operator;
     UpdateOperator update_operator;
     DeleteOperator delete_operator;
+    BatchedOperator batched_operator;
+    SelectAggOperator select_agg_operator;
+    GroupByOperator group_by_operator;
 } OperatorFields;
 /*
  * DbOperator holds the following fields:
@@ -449,6 +607,7 @@ typedef struct DbOperator {
 * data_type is used to cast the data to the correct type for pointer arithmetic
 * vect_size is the how far to read into data
 * results is an array of Result pointers, one fo reach query. Each result is appended to. 
+* zonemap is the zone map of the scanned column, used to skip blocks, or NULL
 */
 
 typedef struct SharedScanArgs {
@@ -459,44 +618,54 @@ typedef struct SharedScanArgs {
     size_t vect_size;
     size_t position_offset;
     Result* results[QUERIES_PER_THREAD] ;
+    const struct ZoneMap* zonemap;
 } SharedScanArgs;
 
 
 
-typedef struct JoinPartitions {
-    size_t** left_pos_partitions;
-    size_t** right_pos_partitions;
-    int** left_val_partitions;
-    int** right_val_partitions;
-
-    size_t* left_partition_lengths;
-    size_t* right_partition_lengths;
-    size_t num_parts;
-} JoinPartitions;
-
-
-typedef struct PartitionThreadArgs {
-    size_t* positions;
-    int* vals;
-    size_t** pos_partitions;
-    int** val_partitions;
-    size_t* partition_lengths;
-    size_t num_parts;
-    size_t data_length;
-} PartitionThreadArgs;
+/*
+* JoinChunk is a block of matching left and right positions written by a join task.
+* JoinMatches is the list of chunks of one task. A full chunk is never grown or moved,
+* a new one, up to JOIN_OUTPUT_CHUNK_ROWS pairs, is started instead, and every pair is
+* copied once from its chunk into the join result at the task's offset.
+* swapped is set if the task's left side is the join's right side.
+*/
+typedef struct JoinChunk {
+    size_t* left_positions;
+    size_t* right_positions;
+    size_t length;
+    size_t capacity;
+    struct JoinChunk* next;
+} JoinChunk;
+
+typedef struct JoinMatches {
+    JoinChunk* head;
+    JoinChunk* tail;
+    size_t length;
+    bool swapped;
+    // semi and anti joins keep no right positions
+    bool left_only;
+} JoinMatches;
 
+/*
+* HashJoinThreadArgs is one task of a join. table is NULL unless the task is a chunk of a
+* partition split across several tasks, in which case it is the table of the side which
+* is not split, built once and shared read only by the partition's tasks. It is built on
+* the left side if table_left is set and on the right side otherwise.
+*/
+struct HashTable;
 
 typedef struct HashJoinThreadArgs {
     size_t* left_pos;
     int* left_vals;
     size_t* right_pos;
     int* right_vals;
-    size_t* left_join_positions;
-    size_t* right_join_positions;
     size_t left_len;
     size_t right_len;
-    size_t join_len;
-
+    JoinType join_type;
+    JoinMatches matches;
+    const struct HashTable* table;
+    bool table_left;
 } HashJoinThreadArgs;
 
 
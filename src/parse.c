@@ -530,7 +530,7 @@ DbOperator* parse_fetch(char* query_command, message* send_message,
   GeneralizedColumnHandle* index_handle = lookup_context(arg2, context);
   if (index_handle == NULL) {
     send_message->status = OBJECT_NOT_FOUND;
-    log_err("%s:%d Could not find handle %s \n", arg2, __FILE__, __LINE__);
+    log_err("%s:%d Could not find handle %s \n", __FILE__, __LINE__, arg2);
     return NULL;
   }
   dbo->operator_fields.fetch_operator.indices =
@@ -783,7 +783,7 @@ DbOperator* parse_avg(char* query_command, ClientContext* context,
       return NULL;
     }
     Column* src_column = lookup_column(table, query_command);
-    if (src == NULL) {
+    if (src_column == NULL) {
       log_err(
           "%s:%d No associated handle in parse_avg and could not find column\n",
           __FILE__, __LINE__);
@@ -825,7 +825,7 @@ DbOperator* parse_min(char* query_command, ClientContext* context,
       return NULL;
     }
     Column* src_column = lookup_column(table, query_command);
-    if (src == NULL) {
+    if (src_column == NULL) {
       log_err(
           "%s:%d No associated handle in parse_min and could not find column\n",
           __FILE__, __LINE__);
@@ -867,7 +867,7 @@ DbOperator* parse_max(char* query_command, ClientContext* context,
       return NULL;
     }
     Column* src_column = lookup_column(table, query_command);
-    if (src == NULL) {
+    if (src_column == NULL) {
       log_err(
           "%s:%d No associated handle in parse_max and could not find column\n",
           __FILE__, __LINE__);
@@ -1011,20 +1011,55 @@ DbOperator* parse_binary_op(char* query_command, ClientContext* context,
   return dbo;
 }
 
+/*
+ * and(<vec_pos1>,<vec_pos2>), or(<vec_pos1>,<vec_pos2>), not(<vec_pos>)
+ * the arguments are handles of earlier selects or combinators
+ */
+DbOperator* parse_bitwise_op(char* query_command, ClientContext* context,
+                             char* handle, OperatorType type) {
+  char* right_name = trim_parenthesis(query_command);
+  char* left_name = strsep(&right_name, ",");
+  if (handle == NULL || left_name == NULL ||
+      (type != NOT && right_name == NULL)) {
+    log_err("%s:%d handle or arguments are NULL in parse bitwise op \n",
+            __FILE__, __LINE__);
+    return NULL;
+  }
+  GeneralizedColumnHandle* left_han = lookup_context(left_name, context);
+  GeneralizedColumnHandle* right_han =
+      type == NOT ? NULL : lookup_context(right_name, context);
+  if (left_han == NULL || (type != NOT && right_han == NULL)) {
+    log_err("%s:%d Could not find handle in parse bitwise op \n", __FILE__,
+            __LINE__);
+    return NULL;
+  }
+  DbOperator* dbo = malloc(sizeof(DbOperator));
+  dbo->type = type;
+  strcpy(dbo->operator_fields.binary_operator.handle, handle);
+  dbo->operator_fields.binary_operator.left_column =
+      left_han->generalized_column;
+  if (right_han != NULL) {
+    dbo->operator_fields.binary_operator.right_column =
+        right_han->generalized_column;
+  }
+  return dbo;
+}
+
 DbOperator* parse_join(char* query_command, ClientContext* context,
                        char* handle) {
   query_command = trim_parenthesis(query_command);
+  // semi and anti joins only return left positions, so take one handle
   char* left_handle = strsep(&handle, ",");
-  if (left_handle == NULL || handle == NULL) {
-    log_err("%s:%d left or right handle in parse join is NULL\n", __FILE__,
-            __LINE__);
+  if (left_handle == NULL) {
+    log_err("%s:%d left handle in parse join is NULL\n", __FILE__, __LINE__);
     return NULL;
   }
 
   DbOperator* dbo = malloc(sizeof(DbOperator));
   dbo->type = JOIN;
   strcpy(dbo->operator_fields.join_operator.handle_left, left_handle);
-  strcpy(dbo->operator_fields.join_operator.handle_right, handle);
+  strcpy(dbo->operator_fields.join_operator.handle_right,
+         handle == NULL ? "" : handle);
 
   char* val1_name = strsep(&query_command, ",");
   char* pos1_name = strsep(&query_command, ",");
@@ -1050,12 +1085,165 @@ DbOperator* parse_join(char* query_command, ClientContext* context,
     dbo->operator_fields.join_operator.join_type = NESTEDLOOP;
   } else if (strncmp(query_command, "hash", 4) == 0) {
     dbo->operator_fields.join_operator.join_type = HASH;
+  } else if (strncmp(query_command, "merge", 5) == 0) {
+    dbo->operator_fields.join_operator.join_type = MERGE;
+  } else if (strncmp(query_command, "semi", 4) == 0) {
+    dbo->operator_fields.join_operator.join_type = SEMI;
+  } else if (strncmp(query_command, "anti", 4) == 0) {
+    dbo->operator_fields.join_operator.join_type = ANTI;
+  } else if (strncmp(query_command, "left-outer", 10) == 0) {
+    dbo->operator_fields.join_operator.join_type = LEFT_OUTER;
   } else {
     log_err("%s:%d Invalid join type %s \n", __FILE__, __LINE__, query_command);
     free(dbo);
     return NULL;
   }
+  JoinType join_type = dbo->operator_fields.join_operator.join_type;
+  if ((join_type == SEMI || join_type == ANTI) != (handle == NULL)) {
+    log_err("%s:%d semi and anti joins take one handle, other joins two\n",
+            __FILE__, __LINE__);
+    free(dbo);
+    return NULL;
+  }
+
+  return dbo;
+}
+
+/*
+ * count and count_distinct take a column or handle like the other
+ * aggregates.
+ */
+DbOperator* parse_count(char* query_command, ClientContext* context,
+                        char* handle, OperatorType type) {
+  DbOperator* dbo = parse_sum(query_command, context, handle);
+  if (dbo != NULL) {
+    dbo->type = type;
+  }
+  return dbo;
+}
+
+/*
+ * select_agg(<key column>,<low>,<high>,<value column>,<avg|sum|min|max>)
+ * aggregates the values of the rows whose key is in [low, high). Both columns
+ * must be base columns of the same table.
+ */
+DbOperator* parse_select_agg(char* query_command, ClientContext* context,
+                             char* handle) {
+  query_command = trim_parenthesis(query_command);
+  char* key_name = strsep(&query_command, ",");
+  char* low = strsep(&query_command, ",");
+  char* high = strsep(&query_command, ",");
+  char* value_name = strsep(&query_command, ",");
+  if (key_name == NULL || low == NULL || high == NULL || value_name == NULL ||
+      query_command == NULL) {
+    log_err("%s:%d missing arguments in parse_select_agg \n", __FILE__,
+            __LINE__);
+    return NULL;
+  }
+
+  OperatorType agg_type;
+  if (strncmp(query_command, "avg", 3) == 0) {
+    agg_type = AVG;
+  } else if (strncmp(query_command, "sum", 3) == 0) {
+    agg_type = SUM;
+  } else if (strncmp(query_command, "min", 3) == 0) {
+    agg_type = MIN;
+  } else if (strncmp(query_command, "max", 3) == 0) {
+    agg_type = MAX;
+  } else {
+    log_err("%s:%d Invalid aggregate %s \n", __FILE__, __LINE__,
+            query_command);
+    return NULL;
+  }
+
+  GeneralizedColumn* key = lookup_src(key_name, context);
+  GeneralizedColumn* value = lookup_src(value_name, context);
+  if (key == NULL || value == NULL || key->column_type != COLUMN ||
+      value->column_type != COLUMN ||
+      key->column_pointer.column->num_rows !=
+          value->column_pointer.column->num_rows) {
+    log_err("%s:%d select_agg needs two columns of the same table \n",
+            __FILE__, __LINE__);
+    free(key);
+    free(value);
+    return NULL;
+  }
 
+  DbOperator* dbo = malloc(sizeof(DbOperator));
+  dbo->type = SELECT_AGG;
+  dbo->operator_fields.select_agg_operator = (SelectAggOperator){
+      .key_column = key->column_pointer.column,
+      .value_column = value->column_pointer.column,
+      .minimum = (strcmp("null", low) == 0) ? INT_MIN : atoi(low),
+      .maximum = (strcmp("null", high) == 0) ? INT_MAX : atoi(high),
+      .agg_type = agg_type};
+  strcpy(dbo->operator_fields.select_agg_operator.handle, handle);
+  free(key);
+  free(value);
+  return dbo;
+}
+
+/*
+ * keys,aggs...=group_by(<key>,<values>,<avg|sum|min|max>,...) with one
+ * handle for the distinct keys and one per values, aggregate pair.
+ */
+DbOperator* parse_group_by(char* query_command, ClientContext* context,
+                           char* handle) {
+  query_command = trim_parenthesis(query_command);
+  char* key_name = strsep(&query_command, ",");
+  char* key_handle = strsep(&handle, ",");
+  if (key_name == NULL || key_handle == NULL || query_command == NULL) {
+    log_err("%s:%d missing key or aggregates in parse_group_by \n", __FILE__,
+            __LINE__);
+    return NULL;
+  }
+
+  DbOperator* dbo = malloc(sizeof(DbOperator));
+  dbo->type = GROUP_BY;
+  GroupByOperator* group_by = &dbo->operator_fields.group_by_operator;
+  group_by->num_aggregates = 0;
+  strcpy(group_by->key_handle, key_handle);
+  group_by->key = lookup_src(key_name, context);
+  bool valid = group_by->key != NULL;
+  while (valid && query_command != NULL) {
+    char* value_name = strsep(&query_command, ",");
+    char* agg_name = strsep(&query_command, ",");
+    char* agg_handle = strsep(&handle, ",");
+    size_t a = group_by->num_aggregates;
+    if (agg_name == NULL || agg_handle == NULL ||
+        a == GROUP_BY_MAX_AGGREGATES) {
+      log_err("%s:%d group_by needs one handle per aggregate and at most %d \n",
+              __FILE__, __LINE__, GROUP_BY_MAX_AGGREGATES);
+      valid = false;
+      break;
+    }
+    if (strncmp(agg_name, "avg", 3) == 0) {
+      group_by->agg_types[a] = AVG;
+    } else if (strncmp(agg_name, "sum", 3) == 0) {
+      group_by->agg_types[a] = SUM;
+    } else if (strncmp(agg_name, "min", 3) == 0) {
+      group_by->agg_types[a] = MIN;
+    } else if (strncmp(agg_name, "max", 3) == 0) {
+      group_by->agg_types[a] = MAX;
+    } else {
+      log_err("%s:%d Invalid aggregate %s \n", __FILE__, __LINE__, agg_name);
+      valid = false;
+      break;
+    }
+    strcpy(group_by->agg_handles[a], agg_handle);
+    group_by->values[a] = lookup_src(value_name, context);
+    group_by->num_aggregates += 1;
+    valid = group_by->values[a] != NULL;
+  }
+  if (!valid || handle != NULL) {
+    log_err("%s:%d could not parse group_by \n", __FILE__, __LINE__);
+    free(group_by->key);
+    for (size_t a = 0; a < group_by->num_aggregates; a++) {
+      free(group_by->values[a]);
+    }
+    free(dbo);
+    return NULL;
+  }
   return dbo;
 }
 
@@ -1071,6 +1259,20 @@ DbOperator* parse_command(char* query_command, message* send_message,
     // The -- signifies a comment line, no operator needed.
     return NULL;
   }
+  // while batching every command but the end of the batch is kept as text,
+  // execute_batch parses it once the handles it uses exist
+  if (context->batching_active &&
+      strstr(query_command, "batch_execute()") == NULL) {
+    dbo = malloc(sizeof(DbOperator));
+    dbo->type = BATCHED;
+    dbo->operator_fields.batched_operator.command =
+        malloc(strlen(query_command) + 1);
+    strcpy(dbo->operator_fields.batched_operator.command, query_command);
+    send_message->status = OK_DONE;
+    dbo->client_fd = client_socket;
+    dbo->context = context;
+    return dbo;
+  }
   // flag to indicate that next incoming message is a file
   char* equals_pointer = strchr(query_command, '=');
   char* handle = query_command;
@@ -1114,6 +1316,9 @@ DbOperator* parse_command(char* query_command, message* send_message,
     } else if (strncmp(query_command, "shutdown", 8) == 0) {
       query_command += 8;
       dbo = parse_shutdown();
+    } else if (strncmp(query_command, "select_agg", 10) == 0) {
+      query_command += 10;
+      dbo = parse_select_agg(query_command, context, handle);
     } else if (strncmp(query_command, "select", 6) == 0) {
       query_command += 6;
       dbo = parse_select(query_command, send_message, handle, context);
@@ -1146,9 +1351,27 @@ DbOperator* parse_command(char* query_command, message* send_message,
       query_command += 3;
       dbo = parse_binary_op(query_command, context, handle);
       if (dbo != NULL) dbo->type = SUB;
+    } else if (strncmp(query_command, "and", 3) == 0) {
+      query_command += 3;
+      dbo = parse_bitwise_op(query_command, context, handle, AND);
+    } else if (strncmp(query_command, "or", 2) == 0) {
+      query_command += 2;
+      dbo = parse_bitwise_op(query_command, context, handle, OR);
+    } else if (strncmp(query_command, "not", 3) == 0) {
+      query_command += 3;
+      dbo = parse_bitwise_op(query_command, context, handle, NOT);
     } else if (strncmp(query_command, "join", 4) == 0) {
       query_command += 4;
       dbo = parse_join(query_command, context, handle);
+    } else if (strncmp(query_command, "count_distinct", 14) == 0) {
+      query_command += 14;
+      dbo = parse_count(query_command, context, handle, COUNT_DISTINCT);
+    } else if (strncmp(query_command, "count", 5) == 0) {
+      query_command += 5;
+      dbo = parse_count(query_command, context, handle, COUNT);
+    } else if (strncmp(query_command, "group_by", 8) == 0) {
+      query_command += 8;
+      dbo = parse_group_by(query_command, context, handle);
     } else if (strncmp(query_command, "batch_queries()", 15) == 0) {
       dbo = malloc(sizeof(DbOperator));
       dbo->type = BATCH_QUERIES;
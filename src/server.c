@@ -26,6 +26,7 @@
 #include "common.h"
 #include "db_index.h"
 #include "db_persist.h"
+#include "db_threadpool.h"
 #include "main_api.h"
 #include "message.h"
 #include "parse.h"
@@ -148,6 +149,7 @@ void handle_client(int client_socket) {
   free(recv_buffer);
   free(send_buffer);
   if (shutdown) {
+    threadpool_destroy(g_pool);
     exit(0);
   }
 }
@@ -231,6 +233,10 @@ int main(void) {
     exit(1);
   }
 
+  // workers live for the life of the server, operators submit tasks to them
+  // rather than creating their own threads
+  g_pool = threadpool_create(threadpool_default_size());
+
   int server_socket = setup_server();
   if (server_socket < 0) {
     exit(1);
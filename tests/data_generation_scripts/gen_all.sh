@@ -23,5 +23,7 @@ python3 /db/tests/data_generation_scripts/multicore_scans.py $TBL_SIZE $RAND_SEE
 python3 /db/tests/data_generation_scripts/indexing.py $TBL_SIZE $RAND_SEED ${OUTPUT_TEST_DIR} ${DOCKER_TEST_DIR}
 python3 /db/tests/data_generation_scripts/joins.py $TBL_SIZE $JOIN_DIM1_SIZE $JOIN_DIM2_SIZE $RAND_SEED $ZIPFIAN_PARAM $NUM_UNIQUE_ZIPF ${OUTPUT_TEST_DIR} ${DOCKER_TEST_DIR}
 python3 /db/tests/data_generation_scripts/updates.py $TBL_SIZE $RAND_SEED ${OUTPUT_TEST_DIR} ${DOCKER_TEST_DIR}
+python3 /db/tests/data_generation_scripts/join_variants.py $RAND_SEED ${OUTPUT_TEST_DIR} ${DOCKER_TEST_DIR}
+python3 /db/tests/data_generation_scripts/operators.py $RAND_SEED ${OUTPUT_TEST_DIR} ${DOCKER_TEST_DIR}
 
 echo "DATA GENERATION STEP FINISHED ..."
@@ -0,0 +1,314 @@
+#!/usr/bin/python
+import sys
+import numpy as np
+import pandas as pd
+
+import data_gen_utils
+
+#
+# Example usage:
+#   python join_variants.py 42 /db/tests/gen_tests /db/tests/gen_tests
+#
+
+############################################################################
+# Tests for the join types beyond nested-loop and hash: merge, semi, anti
+# and left-outer joins, joins of duplicate keys, joins with an empty side and
+# a skewed hash join big enough to split out its heavy hitters, deletes
+# through the repeated positions a join returns, joins with an indexed
+# base column, and skewed semi, anti and left-outer joins whose largest
+# partitions are split across several tasks.
+############################################################################
+
+TEST_BASE_DIR = '/db/tests/gen_tests'
+DOCKER_TEST_BASE_DIR = '/db/tests/gen_tests'
+
+LEFT_SIZE = 100000
+RIGHT_SIZE = 20000
+NUM_DISTINCT_ZIPF = 1000
+# the most frequent value is over half of the column, enough to be split out
+# as a heavy hitter
+ZIPFIAN_PARAM = 2.0
+
+
+def zipfianArray(zipfianParam, numElements, arraySize):
+    weights = 1.0 / np.power(np.arange(1, numElements + 1), zipfianParam)
+    return np.random.choice(np.arange(1, numElements + 1), size=arraySize, p=weights / weights.sum())
+
+
+def generateDataMilestone6():
+    outputFile1 = TEST_BASE_DIR + '/' + 'data6_left.csv'
+    outputFile2 = TEST_BASE_DIR + '/' + 'data6_right.csv'
+    header_line_left = data_gen_utils.generateHeaderLine('db1', 'tbl6_left', 3)
+    header_line_right = data_gen_utils.generateHeaderLine('db1', 'tbl6_right', 3)
+    # col1 joins many to many with duplicate keys on both sides, col3 of the
+    # left table is skewed and joins the unique col3 of the right table
+    leftTable = pd.DataFrame({
+        'col1': np.random.randint(0, 2000, size=LEFT_SIZE),
+        'col2': np.random.randint(0, 1000, size=LEFT_SIZE),
+        'col3': zipfianArray(ZIPFIAN_PARAM, NUM_DISTINCT_ZIPF, LEFT_SIZE)})
+    rightTable = pd.DataFrame({
+        'col1': np.random.randint(0, 4000, size=RIGHT_SIZE),
+        'col2': np.random.randint(0, 1000, size=RIGHT_SIZE),
+        'col3': np.arange(1, RIGHT_SIZE + 1)})
+    leftTable.to_csv(outputFile1, sep=',', index=False, header=header_line_left)
+    rightTable.to_csv(outputFile2, sep=',', index=False, header=header_line_right)
+    return leftTable, rightTable
+
+
+def writeSelects(output_file):
+    output_file.write('p1=select(db1.tbl6_left.col2,null,200)\n')
+    output_file.write('p2=select(db1.tbl6_right.col2,null,500)\n')
+    output_file.write('f1=fetch(db1.tbl6_left.col1,p1)\n')
+    output_file.write('f2=fetch(db1.tbl6_right.col1,p2)\n')
+
+
+def preJoin(leftTable, rightTable):
+    return leftTable[leftTable['col2'] < 200], rightTable[rightTable['col2'] < 500]
+
+
+def createTest44():
+    output_file, exp_output_file = data_gen_utils.openFileHandles(44, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Creates tables for the join variant tests\n')
+    output_file.write('create(tbl,"tbl6_left",db1,3)\n')
+    output_file.write('create(col,"col1",db1.tbl6_left)\n')
+    output_file.write('create(col,"col2",db1.tbl6_left)\n')
+    output_file.write('create(col,"col3",db1.tbl6_left)\n')
+    output_file.write('load("' + DOCKER_TEST_BASE_DIR + '/data6_left.csv")\n')
+    output_file.write('--\n')
+    output_file.write('create(tbl,"tbl6_right",db1,3)\n')
+    output_file.write('create(col,"col1",db1.tbl6_right)\n')
+    output_file.write('create(col,"col2",db1.tbl6_right)\n')
+    output_file.write('create(col,"col3",db1.tbl6_right)\n')
+    output_file.write('load("' + DOCKER_TEST_BASE_DIR + '/data6_right.csv")\n')
+    output_file.write('shutdown\n')
+    # no expected results
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest45(leftTable, rightTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(45, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Many to many join of duplicate keys, by hashing and by sort-merge\n')
+    output_file.write('-- SELECT count(*), sum(tbl6_left.col2), sum(tbl6_right.col2) FROM tbl6_left,tbl6_right WHERE tbl6_left.col1=tbl6_right.col1 AND tbl6_left.col2<200 AND tbl6_right.col2<500;\n')
+    writeSelects(output_file)
+    for i, method in enumerate(['hash', 'merge']):
+        output_file.write('t{0}l,t{0}r=join(f1,p1,f2,p2,{1})\n'.format(i, method))
+        output_file.write('v{0}l=fetch(db1.tbl6_left.col2,t{0}l)\n'.format(i))
+        output_file.write('v{0}r=fetch(db1.tbl6_right.col2,t{0}r)\n'.format(i))
+        output_file.write('c{0}=count(v{0}l)\n'.format(i))
+        output_file.write('s{0}l=sum(v{0}l)\n'.format(i))
+        output_file.write('s{0}r=sum(v{0}r)\n'.format(i))
+        output_file.write('print(c{0},s{0}l,s{0}r)\n'.format(i))
+    left, right = preJoin(leftTable, rightTable)
+    joinedTable = left.merge(right, on='col1', suffixes=('', '_right'))
+    for i in range(2):
+        exp_output_file.write('{},{},{}\n'.format(len(joinedTable), joinedTable['col2'].sum(), joinedTable['col2_right'].sum()))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest46(leftTable, rightTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(46, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Semi and anti join, each left row is kept at most once\n')
+    output_file.write('-- SELECT count(*), sum(col2) FROM tbl6_left WHERE col2<200 AND [NOT] EXISTS (SELECT * FROM tbl6_right WHERE tbl6_right.col1=tbl6_left.col1 AND tbl6_right.col2<500);\n')
+    writeSelects(output_file)
+    for method in ['semi', 'anti']:
+        output_file.write('{0}=join(f1,p1,f2,p2,{0})\n'.format(method))
+        output_file.write('{0}v=fetch(db1.tbl6_left.col2,{0})\n'.format(method))
+        output_file.write('{0}c=count({0}v)\n'.format(method))
+        output_file.write('{0}s=sum({0}v)\n'.format(method))
+        output_file.write('print({0}c,{0}s)\n'.format(method))
+    left, right = preJoin(leftTable, rightTable)
+    matched = left['col1'].isin(right['col1'])
+    for rows in [left[matched], left[~matched]]:
+        exp_output_file.write('{},{}\n'.format(len(rows), rows['col2'].sum()))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest47(leftTable, rightTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(47, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Left outer join. Unmatched left rows are paired with a null right\n')
+    output_file.write('-- position, which is not counted, fetches as 0 and is skipped by updates\n')
+    writeSelects(output_file)
+    output_file.write('l,r=join(f1,p1,f2,p2,left-outer)\n')
+    output_file.write('lv=fetch(db1.tbl6_left.col2,l)\n')
+    output_file.write('rv=fetch(db1.tbl6_right.col2,r)\n')
+    output_file.write('cl=count(l)\n')
+    output_file.write('cr=count(r)\n')
+    output_file.write('sl=sum(lv)\n')
+    output_file.write('sr=sum(rv)\n')
+    output_file.write('print(cl,cr,sl,sr)\n')
+    output_file.write('-- the null rows are left out of selects over the right positions\n')
+    output_file.write('rs=select(r,rv,null,null)\n')
+    output_file.write('crs=count(rs)\n')
+    output_file.write('print(crs)\n')
+    left, right = preJoin(leftTable, rightTable)
+    joinedTable = left.merge(right, on='col1', how='left', suffixes=('', '_right'))
+    numMatched = int(joinedTable['col2_right'].notna().sum())
+    exp_output_file.write('{},{},{},{}\n'.format(len(joinedTable), numMatched, joinedTable['col2'].sum(), int(joinedTable['col2_right'].fillna(0).sum())))
+    exp_output_file.write('{}\n'.format(numMatched))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest48(leftTable, rightTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(48, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Joins with an empty side\n')
+    writeSelects(output_file)
+    output_file.write('e=select(db1.tbl6_right.col2,null,-1)\n')
+    output_file.write('fe=fetch(db1.tbl6_right.col1,e)\n')
+    left, right = preJoin(leftTable, rightTable)
+    for method in ['hash', 'merge', 'nested-loop']:
+        output_file.write('-- {} join with an empty right and an empty left side\n'.format(method))
+        output_file.write('x1,x2=join(f1,p1,fe,e,{})\n'.format(method))
+        output_file.write('y1,y2=join(fe,e,f2,p2,{})\n'.format(method))
+        output_file.write('cx=count(x1)\n')
+        output_file.write('cy=count(y2)\n')
+        output_file.write('print(cx,cy)\n')
+        exp_output_file.write('0,0\n')
+    output_file.write('-- semi and anti joins keep no and every left row\n')
+    output_file.write('s=join(f1,p1,fe,e,semi)\n')
+    output_file.write('a=join(f1,p1,fe,e,anti)\n')
+    output_file.write('cs=count(s)\n')
+    output_file.write('ca=count(a)\n')
+    output_file.write('print(cs,ca)\n')
+    exp_output_file.write('0,{}\n'.format(len(left)))
+    output_file.write('-- every left row of a left outer join is unmatched\n')
+    output_file.write('l,r=join(f1,p1,fe,e,left-outer)\n')
+    output_file.write('cl=count(l)\n')
+    output_file.write('cr=count(r)\n')
+    output_file.write('print(cl,cr)\n')
+    exp_output_file.write('{},0\n'.format(len(left)))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest49(leftTable, rightTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(49, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Hash join of a zipfian column, whose heavy hitters are joined apart\n')
+    output_file.write('-- SELECT count(*), sum(tbl6_left.col2), sum(tbl6_right.col2) FROM tbl6_left,tbl6_right WHERE tbl6_left.col3=tbl6_right.col3;\n')
+    output_file.write('p3=select(db1.tbl6_left.col2,null,null)\n')
+    output_file.write('p4=select(db1.tbl6_right.col2,null,null)\n')
+    output_file.write('f3=fetch(db1.tbl6_left.col3,p3)\n')
+    output_file.write('f4=fetch(db1.tbl6_right.col3,p4)\n')
+    output_file.write('t1,t2=join(f3,p3,f4,p4,hash)\n')
+    output_file.write('v1=fetch(db1.tbl6_left.col2,t1)\n')
+    output_file.write('v2=fetch(db1.tbl6_right.col2,t2)\n')
+    output_file.write('c=count(v1)\n')
+    output_file.write('s1=sum(v1)\n')
+    output_file.write('s2=sum(v2)\n')
+    output_file.write('print(c,s1,s2)\n')
+    joinedTable = leftTable.merge(rightTable, on='col3', suffixes=('', '_right'))
+    exp_output_file.write('{},{},{}\n'.format(len(joinedTable), joinedTable['col2'].sum(), joinedTable['col2_right'].sum()))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest50(leftTable, rightTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(50, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Deletes the right rows of a join, which repeat once per left match.\n')
+    output_file.write('-- Each row is deleted once, and deleting them again changes nothing\n')
+    writeSelects(output_file)
+    output_file.write('t1,t2=join(f1,p1,f2,p2,hash)\n')
+    for i in range(2):
+        output_file.write('relational_delete(db1.tbl6_right,t2)\n')
+        output_file.write('c{0}=count(db1.tbl6_right.col2)\n'.format(i))
+        output_file.write('s{0}=sum(db1.tbl6_right.col2)\n'.format(i))
+        output_file.write('print(c{0},s{0})\n'.format(i))
+    left, right = preJoin(leftTable, rightTable)
+    keptTable = rightTable[~rightTable.index.isin(right[right['col1'].isin(left['col1'])].index)]
+    for i in range(2):
+        exp_output_file.write('{},{}\n'.format(len(keptTable), keptTable['col2'].sum()))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+    return keptTable
+
+
+def createTest57(leftTable, rightTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(57, TEST_DIR=TEST_BASE_DIR)
+    outputFile = TEST_BASE_DIR + '/' + 'data6_indexed.csv'
+    header_line = data_gen_utils.generateHeaderLine('db1', 'tbl6_indexed', 2)
+    rightTable[['col1', 'col2']].to_csv(outputFile, sep=',', index=False, header=header_line)
+    output_file.write('-- Joins a small result with a base column that has a B-tree. The column has\n')
+    output_file.write('-- many more rows than the result, so the join probes the index, before and\n')
+    output_file.write('-- after pending inserts and deletes\n')
+    output_file.write('create(tbl,"tbl6_indexed",db1,2)\n')
+    output_file.write('create(col,"col1",db1.tbl6_indexed)\n')
+    output_file.write('create(col,"col2",db1.tbl6_indexed)\n')
+    output_file.write('create(idx,db1.tbl6_indexed.col1,btree,unclustered)\n')
+    output_file.write('load("' + DOCKER_TEST_BASE_DIR + '/data6_indexed.csv")\n')
+    output_file.write('p=select(db1.tbl6_left.col2,null,2)\n')
+    output_file.write('f=fetch(db1.tbl6_left.col1,p)\n')
+    insertedRows = [[int(leftTable['col1'][leftTable['col2'] < 2].iloc[0]), 5000], [5000, 5001]]
+    indexedTable = rightTable[['col1', 'col2']]
+    for i in range(2):
+        output_file.write('t1,t2=join(f,p,db1.tbl6_indexed.col1,db1.tbl6_indexed.col1,hash)\n')
+        output_file.write('v1=fetch(db1.tbl6_left.col2,t1)\n')
+        output_file.write('v2=fetch(db1.tbl6_indexed.col2,t2)\n')
+        output_file.write('c=count(v1)\n')
+        output_file.write('s1=sum(v1)\n')
+        output_file.write('s2=sum(v2)\n')
+        output_file.write('print(c,s1,s2)\n')
+        joinedTable = leftTable[leftTable['col2'] < 2].merge(indexedTable, on='col1', suffixes=('', '_right'))
+        exp_output_file.write('{},{},{}\n'.format(len(joinedTable), joinedTable['col2'].sum(), joinedTable['col2_right'].sum()))
+        if i == 0:
+            output_file.write('d=select(db1.tbl6_indexed.col2,null,100)\n')
+            output_file.write('relational_delete(db1.tbl6_indexed,d)\n')
+            for row in insertedRows:
+                output_file.write('relational_insert(db1.tbl6_indexed,{},{})\n'.format(row[0], row[1]))
+            indexedTable = indexedTable[~(indexedTable['col2'] < 100)]
+            indexedTable = pd.concat([indexedTable, pd.DataFrame(insertedRows, columns=indexedTable.columns)], ignore_index=True)
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest58(leftTable, rightTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(58, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Left outer, semi and anti joins of a zipfian column. They keep the heavy\n')
+    output_file.write('-- hitters in their partitions, which are split into chunks that share one\n')
+    output_file.write('-- hash table of the right side\n')
+    output_file.write('p3=select(db1.tbl6_left.col2,null,null)\n')
+    output_file.write('p4=select(db1.tbl6_right.col2,null,500)\n')
+    output_file.write('f3=fetch(db1.tbl6_left.col3,p3)\n')
+    output_file.write('f4=fetch(db1.tbl6_right.col3,p4)\n')
+    output_file.write('l,r=join(f3,p3,f4,p4,left-outer)\n')
+    output_file.write('lv=fetch(db1.tbl6_left.col2,l)\n')
+    output_file.write('cl=count(l)\n')
+    output_file.write('cr=count(r)\n')
+    output_file.write('sl=sum(lv)\n')
+    output_file.write('print(cl,cr,sl)\n')
+    for method in ['semi', 'anti']:
+        output_file.write('{0}=join(f3,p3,f4,p4,{0})\n'.format(method))
+        output_file.write('{0}v=fetch(db1.tbl6_left.col2,{0})\n'.format(method))
+        output_file.write('{0}c=count({0}v)\n'.format(method))
+        output_file.write('{0}s=sum({0}v)\n'.format(method))
+        output_file.write('print({0}c,{0}s)\n'.format(method))
+    right = rightTable[rightTable['col2'] < 500]
+    joinedTable = leftTable.merge(right, on='col3', how='left', suffixes=('', '_right'))
+    exp_output_file.write('{},{},{}\n'.format(len(joinedTable), int(joinedTable['col2_right'].notna().sum()), joinedTable['col2'].sum()))
+    matched = leftTable['col3'].isin(right['col3'])
+    for rows in [leftTable[matched], leftTable[~matched]]:
+        exp_output_file.write('{},{}\n'.format(len(rows), rows['col2'].sum()))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def generateMilestoneSixFiles(randomSeed=47):
+    np.random.seed(randomSeed)
+    leftTable, rightTable = generateDataMilestone6()
+    createTest44()
+    createTest45(leftTable, rightTable)
+    createTest46(leftTable, rightTable)
+    createTest47(leftTable, rightTable)
+    createTest48(leftTable, rightTable)
+    createTest49(leftTable, rightTable)
+    keptTable = createTest50(leftTable, rightTable)
+    createTest57(leftTable, rightTable)
+    createTest58(leftTable, keptTable)
+
+
+def main(argv):
+    global TEST_BASE_DIR
+    global DOCKER_TEST_BASE_DIR
+
+    randomSeed = int(argv[0]) if len(argv) > 0 else 47
+    if len(argv) > 1:
+        TEST_BASE_DIR = argv[1]
+    if len(argv) > 2:
+        DOCKER_TEST_BASE_DIR = argv[2]
+    generateMilestoneSixFiles(randomSeed=randomSeed)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
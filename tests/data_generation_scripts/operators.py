@@ -0,0 +1,185 @@
+#!/usr/bin/python
+import sys
+import numpy as np
+import pandas as pd
+
+import data_gen_utils
+
+#
+# Example usage:
+#   python operators.py 42 /db/tests/gen_tests /db/tests/gen_tests
+#
+
+############################################################################
+# Tests for the operators added alongside the join variants: and/or/not of
+# selects, select_agg, group_by, count and count_distinct, and the column
+# statistics that answer aggregates of a base column after inserts, updates
+# and deletes, and a delete of more rows than UPDATE_BATCH_SIZE.
+############################################################################
+
+TEST_BASE_DIR = '/db/tests/gen_tests'
+DOCKER_TEST_BASE_DIR = '/db/tests/gen_tests'
+
+# several morsels, so that group_by merges the tables of its workers
+DATA_SIZE = 100000
+NUM_GROUPS = 50
+# UPDATE_BATCH_SIZE in main_api.h
+UPDATE_BATCH_SIZE = 15000
+
+
+def generateDataMilestone6():
+    outputFile = TEST_BASE_DIR + '/' + 'data7.csv'
+    header_line = data_gen_utils.generateHeaderLine('db1', 'tbl7', 4)
+    outputTable = pd.DataFrame({
+        'col1': np.random.randint(0, 1000, size=DATA_SIZE),
+        'col2': np.random.randint(0, 1000, size=DATA_SIZE),
+        'col3': np.random.randint(-10000, 10000, size=DATA_SIZE),
+        'col4': np.random.randint(0, NUM_GROUPS, size=DATA_SIZE)})
+    outputTable.to_csv(outputFile, sep=',', index=False, header=header_line)
+    return outputTable
+
+
+def createTest51():
+    output_file, exp_output_file = data_gen_utils.openFileHandles(51, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Creates the table for the operator tests\n')
+    output_file.write('create(tbl,"tbl7",db1,4)\n')
+    output_file.write('create(col,"col1",db1.tbl7)\n')
+    output_file.write('create(col,"col2",db1.tbl7)\n')
+    output_file.write('create(col,"col3",db1.tbl7)\n')
+    output_file.write('create(col,"col4",db1.tbl7)\n')
+    output_file.write('load("' + DOCKER_TEST_BASE_DIR + '/data7.csv")\n')
+    output_file.write('shutdown\n')
+    # no expected results
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest52(dataTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(52, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Combines selects with and, or and not\n')
+    output_file.write('-- SELECT count(*), sum(col3) FROM tbl7 WHERE col1 < 300 AND|OR col2 >= 500;\n')
+    output_file.write('-- SELECT count(*), sum(col3) FROM tbl7 WHERE NOT col1 < 300;\n')
+    output_file.write('s1=select(db1.tbl7.col1,null,300)\n')
+    output_file.write('s2=select(db1.tbl7.col2,500,null)\n')
+    output_file.write('a=and(s1,s2)\n')
+    output_file.write('o=or(s1,s2)\n')
+    output_file.write('n=not(s1)\n')
+    for handle in ['a', 'o', 'n']:
+        output_file.write('f{0}=fetch(db1.tbl7.col3,{0})\n'.format(handle))
+        output_file.write('c{0}=count({0})\n'.format(handle))
+        output_file.write('s{0}=sum(f{0})\n'.format(handle))
+        output_file.write('print(c{0},s{0})\n'.format(handle))
+    mask1 = dataTable['col1'] < 300
+    mask2 = dataTable['col2'] >= 500
+    for mask in [mask1 & mask2, mask1 | mask2, ~mask1]:
+        exp_output_file.write('{},{}\n'.format(int(mask.sum()), dataTable['col3'][mask].sum()))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest53(dataTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(53, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Fused select and aggregate, then a group by\n')
+    output_file.write('-- SELECT sum(col3), avg(col3), min(col3), max(col3) FROM tbl7 WHERE col1 >= 100 AND col1 < 400;\n')
+    for agg in ['sum', 'avg', 'min', 'max']:
+        output_file.write('{0}=select_agg(db1.tbl7.col1,100,400,db1.tbl7.col3,{0})\n'.format(agg))
+    output_file.write('print(sum,avg,min,max)\n')
+    output_file.write('-- SELECT col4, sum(col3), max(col2), avg(col1) FROM tbl7 GROUP BY col4 ORDER BY col4;\n')
+    output_file.write('g,gs,gm,ga=group_by(db1.tbl7.col4,db1.tbl7.col3,sum,db1.tbl7.col2,max,db1.tbl7.col1,avg)\n')
+    output_file.write('print(g,gs,gm,ga)\n')
+    values = dataTable['col3'][(dataTable['col1'] >= 100) & (dataTable['col1'] < 400)]
+    exp_output_file.write('{},{:0.2f},{},{}\n'.format(values.sum(), values.sum() / len(values), values.min(), values.max()))
+    for key, group in dataTable.groupby('col4'):
+        exp_output_file.write('{},{},{},{:0.2f}\n'.format(key, group['col3'].sum(), group['col2'].max(), group['col1'].sum() / len(group)))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def createTest54(dataTable):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(54, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Aggregates of base columns after inserts, updates and deletes, which\n')
+    output_file.write('-- are answered from the column statistics\n')
+    insertedRows = [[-5, 100, 5000, NUM_GROUPS], [2000, 600, -20000, NUM_GROUPS]]
+    for row in insertedRows:
+        output_file.write('relational_insert(db1.tbl7,{})\n'.format(','.join(str(v) for v in row)))
+    output_file.write('u=select(db1.tbl7.col1,990,null)\n')
+    output_file.write('relational_update(db1.tbl7.col3,u,20000)\n')
+    output_file.write('d=select(db1.tbl7.col2,null,5)\n')
+    output_file.write('relational_delete(db1.tbl7,d)\n')
+    output_file.write('c=count(db1.tbl7.col3)\n')
+    output_file.write('s=sum(db1.tbl7.col3)\n')
+    output_file.write('a=avg(db1.tbl7.col3)\n')
+    output_file.write('mn=min(db1.tbl7.col3)\n')
+    output_file.write('mx=max(db1.tbl7.col3)\n')
+    output_file.write('m1=min(db1.tbl7.col1)\n')
+    output_file.write('print(c,s,a,mn,mx,m1)\n')
+    output_file.write('cd=count_distinct(db1.tbl7.col4)\n')
+    output_file.write('print(cd)\n')
+    table = pd.concat([dataTable, pd.DataFrame(insertedRows, columns=dataTable.columns)], ignore_index=True)
+    table.loc[table['col1'] >= 990, 'col3'] = 20000
+    table = table[~(table['col2'] < 5)]
+    values = table['col3']
+    exp_output_file.write('{},{},{:0.2f},{},{},{}\n'.format(len(values), values.sum(), values.sum() / len(values), values.min(), values.max(), table['col1'].min()))
+    exp_output_file.write('{}\n'.format(table['col4'].nunique()))
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+    return table
+
+
+def writeDeleteChecks(output_file, exp_output_file, table):
+    output_file.write('s=select(db1.tbl7.col1,500,600)\n')
+    output_file.write('f=fetch(db1.tbl7.col3,s)\n')
+    output_file.write('c=count(f)\n')
+    output_file.write('sm=sum(f)\n')
+    output_file.write('ca=count(db1.tbl7.col1)\n')
+    output_file.write('sa=sum(db1.tbl7.col3)\n')
+    output_file.write('print(c,sm,ca,sa)\n')
+    values = table['col3'][(table['col1'] >= 500) & (table['col1'] < 600)]
+    exp_output_file.write('{},{},{},{}\n'.format(len(values), values.sum(), len(table), table['col3'].sum()))
+
+
+def createTest55(table):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(55, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- Deletes more rows than fit in one batch of pending deletes, and a\n')
+    output_file.write('-- pending insert among them. The deleted positions must stay valid\n')
+    output_file.write('-- while the delete runs\n')
+    insertedRow = [550, 100, 7, 0]
+    output_file.write('relational_insert(db1.tbl7,{})\n'.format(','.join(str(v) for v in insertedRow)))
+    output_file.write('d=select(db1.tbl7.col2,null,200)\n')
+    output_file.write('relational_delete(db1.tbl7,d)\n')
+    table = pd.concat([table, pd.DataFrame([insertedRow], columns=table.columns)], ignore_index=True)
+    assert (table['col2'] < 200).sum() > UPDATE_BATCH_SIZE
+    table = table[~(table['col2'] < 200)]
+    writeDeleteChecks(output_file, exp_output_file, table)
+    output_file.write('shutdown\n')
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+    return table
+
+
+def createTest56(table):
+    output_file, exp_output_file = data_gen_utils.openFileHandles(56, TEST_DIR=TEST_BASE_DIR)
+    output_file.write('-- The deletes of test 55 are flushed at shutdown and persisted\n')
+    writeDeleteChecks(output_file, exp_output_file, table)
+    data_gen_utils.closeFileHandles(output_file, exp_output_file)
+
+
+def generateMilestoneSixFiles(randomSeed=47):
+    np.random.seed(randomSeed)
+    dataTable = generateDataMilestone6()
+    createTest51()
+    createTest52(dataTable)
+    createTest53(dataTable)
+    table = createTest54(dataTable)
+    table = createTest55(table)
+    createTest56(table)
+
+
+def main(argv):
+    global TEST_BASE_DIR
+    global DOCKER_TEST_BASE_DIR
+
+    randomSeed = int(argv[0]) if len(argv) > 0 else 47
+    if len(argv) > 1:
+        TEST_BASE_DIR = argv[1]
+    if len(argv) > 2:
+        DOCKER_TEST_BASE_DIR = argv[2]
+    generateMilestoneSixFiles(randomSeed=randomSeed)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])